@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <block_cache.h>
+#include <riscv_helper.h>
+
+void block_cache_init(block_cache_td *block_cache)
+{
+    memset(block_cache, 0, sizeof(block_cache_td));
+
+    block_cache->blocks = calloc(BLOCK_CACHE_NR_BLOCKS, sizeof(block_td));
+    block_cache->jump_cache = calloc(BLOCK_CACHE_JUMP_CACHE_SIZE, sizeof(block_link_td));
+    block_cache->page_gen = calloc(BLOCK_CACHE_NR_PAGES, sizeof(uint32_t));
+    block_cache->page_has_code = calloc(BLOCK_CACHE_NR_PAGES, sizeof(uint8_t));
+
+    if( (block_cache->blocks == NULL) || (block_cache->jump_cache == NULL) ||
+        (block_cache->page_gen == NULL) || (block_cache->page_has_code == NULL) )
+        die_msg("Could not allocate block cache!\n");
+
+    /* links with epoch 0 are the ones which were never set */
+    block_cache->epoch = 1;
+}
+
+void block_cache_flush(block_cache_td *block_cache)
+{
+    unsigned int i = 0;
+
+    for(i=0;i<BLOCK_CACHE_NR_BLOCKS;i++)
+        block_cache->blocks[i].valid = 0;
+
+    block_cache_new_epoch(block_cache);
+}
+
+void block_cache_new_epoch(block_cache_td *block_cache)
+{
+    block_cache->epoch++;
+
+    /* On a wrap around old links could become valid again, so drop all of them */
+    if(block_cache->epoch == 0)
+    {
+        unsigned int i = 0;
+
+        memset(block_cache->jump_cache, 0, BLOCK_CACHE_JUMP_CACHE_SIZE * sizeof(block_link_td));
+        memset(block_cache->ras, 0, sizeof(block_cache->ras));
+        for(i=0;i<BLOCK_CACHE_NR_BLOCKS;i++)
+        {
+            memset(&block_cache->blocks[i].link_taken, 0, sizeof(block_link_td));
+            memset(&block_cache->blocks[i].link_next, 0, sizeof(block_link_td));
+        }
+
+        block_cache->epoch = 1;
+    }
+}
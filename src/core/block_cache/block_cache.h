@@ -0,0 +1,204 @@
+#ifndef RISCV_BLOCK_CACHE_H
+#define RISCV_BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <riscv_types.h>
+
+#include <decode_cache.h>
+
+#define BLOCK_CACHE_PAGE_SHIFT 12
+
+typedef struct block_struct block_td;
+
+typedef enum
+{
+    block_exit_fallthrough = 0, /* page end, max length, stop pc or a system instruction reached */
+    block_exit_branch,
+    block_exit_jal,
+    block_exit_jalr,
+    block_exit_system           /* CSR access, ECALL, xRET, WFI, SFENCE.VMA... */
+
+} block_exit_type;
+
+/* A remembered transition to a block. It stays usable as long as the translation epoch
+ * did not change and the block it points to still holds the same code.
+ */
+typedef struct block_link_struct
+{
+    rv_uint_xlen virt_pc;
+    uint64_t phys_pc;
+    privilege_level priv;
+    uint32_t epoch;
+    block_td *block;
+
+} block_link_td;
+
+struct block_struct
+{
+    /* tag */
+    uint64_t phys_pc;
+    privilege_level priv;
+    uint32_t gen;
+    uint8_t valid;
+
+    uint8_t exit_type;
+    uint16_t nr_instr;
+
+    /* branch or jal target, for jalr this is the per-site target cache */
+    block_link_td link_taken;
+    /* fall-through, or the return site if the block ends with a call */
+    block_link_td link_next;
+
+    #ifdef JIT_SUPPORT
+        /* host code once the block got hot, see jit.c */
+        uint8_t *jit_code;
+        uint32_t build_id;
+        uint16_t exec_count;
+        uint8_t jit_requested;
+    #endif
+
+    decode_cache_entry_td instr[BLOCK_CACHE_MAX_INSTR];
+};
+
+typedef struct block_cache_struct
+{
+    /* direct mapped by physical pc */
+    block_td *blocks;
+
+    /* virtual pc -> block, used when there is no link to follow */
+    block_link_td *jump_cache;
+
+    /* Code page tracking for self-modifying code, indexed by the hashed physical page number.
+     * A store to a page which holds blocks bumps its generation, which invalidates all of them.
+     */
+    uint32_t *page_gen;
+    uint8_t *page_has_code;
+    uint8_t code_modified;
+
+    /* Bumped whenever virtual to physical translations might have changed */
+    uint32_t epoch;
+
+    /* return address stack, holds the return site links of the callers */
+    block_link_td *ras[BLOCK_CACHE_RAS_SIZE];
+    unsigned int ras_top;
+
+    #ifdef JIT_SUPPORT
+        uint32_t build_count;
+    #endif
+
+} block_cache_td;
+
+void block_cache_init(block_cache_td *block_cache);
+void block_cache_flush(block_cache_td *block_cache);
+void block_cache_new_epoch(block_cache_td *block_cache);
+
+static inline unsigned int block_cache_page_index(uint64_t phys_addr)
+{
+    return (phys_addr >> BLOCK_CACHE_PAGE_SHIFT) & (BLOCK_CACHE_NR_PAGES-1);
+}
+
+static inline block_td *block_cache_slot(block_cache_td *block_cache, uint64_t phys_pc)
+{
+    return &block_cache->blocks[(phys_pc >> 2) & (BLOCK_CACHE_NR_BLOCKS-1)];
+}
+
+static inline int block_is_valid(block_cache_td *block_cache, block_td *block, uint64_t phys_pc, privilege_level priv)
+{
+    return block->valid &&
+           (block->phys_pc == phys_pc) &&
+           (block->priv == priv) &&
+           (block->gen == block_cache->page_gen[block_cache_page_index(phys_pc)]);
+}
+
+/* Returns 1 if the page did not hold any code before */
+static inline int block_cache_mark_code_page(block_cache_td *block_cache, block_td *block)
+{
+    unsigned int page_index = block_cache_page_index(block->phys_pc);
+    int newly_marked = !block_cache->page_has_code[page_index];
+
+    block_cache->page_has_code[page_index] = 1;
+    block->gen = block_cache->page_gen[page_index];
+
+    return newly_marked;
+}
+
+static inline int block_cache_page_has_code(block_cache_td *block_cache, uint64_t phys_addr)
+{
+    /* block engine not in use */
+    if(block_cache->page_has_code == NULL)
+        return 0;
+
+    return block_cache->page_has_code[block_cache_page_index(phys_addr)];
+}
+
+static inline void block_cache_notify_write(block_cache_td *block_cache, uint64_t phys_addr, uint8_t len)
+{
+    unsigned int page_index = 0;
+
+    /* block engine not in use */
+    if(block_cache->page_has_code == NULL)
+        return;
+
+    page_index = block_cache_page_index(phys_addr);
+    if(block_cache->page_has_code[page_index])
+    {
+        block_cache->page_has_code[page_index] = 0;
+        block_cache->page_gen[page_index]++;
+        block_cache->code_modified = 1;
+    }
+
+    /* the access might cross a page boundary */
+    page_index = block_cache_page_index(phys_addr + len - 1);
+    if(block_cache->page_has_code[page_index])
+    {
+        block_cache->page_has_code[page_index] = 0;
+        block_cache->page_gen[page_index]++;
+        block_cache->code_modified = 1;
+    }
+}
+
+static inline block_td *block_link_get(block_cache_td *block_cache, block_link_td *link, rv_uint_xlen virt_pc, privilege_level priv)
+{
+    block_td *block = link->block;
+
+    if( (block != NULL) &&
+        (link->virt_pc == virt_pc) &&
+        (link->priv == priv) &&
+        (link->epoch == block_cache->epoch) &&
+        block_is_valid(block_cache, block, link->phys_pc, priv) )
+        return block;
+
+    return NULL;
+}
+
+static inline void block_link_set(block_cache_td *block_cache, block_link_td *link, rv_uint_xlen virt_pc, privilege_level priv, block_td *block)
+{
+    link->virt_pc = virt_pc;
+    link->phys_pc = block->phys_pc;
+    link->priv = priv;
+    link->epoch = block_cache->epoch;
+    link->block = block;
+}
+
+static inline block_link_td *block_cache_jump_cache_entry(block_cache_td *block_cache, rv_uint_xlen virt_pc)
+{
+    return &block_cache->jump_cache[(virt_pc >> 2) & (BLOCK_CACHE_JUMP_CACHE_SIZE-1)];
+}
+
+static inline void block_cache_ras_push(block_cache_td *block_cache, block_link_td *link)
+{
+    block_cache->ras_top = (block_cache->ras_top + 1) % BLOCK_CACHE_RAS_SIZE;
+    block_cache->ras[block_cache->ras_top] = link;
+}
+
+static inline block_link_td *block_cache_ras_pop(block_cache_td *block_cache)
+{
+    block_link_td *link = block_cache->ras[block_cache->ras_top];
+
+    block_cache->ras[block_cache->ras_top] = NULL;
+    block_cache->ras_top = (block_cache->ras_top + BLOCK_CACHE_RAS_SIZE - 1) % BLOCK_CACHE_RAS_SIZE;
+
+    return link;
+}
+
+#endif /* RISCV_BLOCK_CACHE_H */
@@ -57,9 +57,71 @@ rv_ret pmp_checked_bus_access(void *priv, privilege_level priv_level, bus_access
         return rv_err;
     }
 
+    #ifdef BLOCK_CACHE_SUPPORT
+        if(access_type == bus_write_access)
+            block_cache_notify_write(&rv_core->block_cache, addr, len);
+    #endif
+
     return rv_core->bus_access(rv_core->priv, priv_level, access_type, addr, value, len);
 }
 
+#ifdef TLB_SUPPORT
+    /* Host memory of a physical page, if it is plain memory fully accessible according to the PMP */
+    static uint8_t *rv_core_host_page(rv_core_td *rv_core, privilege_level priv_level, bus_access_type access_type, uint64_t phys_page)
+    {
+        uint8_t *host_page = NULL;
+
+        if(rv_core->bus_host_ptr == NULL)
+            return NULL;
+
+        /* physical addresses beyond XLEN can't be on the bus anyway */
+        if(phys_page != (rv_uint_xlen)phys_page)
+            return NULL;
+
+        host_page = rv_core->bus_host_ptr(rv_core->priv, phys_page, TLB_PAGE_SIZE);
+        if(host_page == NULL)
+            return NULL;
+
+        if(pmp_mem_check_range(&rv_core->pmp, priv_level, phys_page, TLB_PAGE_SIZE, access_type) != rv_ok)
+            return NULL;
+
+        return host_page;
+    }
+
+    /* Only pages which are plain memory, fully accessible according to the PMP and, for stores,
+     * hold no translated code are cached. Everything else keeps using the checked slow path.
+     */
+    static void rv_core_tlb_fill(rv_core_td *rv_core, tlb_entry_td *tlb_entry, rv_uint_xlen tlb_tag, privilege_level priv_level, bus_access_type access_type, uint64_t phys_addr)
+    {
+        uint64_t phys_page = phys_addr & ~(uint64_t)TLB_PAGE_MASK;
+        uint8_t *host_page = rv_core_host_page(rv_core, priv_level, access_type, phys_page);
+
+        if(host_page == NULL)
+            return;
+
+        #ifdef BLOCK_CACHE_SUPPORT
+            if( (access_type == bus_write_access) && block_cache_page_has_code(&rv_core->block_cache, phys_page) )
+                return;
+        #endif
+
+        tlb_fill(&rv_core->mmu.tlb, tlb_entry, tlb_tag, host_page, phys_page, rv_core->mmu.last_global, rv_core->mmu.last_page_shift);
+    }
+
+    /* Page tables are accessed directly if they are plain memory and accessible according to the PMP */
+    static uint8_t *pmp_checked_table_ptr(void *priv, privilege_level priv_level, bus_access_type access_type, uint64_t table_addr)
+    {
+        #ifdef BLOCK_CACHE_SUPPORT
+            rv_core_td *rv_core = priv;
+
+            /* same as for the TLB, stores to pages with translated code have to go through the write hook */
+            if( (access_type == bus_write_access) && block_cache_page_has_code(&rv_core->block_cache, table_addr) )
+                return NULL;
+        #endif
+
+        return rv_core_host_page(priv, priv_level, access_type, table_addr);
+    }
+#endif
+
 rv_ret mmu_checked_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen addr, void *value, uint8_t len)
 {
     (void) priv_level;
@@ -73,6 +135,19 @@ rv_ret mmu_checked_bus_access(void *priv, privilege_level priv_level, bus_access
     uint8_t mxr = CHECK_BIT(*rv_core->trap.m.regs[trap_reg_status], TRAP_XSTATUS_MXR_BIT) ? 1 : 0;
     uint8_t sum = CHECK_BIT(*rv_core->trap.m.regs[trap_reg_status], TRAP_XSTATUS_SUM_BIT) ? 1 : 0;
 
+    #ifdef TLB_SUPPORT
+        /* MXR only affects loads */
+        tlb_entry_td *tlb_entry = tlb_get_entry(&rv_core->mmu.tlb, internal_priv_level, access_type, addr);
+        rv_uint_xlen tlb_tag = tlb_make_tag(addr, (access_type == bus_read_access) ? mxr : 0, sum);
+
+        /* instruction fetches have their own fast path, see rv_core_fetch() */
+        if( (access_type != bus_instr_access) && tlb_hit(&rv_core->mmu.tlb, tlb_entry, tlb_tag, addr, len) )
+        {
+            tlb_access(tlb_entry, access_type, addr, value, len);
+            return rv_ok;
+        }
+    #endif
+
     rv_uint_xlen tmp = 0;
     memcpy(&tmp, value, len);
     uint64_t phys_addr = mmu_virt_to_phys(&rv_core->mmu, internal_priv_level, addr, access_type, mxr, sum, &mmu_ret_val, rv_core, tmp);
@@ -83,7 +158,16 @@ rv_ret mmu_checked_bus_access(void *priv, privilege_level priv_level, bus_access
         return rv_err;
     }
 
-    return rv_core->mmu.bus_access(rv_core->mmu.priv, internal_priv_level, access_type, phys_addr, value, len);
+    #ifdef TLB_SUPPORT
+        if(rv_core->mmu.bus_access(rv_core->mmu.priv, internal_priv_level, access_type, phys_addr, value, len) != rv_ok)
+            return rv_err;
+
+        rv_core_tlb_fill(rv_core, tlb_entry, tlb_tag, internal_priv_level, access_type, phys_addr);
+
+        return rv_ok;
+    #else
+        return rv_core->mmu.bus_access(rv_core->mmu.priv, internal_priv_level, access_type, phys_addr, value, len);
+    #endif
 }
 
 /*
@@ -96,6 +180,34 @@ static void instr_NOP(rv_core_td *rv_core)
     return;
 }
 
+/* FENCE.I has to make stores of other harts visible to instruction fetches, the ones of this hart
+ * are tracked anyway, see block_cache_notify_write(). For FENCE the ordering of plain host loads
+ * and stores is not strong enough if other harts are running at the same time.
+ */
+static void instr_FENCE(rv_core_td *rv_core)
+{
+    CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+
+    if(!rv_core->smp)
+        return;
+
+    if(((rv_core->instruction >> 12) & 0x7) == FUNC3_INSTR_FENCE_I)
+    {
+        #ifdef BLOCK_CACHE_SUPPORT
+            if(rv_core->block_cache.blocks != NULL)
+            {
+                block_cache_flush(&rv_core->block_cache);
+                /* the rest of the current block might be outdated as well */
+                rv_core->block_cache.code_modified = 1;
+            }
+        #endif
+    }
+    else
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
 /* RISCV Instructions */
 static void instr_LUI(rv_core_td *rv_core)
 {
@@ -739,6 +851,14 @@ static void instr_SW(rv_core_td *rv_core)
         rv_core->next_pc = *rv_core->trap.s.regs[trap_reg_epc];
     }
 
+    static void instr_WFI(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        /* an enabled interrupt which is already pending ends the wait right away */
+        if(!(*rv_core->trap.m.regs[trap_reg_ip] & *rv_core->trap.m.regs[trap_reg_ie]))
+            rv_core->wfi = 1;
+    }
+
     static void instr_URET(rv_core_td *rv_core)
     {
         CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
@@ -747,332 +867,399 @@ static void instr_SW(rv_core_td *rv_core)
         /* not implemented */
         (void)rv_core;
     }
+
+    static void instr_SFENCEVMA(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        #ifdef TLB_SUPPORT
+            /* rs1 selects the virtual address and rs2 the ASID, x0 means all of them */
+            uint8_t rs2 = rv_core->immediate & 0x1F;
+            tlb_flush_vma(&rv_core->mmu.tlb, rv_core->rs1 != 0, rv_core->x[rv_core->rs1], rs2 != 0, rv_core->x[rs2] & MMU_ASID_MASK);
+        #else
+            (void)rv_core;
+        #endif
+    }
+
+    /* Svinval: SINVAL.VMA is SFENCE.VMA without the ordering, which is implicit here
+     * as accesses are done one after another. The fences around it have nothing to order.
+     */
+    static void instr_SINVALVMA(rv_core_td *rv_core)
+    {
+        instr_SFENCEVMA(rv_core);
+    }
 #endif
 
 #ifdef ATOMIC_SUPPORT
-    static void instr_LR_W(rv_core_td *rv_core)
+    typedef enum
     {
-        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_core->lr_address = rv_core->x[rv_core->rs1];
-        rv_core->lr_valid = 1;
-        instr_LW(rv_core);
+        amo_swap = 0,
+        amo_add,
+        amo_xor,
+        amo_and,
+        amo_or,
+        amo_min,
+        amo_max,
+        amo_minu,
+        amo_maxu
+
+    } amo_op;
+
+    /* The value an AMO writes back, for the .W variants only the lower 32 bits count */
+    static inline uint64_t amo_result(amo_op op, uint8_t len, uint64_t mem_val, uint64_t rs2_val)
+    {
+        int64_t mem_signed = (len == 4) ? (int32_t)mem_val : (int64_t)mem_val;
+        int64_t rs2_signed = (len == 4) ? (int32_t)rs2_val : (int64_t)rs2_val;
+        uint64_t mem_unsigned = (len == 4) ? (uint32_t)mem_val : mem_val;
+        uint64_t rs2_unsigned = (len == 4) ? (uint32_t)rs2_val : rs2_val;
+
+        switch(op)
+        {
+            case amo_swap: return rs2_val;
+            case amo_add: return mem_val + rs2_val;
+            case amo_xor: return mem_val ^ rs2_val;
+            case amo_and: return mem_val & rs2_val;
+            case amo_or: return mem_val | rs2_val;
+            case amo_min: return ASSIGN_MIN(mem_signed, rs2_signed);
+            case amo_max: return ASSIGN_MAX(mem_signed, rs2_signed);
+            case amo_minu: return ASSIGN_MIN(mem_unsigned, rs2_unsigned);
+            case amo_maxu: return ASSIGN_MAX(mem_unsigned, rs2_unsigned);
+        }
+
+        return rs2_val;
     }
 
-    static void instr_SC_W(rv_core_td *rv_core)
+    /* Misaligned atomics are not split into several accesses, as another hart could get in between */
+    static inline int rv_core_atomic_misaligned(rv_core_td *rv_core, rv_uint_xlen address, uint8_t len, trap_cause_exception cause)
     {
-        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        if(rv_core->lr_valid && (rv_core->lr_address == rv_core->x[rv_core->rs1]))
+        if(!(address & (len-1)))
+            return 0;
+
+        prepare_sync_trap(rv_core, cause, address);
+        return 1;
+    }
+
+    /* Host memory an AMO or SC operates on, so that other harts see it as one single access.
+     * The address has to be aligned, it is translated and checked as for a store, faults are
+     * store/AMO faults. Returns NULL with ret set to rv_ok if the address is no plain memory,
+     * the access then has to go over the bus as a separate load and store.
+     * The caller has to report the physical address to the block cache once it actually wrote.
+     */
+    static uint8_t *rv_core_atomic_host_ptr(rv_core_td *rv_core, rv_uint_xlen address, uint8_t len, uint64_t *phys_addr, rv_ret *ret)
+    {
+        privilege_level priv_level = check_mprv_override(rv_core, bus_write_access);
+        uint8_t sum = CHECK_BIT(*rv_core->trap.m.regs[trap_reg_status], TRAP_XSTATUS_SUM_BIT) ? 1 : 0;
+        mmu_ret mmu_ret_val = mmu_ok;
+
+        *ret = rv_ok;
+
+        #ifdef TLB_SUPPORT
+            tlb_entry_td *tlb_entry = tlb_get_entry(&rv_core->mmu.tlb, priv_level, bus_write_access, address);
+
+            if(tlb_hit(&rv_core->mmu.tlb, tlb_entry, tlb_make_tag(address, 0, sum), address, len))
+            {
+                *phys_addr = tlb_entry->phys_page | (address & TLB_PAGE_MASK);
+                return tlb_entry->host_page + (address & TLB_PAGE_MASK);
+            }
+        #endif
+
+        *phys_addr = mmu_virt_to_phys(&rv_core->mmu, priv_level, address, bus_write_access, 0, sum, &mmu_ret_val, rv_core, 0);
+        if(mmu_ret_val != mmu_ok)
         {
-            instr_SW(rv_core);
-            rv_core->x[rv_core->rd] = 0;
+            prepare_sync_trap(rv_core, trap_cause_store_amo_page_fault, address);
+            *ret = rv_err;
+            return NULL;
         }
-        else
+
+        if(pmp_mem_check(&rv_core->pmp, priv_level, *phys_addr, len, bus_write_access))
         {
-            rv_core->x[rv_core->rd] = 1;
+            printf("PMP Violation!\n");
+            prepare_sync_trap(rv_core, trap_cause_store_amo_access_fault, *phys_addr);
+            *ret = rv_err;
+            return NULL;
         }
 
-        rv_core->lr_valid = 0;
-        rv_core->lr_address = 0;
+        /* physical addresses beyond XLEN can't be on the bus anyway */
+        if( (rv_core->bus_host_ptr == NULL) || (*phys_addr != (rv_uint_xlen)*phys_addr) )
+            return NULL;
+
+        return rv_core->bus_host_ptr(rv_core->priv, *phys_addr, len);
     }
 
-    static void instr_AMOSWAP_W(rv_core_td *rv_core)
+    static inline void rv_core_atomic_notify_write(rv_core_td *rv_core, uint64_t phys_addr, uint8_t len)
     {
-        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        uint32_t result = 0;
+        #ifdef BLOCK_CACHE_SUPPORT
+            block_cache_notify_write(&rv_core->block_cache, phys_addr, len);
+        #else
+            (void) rv_core;
+            (void) phys_addr;
+            (void) len;
+        #endif
+    }
+
+    /* Returns the old value, a failed exchange updates it so the result just gets computed again */
+    static uint64_t rv_core_host_amo(uint8_t *host_ptr, amo_op op, uint8_t len, uint64_t rs2_val)
+    {
+        uint32_t *ptr_32 = (uint32_t *)host_ptr;
+        uint64_t *ptr_64 = (uint64_t *)host_ptr;
+        uint32_t old_32 = 0;
+        uint64_t old_64 = 0;
+
+        if(len == 4)
+        {
+            old_32 = __atomic_load_n(ptr_32, __ATOMIC_RELAXED);
+            while(!__atomic_compare_exchange_n(ptr_32, &old_32, amo_result(op, len, old_32, rs2_val), 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                ;
+            return old_32;
+        }
 
-        instr_LW(rv_core);
-        result = rs2_val;
+        old_64 = __atomic_load_n(ptr_64, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(ptr_64, &old_64, amo_result(op, len, old_64, rs2_val), 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            ;
+        return old_64;
+    }
 
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+    static inline rv_uint_xlen amo_extend(uint64_t val, uint8_t len)
+    {
+        /* the .W variants sign extend on RV64 as well */
+        return (len == 4) ? (rv_uint_xlen)(int32_t)val : (rv_uint_xlen)val;
     }
 
-    static void instr_AMOADD_W(rv_core_td *rv_core)
+    static void rv_core_amo(rv_core_td *rv_core, amo_op op, uint8_t len)
     {
-        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
         rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rd_val = 0;
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        uint32_t result = 0;
+        uint64_t rs2_val = rv_core->x[rv_core->rs2];
+        uint64_t mem_val = 0;
+        uint64_t result = 0;
+        uint64_t phys_addr = 0;
+        rv_ret ret = rv_ok;
+        uint8_t *host_ptr = NULL;
+
+        if(rv_core_atomic_misaligned(rv_core, address, len, trap_cause_store_amo_addr_fault))
+            return;
 
-        instr_LW(rv_core);
-        rd_val = rv_core->x[rv_core->rd];
-        result = rd_val + rs2_val;
+        host_ptr = rv_core_atomic_host_ptr(rv_core, address, len, &phys_addr, &ret);
+        if(ret != rv_ok)
+            return;
+
+        if(host_ptr != NULL)
+        {
+            mem_val = rv_core_host_amo(host_ptr, op, len, rs2_val);
+            rv_core_atomic_notify_write(rv_core, phys_addr, len);
+        }
+        else
+        {
+            /* peripherals are only accessed while holding the device lock anyway */
+            if(mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_read_access, address, &mem_val, len) != rv_ok)
+                return;
 
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+            result = amo_result(op, len, mem_val, rs2_val);
+            if(mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, len) != rv_ok)
+                return;
+        }
+
+        rv_core->x[rv_core->rd] = amo_extend(mem_val, len);
     }
 
-    static void instr_AMOXOR_W(rv_core_td *rv_core)
+    static void rv_core_lr(rv_core_td *rv_core, uint8_t len)
     {
-        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
         rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rd_val = 0;
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        uint32_t result = 0;
+        uint64_t mem_val = 0;
+
+        if(rv_core_atomic_misaligned(rv_core, address, len, trap_cause_load_addr_misalign))
+            return;
 
-        instr_LW(rv_core);
-        rd_val = rv_core->x[rv_core->rd];
-        result = rd_val ^ rs2_val;
+        if(mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_read_access, address, &mem_val, len) != rv_ok)
+            return;
 
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+        rv_core->lr_valid = 1;
+        rv_core->lr_address = address;
+        rv_core->lr_value = mem_val;
+        rv_core->x[rv_core->rd] = amo_extend(mem_val, len);
     }
 
-    static void instr_AMOAND_W(rv_core_td *rv_core)
+    /* Like most emulators this compares values instead of tracking the reservation set,
+     * a store of the same value by another hart in between goes unnoticed.
+     */
+    static void rv_core_sc(rv_core_td *rv_core, uint8_t len)
     {
-        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
         rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rd_val = 0;
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        uint32_t result = 0;
+        uint64_t rs2_val = rv_core->x[rv_core->rs2];
+        uint32_t expected_32 = rv_core->lr_value;
+        uint64_t expected_64 = rv_core->lr_value;
+        uint8_t reserved = rv_core->lr_valid && (rv_core->lr_address == address);
+        uint8_t *host_ptr = NULL;
+        uint64_t phys_addr = 0;
+        rv_ret ret = rv_ok;
+        uint8_t stored = 0;
+
+        /* the reservation is gone in any case, even if the store faults */
+        rv_core->lr_valid = 0;
+        rv_core->lr_address = 0;
+
+        /* an SC which would fail anyway still has to trap */
+        if(rv_core_atomic_misaligned(rv_core, address, len, trap_cause_store_amo_addr_fault))
+            return;
+
+        if(reserved)
+        {
+            host_ptr = rv_core_atomic_host_ptr(rv_core, address, len, &phys_addr, &ret);
+            if(ret != rv_ok)
+                return;
+
+            if(host_ptr == NULL)
+            {
+                if(mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &rs2_val, len) != rv_ok)
+                    return;
+                stored = 1;
+            }
+            else if(len == 4)
+            {
+                stored = __atomic_compare_exchange_n((uint32_t *)host_ptr, &expected_32, (uint32_t)rs2_val, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                stored = __atomic_compare_exchange_n((uint64_t *)host_ptr, &expected_64, rs2_val, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            }
 
-        instr_LW(rv_core);
-        rd_val = rv_core->x[rv_core->rd];
-        result = rd_val & rs2_val;
+            /* a failed SC leaves memory alone and must not throw away blocks on the page */
+            if(stored && (host_ptr != NULL))
+                rv_core_atomic_notify_write(rv_core, phys_addr, len);
+        }
 
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+        rv_core->x[rv_core->rd] = !stored;
     }
 
-    static void instr_AMOOR_W(rv_core_td *rv_core)
+    static void instr_LR_W(rv_core_td *rv_core)
     {
         CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rd_val = 0;
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        uint32_t result = 0;
-
-        instr_LW(rv_core);
-        rd_val = rv_core->x[rv_core->rd];
-        result = rd_val | rs2_val;
-
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+        rv_core_lr(rv_core, 4);
     }
 
-    static void instr_AMOMIN_W(rv_core_td *rv_core)
+    static void instr_SC_W(rv_core_td *rv_core)
     {
         CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        int32_t rd_val = 0;
-        int32_t rs2_val = rv_core->x[rv_core->rs2];
-        rv_uint_xlen result = 0;
+        rv_core_sc(rv_core, 4);
+    }
 
-        instr_LW(rv_core);
+    static void instr_AMOSWAP_W(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        rv_core_amo(rv_core, amo_swap, 4);
+    }
 
-        rd_val = rv_core->x[rv_core->rd];
-        result = ASSIGN_MIN(rd_val, rs2_val);
+    static void instr_AMOADD_W(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        rv_core_amo(rv_core, amo_add, 4);
+    }
 
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+    static void instr_AMOXOR_W(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        rv_core_amo(rv_core, amo_xor, 4);
     }
 
-    static void instr_AMOMAX_W(rv_core_td *rv_core)
+    static void instr_AMOAND_W(rv_core_td *rv_core)
     {
         CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        int32_t rd_val = 0;
-        int32_t rs2_val = rv_core->x[rv_core->rs2];
-        rv_uint_xlen result = 0;
+        rv_core_amo(rv_core, amo_and, 4);
+    }
 
-        instr_LW(rv_core);
+    static void instr_AMOOR_W(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        rv_core_amo(rv_core, amo_or, 4);
+    }
 
-        rd_val = rv_core->x[rv_core->rd];
-        result = ASSIGN_MAX(rd_val, rs2_val);
+    static void instr_AMOMIN_W(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        rv_core_amo(rv_core, amo_min, 4);
+    }
 
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+    static void instr_AMOMAX_W(rv_core_td *rv_core)
+    {
+        CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
+        rv_core_amo(rv_core, amo_max, 4);
     }
 
     static void instr_AMOMINU_W(rv_core_td *rv_core)
     {
         CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rd_val = 0;
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        rv_uint_xlen result = 0;
-
-        instr_LW(rv_core);
-
-        rd_val = rv_core->x[rv_core->rd];
-        result = ASSIGN_MIN(rd_val, rs2_val);
-
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+        rv_core_amo(rv_core, amo_minu, 4);
     }
 
     static void instr_AMOMAXU_W(rv_core_td *rv_core)
     {
         CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-        rv_uint_xlen address = rv_core->x[rv_core->rs1];
-        uint32_t rd_val = 0;
-        uint32_t rs2_val = rv_core->x[rv_core->rs2];
-        rv_uint_xlen result = 0;
-
-        instr_LW(rv_core);
-
-        rd_val = rv_core->x[rv_core->rd];
-        result = ASSIGN_MAX(rd_val, rs2_val);
-
-        mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 4);
+        rv_core_amo(rv_core, amo_maxu, 4);
     }
 
     #ifdef RV64
         static void instr_LR_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_core->lr_valid = 1;
-            rv_core->lr_address = rv_core->x[rv_core->rs1];
-            instr_LD(rv_core);
+            rv_core_lr(rv_core, 8);
         }
 
         static void instr_SC_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            if(rv_core->lr_valid && (rv_core->lr_address == rv_core->x[rv_core->rs1]))
-            {
-                instr_SD(rv_core);
-                rv_core->x[rv_core->rd] = 0;
-            }
-            else
-            {
-                rv_core->x[rv_core->rd] = 1;
-            }
-
-            rv_core->lr_valid = 0;
-            rv_core->lr_address = 0;
+            rv_core_sc(rv_core, 8);
         }
 
         static void instr_AMOSWAP_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-            result = rs2_val;
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_swap, 8);
         }
 
         static void instr_AMOADD_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rd_val = 0;
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-            rd_val = rv_core->x[rv_core->rd];
-            result = rd_val + rs2_val;
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_add, 8);
         }
 
         static void instr_AMOXOR_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rd_val = 0;
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-            rd_val = rv_core->x[rv_core->rd];
-            result = rd_val ^ rs2_val;
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_xor, 8);
         }
 
         static void instr_AMOAND_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rd_val = 0;
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-            rd_val = rv_core->x[rv_core->rd];
-            result = rd_val & rs2_val;
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_and, 8);
         }
 
         static void instr_AMOOR_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rd_val = 0;
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-            rd_val = rv_core->x[rv_core->rd];
-            result = rd_val | rs2_val;
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_or, 8);
         }
 
         static void instr_AMOMIN_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_int_xlen rd_val = 0;
-            rv_int_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-
-            rd_val = rv_core->x[rv_core->rd];
-            result = ASSIGN_MIN(rd_val, rs2_val);
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_min, 8);
         }
 
         static void instr_AMOMAX_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_int_xlen rd_val = 0;
-            rv_int_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-
-            rd_val = rv_core->x[rv_core->rd];
-            result = ASSIGN_MAX(rd_val, rs2_val);
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_max, 8);
         }
 
         static void instr_AMOMINU_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rd_val = 0;
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-
-            rd_val = rv_core->x[rv_core->rd];
-            result = ASSIGN_MIN(rd_val, rs2_val);
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_minu, 8);
         }
 
         static void instr_AMOMAXU_D(rv_core_td *rv_core)
         {
             CORE_DBG("%s: %x\n", __func__, rv_core->instruction);
-            rv_uint_xlen address = rv_core->x[rv_core->rs1];
-            rv_uint_xlen rd_val = 0;
-            rv_uint_xlen rs2_val = rv_core->x[rv_core->rs2];
-            rv_uint_xlen result = 0;
-
-            instr_LD(rv_core);
-
-            rd_val = rv_core->x[rv_core->rd];
-            result = ASSIGN_MAX(rd_val, rs2_val);
-
-            mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_write_access, address, &result, 8);
+            rv_core_amo(rv_core, amo_maxu, 8);
         }
     #endif
 #endif
@@ -1583,15 +1770,23 @@ INIT_INSTRUCTION_LIST_DESC(ADD_SUB_SLL_SLT_SLTU_XOR_SRL_SRA_OR_AND_func3_subcode
 
     static instruction_hook_td SRET_WFI_func12_sub5_subcode_list[] = {
         [FUNC5_INSTR_SRET] = {NULL, instr_SRET, NULL},
-        [FUNC5_INSTR_WFI] = {NULL, instr_NOP, NULL},
+        [FUNC5_INSTR_WFI] = {NULL, instr_WFI, NULL},
     };
     INIT_INSTRUCTION_LIST_DESC(SRET_WFI_func12_sub5_subcode_list);
 
+    static instruction_hook_td SFENCE_W_INVAL_INVAL_IR_func12_sub5_subcode_list[] = {
+        [FUNC5_INSTR_SFENCE_W_INVAL] = {NULL, instr_NOP, NULL},
+        [FUNC5_INSTR_SFENCE_INVAL_IR] = {NULL, instr_NOP, NULL},
+    };
+    INIT_INSTRUCTION_LIST_DESC(SFENCE_W_INVAL_INVAL_IR_func12_sub5_subcode_list);
+
     static instruction_hook_td ECALL_EBREAK_URET_SRET_MRET_WFI_SFENCEVMA_func7_subcode_list[] = {
         [FUNC7_INSTR_ECALL_EBREAK_URET] = {preparation_func7_func12_sub5_extended, NULL, &ECALL_EBREAK_URET_func12_sub5_subcode_list_desc},
         [FUNC7_INSTR_SRET_WFI] = {preparation_func7_func12_sub5_extended, NULL, &SRET_WFI_func12_sub5_subcode_list_desc},
         [FUNC7_INSTR_MRET] = {NULL, instr_MRET, NULL},
-        [FUNC7_INSTR_SFENCEVMA] = {NULL, instr_NOP, NULL},
+        [FUNC7_INSTR_SFENCEVMA] = {NULL, instr_SFENCEVMA, NULL},
+        [FUNC7_INSTR_SINVALVMA] = {NULL, instr_SINVALVMA, NULL},
+        [FUNC7_INSTR_SFENCE_W_INVAL_INVAL_IR] = {preparation_func7_func12_sub5_extended, NULL, &SFENCE_W_INVAL_INVAL_IR_func12_sub5_subcode_list_desc},
     };
     INIT_INSTRUCTION_LIST_DESC(ECALL_EBREAK_URET_SRET_MRET_WFI_SFENCEVMA_func7_subcode_list);
 
@@ -1659,7 +1854,7 @@ static instruction_hook_td RV_opcode_list[] = {
     [INSTR_SB_SH_SW_SD] = {S_type_preparation, NULL, &SB_SH_SW_SD_func3_subcode_list_desc},
     [INSTR_ADDI_SLTI_SLTIU_XORI_ORI_ANDI_SLLI_SRLI_SRAI] = {I_type_preparation, NULL, &ADDI_SLTI_SLTIU_XORI_ORI_ANDI_SLLI_SRLI_SRAI_func3_subcode_list_desc},
     [INSTR_ADD_SUB_SLL_SLT_SLTU_XOR_SRL_SRA_OR_AND_MUL_MULH_MULHSU_MULHU_DIV_DIVU_REM_REMU] = {R_type_preparation, NULL, &ADD_SUB_SLL_SLT_SLTU_XOR_SRL_SRA_OR_AND_func3_subcode_list_desc},
-    [INSTR_FENCE_FENCE_I] = {NULL, instr_NOP, NULL}, /* Not implemented */
+    [INSTR_FENCE_FENCE_I] = {NULL, instr_FENCE, NULL},
 
     #ifdef RV64
         [INSTR_ADDIW_SLLIW_SRLIW_SRAIW] = {I_type_preparation, NULL, &SLLIW_SRLIW_SRAIW_ADDIW_func3_subcode_list_desc},
@@ -1676,20 +1871,20 @@ static instruction_hook_td RV_opcode_list[] = {
 };
 INIT_INSTRUCTION_LIST_DESC(RV_opcode_list);
 
-static void rv_call_from_opcode_list(rv_core_td *rv_core, instruction_desc_td *opcode_list_desc, uint32_t opcode)
+static rv_ret rv_call_from_opcode_list(rv_core_td *rv_core, instruction_desc_td *opcode_list_desc, uint32_t opcode)
 {
     int32_t next_subcode = -1;
 
     unsigned int list_size = opcode_list_desc->instruction_hook_list_size;
     instruction_hook_td *opcode_list = opcode_list_desc->instruction_hook_list;
 
+    if(opcode >= list_size)
+        return rv_err;
+
     if( (opcode_list[opcode].preparation_cb == NULL) &&
         (opcode_list[opcode].execution_cb == NULL) &&
         (opcode_list[opcode].next == NULL) )
-        die_msg("Unknown instruction: %08x PC: "PRINTF_FMT" Cycle: %016ld\n", rv_core->instruction, rv_core->pc, rv_core->curr_cycle);
-
-    if(opcode >= list_size)
-        die_msg("Unknown instruction: %08x PC: "PRINTF_FMT" Cycle: %016ld\n", rv_core->instruction, rv_core->pc, rv_core->curr_cycle);
+        return rv_err;
 
     if(opcode_list[opcode].preparation_cb != NULL)
         opcode_list[opcode].preparation_cb(rv_core, &next_subcode);
@@ -1698,7 +1893,9 @@ static void rv_call_from_opcode_list(rv_core_td *rv_core, instruction_desc_td *o
         rv_core->execute_cb = opcode_list[opcode].execution_cb;
 
     if((next_subcode != -1) && (opcode_list[opcode].next != NULL))
-        rv_call_from_opcode_list(rv_core, opcode_list[opcode].next, next_subcode);
+        return rv_call_from_opcode_list(rv_core, opcode_list[opcode].next, next_subcode);
+
+    return rv_ok;
 }
 
 #ifdef CSR_SUPPORT
@@ -1710,7 +1907,7 @@ static void rv_call_from_opcode_list(rv_core_td *rv_core, instruction_desc_td *o
     static inline uint8_t rv_core_prepare_interrupts(rv_core_td *rv_core)
     {
         trap_cause_interrupt interrupt_cause = 0;
-        trap_ret trap_retval = 0;
+        rv_uint_xlen deliverable_irqs = 0;
         privilege_level serving_priv_level = machine_mode;
 
         /* Privilege Spec: "Multiple simultaneous interrupts and traps at the same privilege level are handled in the following
@@ -1743,30 +1940,45 @@ static void rv_call_from_opcode_list(rv_core_td *rv_core, instruction_desc_td *o
             return 1;
         }
 
+        /* the common case, nothing to take */
+        deliverable_irqs = trap_get_deliverable_irqs(&rv_core->trap, rv_core->curr_priv_mode);
+        if(!deliverable_irqs)
+            return 0;
+
         /* For simplicity we just stupidly go down from machine exti to user swi
          * Altough the correct order should be (exti, swi, timer, probably for each priv level separately)
          * Simplicity definitely wins here over spec correctness
          */
-        for(interrupt_cause=trap_cause_machine_exti;interrupt_cause>=trap_cause_user_swi;interrupt_cause--)
-        {
-            trap_retval = trap_check_interrupt_pending(&rv_core->trap, rv_core->curr_priv_mode, interrupt_cause, &serving_priv_level);
-            if(trap_retval)
-            {
-                rv_core->pc = trap_serve_interrupt(&rv_core->trap, serving_priv_level, rv_core->curr_priv_mode, 1, interrupt_cause, rv_core->pc, rv_core->sync_trap_tval);
-                rv_core->curr_priv_mode = serving_priv_level;
-                return 1;
-            }
-        }
+        interrupt_cause = (sizeof(unsigned int) * 8 - 1) - __builtin_clz((unsigned int)deliverable_irqs);
+        trap_check_interrupt_pending(&rv_core->trap, rv_core->curr_priv_mode, interrupt_cause, &serving_priv_level);
 
-        return 0;
+        rv_core->pc = trap_serve_interrupt(&rv_core->trap, serving_priv_level, rv_core->curr_priv_mode, 1, interrupt_cause, rv_core->pc, rv_core->sync_trap_tval);
+        rv_core->curr_priv_mode = serving_priv_level;
+        return 1;
     }
 #endif
 
-static inline rv_uint_xlen rv_core_fetch(rv_core_td *rv_core)
+static inline rv_ret rv_core_fetch(rv_core_td *rv_core)
 {
     rv_uint_xlen addr = rv_core->pc;
 
-    return mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_instr_access, addr, &rv_core->instruction, sizeof(rv_uint_xlen));
+    #ifdef TLB_SUPPORT
+        /* Fetches from an already translated code page are read directly from host memory,
+         * instructions are 4 byte aligned so they never cross the page.
+         */
+        uint8_t sum = CHECK_BIT(*rv_core->trap.m.regs[trap_reg_status], TRAP_XSTATUS_SUM_BIT) ? 1 : 0;
+        tlb_entry_td *tlb_entry = tlb_get_entry(&rv_core->mmu.tlb, rv_core->curr_priv_mode, bus_instr_access, addr);
+
+        if(tlb_match(&rv_core->mmu.tlb, tlb_entry, tlb_make_tag(addr, 0, sum)))
+        {
+            rv_core->mmu.last_virt_pc = addr;
+            rv_core->mmu.last_phys_pc = tlb_entry->phys_page | (addr & TLB_PAGE_MASK);
+            memcpy(&rv_core->instruction, tlb_entry->host_page + (addr & TLB_PAGE_MASK), sizeof(rv_core->instruction));
+            return rv_ok;
+        }
+    #endif
+
+    return mmu_checked_bus_access(rv_core, rv_core->curr_priv_mode, bus_instr_access, addr, &rv_core->instruction, sizeof(rv_core->instruction));
 }
 
 static inline rv_uint_xlen rv_core_decode(rv_core_td *rv_core)
@@ -1780,11 +1992,64 @@ static inline rv_uint_xlen rv_core_decode(rv_core_td *rv_core)
     rv_core->immediate = 0;
     rv_core->jump_offset = 0;
 
-    rv_call_from_opcode_list(rv_core, &RV_opcode_list_desc, rv_core->opcode);
+    if(rv_call_from_opcode_list(rv_core, &RV_opcode_list_desc, rv_core->opcode) != rv_ok)
+        die_msg("Unknown instruction: %08x PC: "PRINTF_FMT" Cycle: %016ld\n", rv_core->instruction, rv_core->pc, rv_core->curr_cycle);
 
     return 0;
 }
 
+static inline void rv_core_load_decoded(rv_core_td *rv_core, decode_cache_entry_td *entry)
+{
+    rv_core->instruction = entry->instruction;
+    rv_core->opcode = entry->opcode;
+    rv_core->rd = entry->rd;
+    rv_core->rs1 = entry->rs1;
+    rv_core->rs2 = entry->rs2;
+    rv_core->func3 = entry->func3;
+    rv_core->func7 = entry->func7;
+    rv_core->func6 = entry->func6;
+    rv_core->func5 = entry->func5;
+    rv_core->immediate = entry->immediate;
+    rv_core->jump_offset = entry->jump_offset;
+    rv_core->execute_cb = entry->execute_cb;
+}
+
+/* Keep a copy of the decoded fields, the instructions are allowed
+ * to modify them in rv_core (e.g. immediate or jump_offset)
+ */
+static inline void rv_core_store_decoded(rv_core_td *rv_core, decode_cache_entry_td *entry)
+{
+    entry->instruction = rv_core->instruction;
+    entry->opcode = rv_core->opcode;
+    entry->rd = rv_core->rd;
+    entry->rs1 = rv_core->rs1;
+    entry->rs2 = rv_core->rs2;
+    entry->func3 = rv_core->func3;
+    entry->func7 = rv_core->func7;
+    entry->func6 = rv_core->func6;
+    entry->func5 = rv_core->func5;
+    entry->immediate = rv_core->immediate;
+    entry->jump_offset = rv_core->jump_offset;
+    entry->execute_cb = rv_core->execute_cb;
+}
+
+#ifdef DECODE_CACHE_SUPPORT
+    static inline void rv_core_decode_cached(rv_core_td *rv_core)
+    {
+        /* the fetch just went through the mmu, so last_phys_pc belongs to this instruction */
+        decode_cache_entry_td *entry = decode_cache_lookup(&rv_core->decode_cache, rv_core->mmu.last_phys_pc);
+
+        if( (entry->execute_cb != NULL) && (entry->instruction == rv_core->instruction) )
+        {
+            rv_core_load_decoded(rv_core, entry);
+            return;
+        }
+
+        rv_core_decode(rv_core);
+        rv_core_store_decoded(rv_core, entry);
+    }
+#endif
+
 static rv_uint_xlen rv_core_execute(rv_core_td *rv_core)
 {
     rv_core->execute_cb(rv_core);
@@ -1795,14 +2060,250 @@ static rv_uint_xlen rv_core_execute(rv_core_td *rv_core)
     return 0;
 }
 
-/******************* Public functions *******************************/
-void rv_core_run(rv_core_td *rv_core)
+/* The counters are not kept up to date while running, their value is derived from
+ * curr_cycle when they are read. Writes only store the difference to the running count.
+ */
+static inline uint64_t rv_core_counter_value(rv_core_td *rv_core, uint16_t reg_index)
+{
+    switch(reg_index)
+    {
+        case counter_reg_cycle:
+        case counter_reg_cycleh:
+            return rv_core->curr_cycle + rv_core->cycle_offset;
+        case counter_reg_instret:
+        case counter_reg_instreth:
+            return rv_core->curr_cycle - rv_core->idle_cycles + rv_core->instret_offset;
+        default:
+            return rv_core->curr_cycle;
+    }
+}
+
+static rv_ret rv_core_counter_read(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen *out_val)
+{
+    rv_core_td *rv_core = priv;
+    uint64_t value = rv_core_counter_value(rv_core, reg_index);
+
+    (void) curr_priv;
+
+    #ifndef RV64
+        if(reg_index >= counter_reg_cycleh)
+            value >>= 32;
+    #endif
+
+    *out_val = value;
+
+    return rv_ok;
+}
+
+static rv_ret rv_core_counter_write(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val)
+{
+    rv_core_td *rv_core = priv;
+    uint64_t *offset = ((reg_index == counter_reg_cycle) || (reg_index == counter_reg_cycleh)) ? &rv_core->cycle_offset : &rv_core->instret_offset;
+    uint64_t curr_value = rv_core_counter_value(rv_core, reg_index);
+    uint64_t new_value = csr_val;
+
+    (void) curr_priv;
+
+    #ifndef RV64
+        if(reg_index >= counter_reg_cycleh)
+            new_value = (curr_value & 0xFFFFFFFF) | ((uint64_t)csr_val << 32);
+        else
+            new_value = (curr_value & 0xFFFFFFFF00000000) | csr_val;
+    #endif
+
+    /* the writing instruction still counts, the next one sees the written value */
+    *offset += new_value - curr_value - 1;
+
+    return rv_ok;
+}
+
+#ifdef BLOCK_CACHE_SUPPORT
+    static block_exit_type rv_core_block_exit_type(uint8_t opcode)
+    {
+        switch(opcode)
+        {
+            case INSTR_JAL:
+                return block_exit_jal;
+            case INSTR_JALR:
+                return block_exit_jalr;
+            case INSTR_BEQ_BNE_BLT_BGE_BLTU_BGEU:
+                return block_exit_branch;
+            case INSTR_ECALL_EBREAK_MRET_SRET_URET_WFI_CSRRW_CSRRS_CSRRC_CSRRWI_CSRRSI_CSRRCI_SFENCEVMA:
+                return block_exit_system;
+            default:
+                return block_exit_fallthrough;
+        }
+    }
+
+    /* Decodes straight-line code starting at the already fetched instruction at rv_core->pc.
+     * The block ends at the first control transfer or system instruction, at the end of the page,
+     * or at stop_pc, so that the caller can check for it before entering the next block.
+     */
+    static void rv_core_build_block(rv_core_td *rv_core, block_td *block, uint64_t phys_pc, rv_uint_xlen stop_pc)
+    {
+        uint32_t instruction = rv_core->instruction;
+        rv_uint_xlen virt_pc = rv_core->pc;
+        uint64_t phys_addr = phys_pc;
+
+        block->valid = 0;
+        #ifdef JIT_SUPPORT
+            block->jit_code = NULL;
+            block->jit_requested = 0;
+            block->exec_count = 0;
+            block->build_id = ++rv_core->block_cache.build_count;
+        #endif
+        block->phys_pc = phys_pc;
+        block->priv = rv_core->curr_priv_mode;
+        block->exit_type = block_exit_fallthrough;
+        block->nr_instr = 0;
+        memset(&block->link_taken, 0, sizeof(block_link_td));
+        memset(&block->link_next, 0, sizeof(block_link_td));
+
+        while(block->nr_instr < BLOCK_CACHE_MAX_INSTR)
+        {
+            if(block->nr_instr == 0)
+            {
+                /* The first one is executed for sure, so unknown instructions have to end up in die_msg() */
+                rv_core_decode(rv_core);
+            }
+            else
+            {
+                if( ((phys_addr & ((1UL << BLOCK_CACHE_PAGE_SHIFT)-1)) == 0) || (virt_pc == stop_pc) )
+                    break;
+
+                /* Peek at the next instruction without raising any traps, it might never be executed */
+                if(pmp_mem_check(&rv_core->pmp, rv_core->curr_priv_mode, phys_addr, 4, bus_instr_access))
+                    break;
+
+                if(rv_core->bus_access(rv_core->priv, rv_core->curr_priv_mode, bus_instr_access, phys_addr, &instruction, 4) != rv_ok)
+                    break;
+
+                rv_core->instruction = instruction;
+                rv_core->opcode = (instruction & 0x7F);
+                rv_core->rd = 0;
+                rv_core->rs1 = 0;
+                rv_core->rs2 = 0;
+                rv_core->func3 = 0;
+                rv_core->func7 = 0;
+                rv_core->immediate = 0;
+                rv_core->jump_offset = 0;
+                rv_core->execute_cb = NULL;
+
+                if( (rv_call_from_opcode_list(rv_core, &RV_opcode_list_desc, rv_core->opcode) != rv_ok) ||
+                    (rv_core->execute_cb == NULL) )
+                    break;
+
+                /* system instructions always start their own block, see rv_core_run_blocks() */
+                if(rv_core->opcode == INSTR_ECALL_EBREAK_MRET_SRET_URET_WFI_CSRRW_CSRRS_CSRRC_CSRRWI_CSRRSI_CSRRCI_SFENCEVMA)
+                    break;
+            }
+
+            rv_core_store_decoded(rv_core, &block->instr[block->nr_instr]);
+            block->nr_instr++;
+            virt_pc += 4;
+            phys_addr += 4;
+
+            block->exit_type = rv_core_block_exit_type(rv_core->opcode);
+            if(block->exit_type != block_exit_fallthrough)
+                break;
+        }
+
+        /* stores to this page have to go through the write hook from now on */
+        if(block_cache_mark_code_page(&rv_core->block_cache, block))
+        {
+            #ifdef TLB_SUPPORT
+                tlb_flush_access_type(&rv_core->mmu.tlb, bus_write_access);
+            #endif
+        }
+        block->valid = 1;
+    }
+
+    /* System instructions may change the address translation or the PMP setup, in that case remembered
+     * block transitions or even the blocks themselves can't be trusted anymore.
+     */
+    static void rv_core_block_system_exit(rv_core_td *rv_core)
+    {
+        uint16_t csr_addr = (rv_core->instruction >> 20);
+
+        if(rv_core->func3 == FUNC3_INSTR_ECALL_EBREAK_MRET_SRET_URET_WFI_SFENCEVMA)
+        {
+            if( ((rv_core->instruction >> 25) == FUNC7_INSTR_SFENCEVMA) ||
+                ((rv_core->instruction >> 25) == FUNC7_INSTR_SINVALVMA) )
+                block_cache_new_epoch(&rv_core->block_cache);
+        }
+        else if(csr_addr == CSR_ADDR_SATP)
+        {
+            block_cache_new_epoch(&rv_core->block_cache);
+        }
+        else if( (csr_addr >= CSR_PMPCFG0) && (csr_addr < (CSR_PMPADDR0 + PMP_NR_ADDR_REGS_WARL_MAX)) )
+        {
+            block_cache_flush(&rv_core->block_cache);
+        }
+    }
+
+    static inline int rv_core_is_link_reg(uint8_t reg)
+    {
+        return (reg == 1) || (reg == 5);
+    }
+
+    /* Interprets up to max_instr instructions of the block and returns the number of executed ones */
+    static inline unsigned int rv_core_exec_block(rv_core_td *rv_core, block_td *block, uint64_t max_instr)
+    {
+        unsigned int nr_instr = ASSIGN_MIN(block->nr_instr, max_instr);
+        unsigned int i = 0;
+
+        for(i=0;i<nr_instr;i++)
+        {
+            rv_core_load_decoded(rv_core, &block->instr[i]);
+
+            rv_core->execute_cb(rv_core);
+            rv_core->x[0] = 0;
+            rv_core->curr_cycle++;
+            rv_core->pc = rv_core->next_pc ? rv_core->next_pc : rv_core->pc + 4;
+
+            /* leave right after a device access just like rv_core_run_n() to not delay interrupts */
+            if(rv_core->sync_trap_pending || rv_core->block_cache.code_modified || rv_core->exit_request)
+                return i + 1;
+        }
+
+        return nr_instr;
+    }
+#endif
+
+#ifdef JIT_SUPPORT
+    uint8_t rv_core_jit_exec_instr(rv_core_td *rv_core, decode_cache_entry_td *entry)
+    {
+        rv_core_load_decoded(rv_core, entry);
+        rv_core->execute_cb(rv_core);
+        rv_core->x[0] = 0;
+        rv_core->curr_cycle++;
+        rv_core->pc = rv_core->next_pc ? rv_core->next_pc : rv_core->pc + 4;
+
+        return rv_core->sync_trap_pending || rv_core->block_cache.code_modified || rv_core->exit_request;
+    }
+
+    static inline void rv_core_jit_profile_block(rv_core_td *rv_core, block_td *block)
+    {
+        if( (rv_core->jit.code_buf == NULL) || block->jit_requested || (block->exit_type == block_exit_system) )
+            return;
+
+        if(++block->exec_count >= JIT_HOT_THRESHOLD)
+            jit_request(&rv_core->jit, block);
+    }
+#endif
+
+static inline void rv_core_step(rv_core_td *rv_core)
 {
     rv_core->next_pc = 0;
 
     if(rv_core_fetch(rv_core) == rv_ok)
     {
-        rv_core_decode(rv_core);
+        #ifdef DECODE_CACHE_SUPPORT
+            rv_core_decode_cached(rv_core);
+        #else
+            rv_core_decode(rv_core);
+        #endif
+
         rv_core_execute(rv_core);
     }
 
@@ -1810,24 +2311,190 @@ void rv_core_run(rv_core_td *rv_core)
     rv_core->pc = rv_core->next_pc ? rv_core->next_pc : rv_core->pc + 4;
 
     rv_core->curr_cycle++;
-    rv_core->csr_regs[CSR_ADDR_MCYCLE].value = rv_core->curr_cycle;
-    rv_core->csr_regs[CSR_ADDR_MINSTRET].value = rv_core->curr_cycle;
-    rv_core->csr_regs[CSR_ADDR_CYCLE].value = rv_core->curr_cycle;
-    rv_core->csr_regs[CSR_ADDR_TIME].value = rv_core->curr_cycle;
+}
 
-    #ifndef RV64
-        rv_core->csr_regs[CSR_ADDR_MCYCLEH].value = rv_core->curr_cycle >> 32;
-        rv_core->csr_regs[CSR_ADDR_MINSTRETH].value = rv_core->curr_cycle >> 32;
-        rv_core->csr_regs[CSR_ADDR_CYCLEH].value = rv_core->curr_cycle >> 32;
-        rv_core->csr_regs[CSR_ADDR_TIMEH].value = rv_core->curr_cycle >> 32;
-    #endif
+/******************* Public functions *******************************/
+void rv_core_run(rv_core_td *rv_core)
+{
+    rv_core_step(rv_core);
+}
+
+/* Interprets up to max_instr instructions and returns the number of executed ones.
+ * It returns early on traps, system instructions (which includes WFI), exit requests
+ * and when stop_pc is reached, as those need to be handled by the caller.
+ */
+uint64_t rv_core_run_n(rv_core_td *rv_core, uint64_t max_instr, rv_uint_xlen stop_pc)
+{
+    uint64_t executed = 0;
+
+    rv_core->exit_request = 0;
+
+    while(executed < max_instr)
+    {
+        rv_core_step(rv_core);
+        executed++;
+
+        if( rv_core->sync_trap_pending || rv_core->exit_request || (rv_core->pc == stop_pc) ||
+            (rv_core->opcode == INSTR_ECALL_EBREAK_MRET_SRET_URET_WFI_CSRRW_CSRRS_CSRRC_CSRRWI_CSRRSI_CSRRCI_SFENCEVMA) )
+            break;
+    }
+
+    return executed;
 }
 
+#ifdef BLOCK_CACHE_SUPPORT
+    void rv_core_enable_block_engine(rv_core_td *rv_core)
+    {
+        block_cache_init(&rv_core->block_cache);
+    }
+
+    /* Executes up to max_instr instructions block by block and returns the number of executed instructions.
+     * It returns early on traps, system instructions, modified code, exit requests and when stop_pc is reached,
+     * as those need to be handled by the caller.
+     */
+    uint64_t rv_core_run_blocks(rv_core_td *rv_core, uint64_t max_instr, rv_uint_xlen stop_pc)
+    {
+        block_cache_td *block_cache = &rv_core->block_cache;
+        block_link_td *link = NULL;
+        block_link_td *jump_cache_entry = NULL;
+        block_td *block = NULL;
+        decode_cache_entry_td *last = NULL;
+        uint64_t executed = 0;
+        unsigned int nr_instr = 0;
+        uint8_t taken = 0;
+
+        #ifdef JIT_SUPPORT
+            if(rv_core->jit.code_buf != NULL)
+                jit_install(&rv_core->jit, block_cache);
+        #endif
+
+        rv_core->exit_request = 0;
+
+        while(executed < max_instr)
+        {
+            if( (rv_core->pc == stop_pc) || rv_core->exit_request )
+                break;
+
+            block = (link != NULL) ? block_link_get(block_cache, link, rv_core->pc, rv_core->curr_priv_mode) : NULL;
+
+            if(block == NULL)
+            {
+                jump_cache_entry = block_cache_jump_cache_entry(block_cache, rv_core->pc);
+                block = block_link_get(block_cache, jump_cache_entry, rv_core->pc, rv_core->curr_priv_mode);
+
+                if(block == NULL)
+                {
+                    /* Slow path, this does the address translation and all permission checks */
+                    if(rv_core_fetch(rv_core) != rv_ok)
+                    {
+                        /* same as in rv_core_run(), the trap will be served with the incremented pc */
+                        rv_core->pc += 4;
+                        rv_core->curr_cycle++;
+                        executed++;
+                        break;
+                    }
+
+                    block = block_cache_slot(block_cache, rv_core->mmu.last_phys_pc);
+                    if(!block_is_valid(block_cache, block, rv_core->mmu.last_phys_pc, rv_core->curr_priv_mode))
+                        rv_core_build_block(rv_core, block, rv_core->mmu.last_phys_pc, stop_pc);
+
+                    block_link_set(block_cache, jump_cache_entry, rv_core->pc, rv_core->curr_priv_mode, block);
+                }
+
+                if(link != NULL)
+                    block_link_set(block_cache, link, rv_core->pc, rv_core->curr_priv_mode, block);
+            }
+
+            /* Give the caller the chance to serve pending interrupts before e.g. they get disabled again */
+            if( (block->exit_type == block_exit_system) && (block->nr_instr == 1) && (executed > 0) )
+                break;
+
+            rv_core->next_pc = 0;
+
+            #ifdef JIT_SUPPORT
+                if( (block->jit_code != NULL) && (block->nr_instr <= (max_instr - executed)) )
+                {
+                    /* curr_cycle is only kept up to date up to the last interpreted instruction of the block */
+                    uint64_t start_cycle = rv_core->curr_cycle;
+
+                    nr_instr = jit_block_get_func(block)(rv_core);
+                    rv_core->curr_cycle = start_cycle + nr_instr;
+                }
+                else
+                {
+                    rv_core_jit_profile_block(rv_core, block);
+                    nr_instr = rv_core_exec_block(rv_core, block, max_instr - executed);
+                }
+            #else
+                nr_instr = rv_core_exec_block(rv_core, block, max_instr - executed);
+            #endif
+            executed += nr_instr;
+
+            if(rv_core->sync_trap_pending || block_cache->code_modified)
+            {
+                block_cache->code_modified = 0;
+                break;
+            }
+
+            /* ran out of instructions in the middle of the block */
+            if(nr_instr < block->nr_instr)
+                break;
+
+            /* only the last instruction of a block may jump */
+            taken = (rv_core->next_pc != 0);
+            last = &block->instr[block->nr_instr - 1];
+
+            switch(block->exit_type)
+            {
+                case block_exit_branch:
+                    link = taken ? &block->link_taken : &block->link_next;
+                break;
+                case block_exit_jal:
+                    if(rv_core_is_link_reg(last->rd))
+                        block_cache_ras_push(block_cache, &block->link_next);
+                    link = &block->link_taken;
+                break;
+                case block_exit_jalr:
+                    link = NULL;
+                    /* return address stack hints as in the unprivileged spec */
+                    if(rv_core_is_link_reg(last->rs1) && !(rv_core_is_link_reg(last->rd) && (last->rd == last->rs1)))
+                        link = block_cache_ras_pop(block_cache);
+                    if(rv_core_is_link_reg(last->rd))
+                        block_cache_ras_push(block_cache, &block->link_next);
+                    if(link == NULL)
+                        link = &block->link_taken;
+                break;
+                case block_exit_system:
+                    rv_core_block_system_exit(rv_core);
+                    goto exit_run;
+                default:
+                    link = &block->link_next;
+            }
+        }
+
+        exit_run:
+
+        return executed;
+    }
+#endif
+
+#ifdef JIT_SUPPORT
+    void rv_core_enable_jit(rv_core_td *rv_core)
+    {
+        jit_init(&rv_core->jit);
+    }
+#endif
+
 void rv_core_process_interrupts(rv_core_td *rv_core, uint8_t mei, uint8_t mti, uint8_t msi)
 {
     #ifdef CSR_SUPPORT
         /* interrupt handling */
         rv_core_update_interrupts(rv_core, mei, mti, msi);
+
+        /* The wait also ends if the interrupt is globally disabled, execution then just continues after the WFI */
+        if(rv_core->wfi && (*rv_core->trap.m.regs[trap_reg_ip] & *rv_core->trap.m.regs[trap_reg_ie]))
+            rv_core->wfi = 0;
+
         rv_core_prepare_interrupts(rv_core);
     #else
         (void)rv_core;
@@ -1837,6 +2504,13 @@ void rv_core_process_interrupts(rv_core_td *rv_core, uint8_t mei, uint8_t mti, u
     #endif
 }
 
+/* Lets cycles pass without executing anything, e.g. while the hart waits in WFI */
+void rv_core_idle(rv_core_td *rv_core, uint64_t cycles)
+{
+    rv_core->curr_cycle += cycles;
+    rv_core->idle_cycles += cycles;
+}
+
 void rv_core_reg_dump(rv_core_td *rv_core)
 {
     (void) rv_core;
@@ -1863,7 +2537,46 @@ void rv_core_reg_dump_more_regs(rv_core_td *rv_core)
     DEBUG_PRINT("\n");
 }
 
-static void rv_core_init_csr_regs(rv_core_td *rv_core)
+#ifdef PMP_SUPPORT
+    /* Any change to the PMP setup invalidates the permissions cached in the TLB */
+    static rv_ret rv_core_pmp_write_csr_cfg(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val)
+    {
+        rv_core_td *rv_core = priv;
+        rv_ret ret_val = pmp_write_csr_cfg(&rv_core->pmp, curr_priv, reg_index, csr_val);
+
+        #ifdef TLB_SUPPORT
+            tlb_flush(&rv_core->mmu.tlb);
+        #endif
+
+        return ret_val;
+    }
+
+    static rv_ret rv_core_pmp_read_csr_cfg(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen *out_val)
+    {
+        rv_core_td *rv_core = priv;
+        return pmp_read_csr_cfg(&rv_core->pmp, curr_priv, reg_index, out_val);
+    }
+
+    static rv_ret rv_core_pmp_write_csr_addr(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val)
+    {
+        rv_core_td *rv_core = priv;
+        rv_ret ret_val = pmp_write_csr_addr(&rv_core->pmp, curr_priv, reg_index, csr_val);
+
+        #ifdef TLB_SUPPORT
+            tlb_flush(&rv_core->mmu.tlb);
+        #endif
+
+        return ret_val;
+    }
+
+    static rv_ret rv_core_pmp_read_csr_addr(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen *out_val)
+    {
+        rv_core_td *rv_core = priv;
+        return pmp_read_csr_addr(&rv_core->pmp, curr_priv, reg_index, out_val);
+    }
+#endif
+
+static void rv_core_init_csr_regs(rv_core_td *rv_core, rv_uint_xlen hart_id)
 {
     uint16_t i = 0;
     rv_uint_xlen xstatus_warl_bits = 0;
@@ -1876,7 +2589,8 @@ static void rv_core_init_csr_regs(rv_core_td *rv_core)
     INIT_CSR_REG_DEFAULT(rv_core->csr_regs, CSR_ADDR_MVENDORID, CSR_ACCESS_RO(machine_mode), 0, CSR_MASK_ZERO, CSR_MASK_ZERO);
     INIT_CSR_REG_DEFAULT(rv_core->csr_regs, CSR_ADDR_MARCHID, CSR_ACCESS_RO(machine_mode), 0, CSR_MASK_ZERO, CSR_MASK_ZERO);
     INIT_CSR_REG_DEFAULT(rv_core->csr_regs, CSR_ADDR_MIMPID, CSR_ACCESS_RO(machine_mode), 0, CSR_MASK_ZERO, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, CSR_ADDR_MHARTID, CSR_ACCESS_RO(machine_mode), 0, CSR_MASK_ZERO, CSR_MASK_ZERO);
+    /* read only anyway, the mask is also applied to the value read */
+    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, CSR_ADDR_MHARTID, CSR_ACCESS_RO(machine_mode), hart_id, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
 
     /* Machine Trap Setup */
     INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_MSTATUS, CSR_ACCESS_RW(machine_mode), CSR_MSTATUS_MASK, xstatus_warl_bits, &rv_core->trap, trap_m_read, trap_m_write, trap_reg_status);
@@ -1887,6 +2601,12 @@ static void rv_core_init_csr_regs(rv_core_td *rv_core)
     INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_MTVEC, CSR_ACCESS_RW(machine_mode), CSR_MTVEC_MASK, CSR_MASK_ZERO, &rv_core->trap, trap_m_read, trap_m_write, trap_reg_tvec);
     INIT_CSR_REG_DEFAULT(rv_core->csr_regs, CSR_ADDR_MCOUNTEREN, CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_ZERO, CSR_MASK_ZERO);
 
+    /* Machine Configuration */
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_MENVCFG, CSR_ACCESS_RW(machine_mode), CSR_MENVCFG_MASK, CSR_MASK_ZERO, &rv_core->mmu, mmu_read_csr, mmu_write_csr, mmu_reg_envcfg);
+    #ifndef RV64
+        INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_MENVCFGH, CSR_ACCESS_RW(machine_mode), CSR_MENVCFGH_MASK, CSR_MASK_ZERO, &rv_core->mmu, mmu_read_csr, mmu_write_csr, mmu_reg_envcfgh);
+    #endif
+
     /* Machine Trap Handling */
     INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_MSCRATCH, CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, &rv_core->trap, trap_m_read, trap_m_write, trap_reg_scratch);
     INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_MEPC, CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, &rv_core->trap, trap_m_read, trap_m_write, trap_reg_epc);
@@ -1906,7 +2626,7 @@ static void rv_core_init_csr_regs(rv_core_td *rv_core)
     for(i=0;i<PMP_NR_CFG_REGS;i++)
     {
         #ifdef PMP_SUPPORT
-            INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_PMPCFG0+i), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, &rv_core->pmp, pmp_read_csr_cfg, pmp_write_csr_cfg, i);
+            INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_PMPCFG0+i), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_pmp_read_csr_cfg, rv_core_pmp_write_csr_cfg, i);
         #else
             INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_PMPCFG0+i), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
         #endif
@@ -1919,7 +2639,7 @@ static void rv_core_init_csr_regs(rv_core_td *rv_core)
     for(i=0;i<PMP_NR_ADDR_REGS;i++)
     {
         #ifdef PMP_SUPPORT
-            INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_PMPADDR0+i), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, &rv_core->pmp, pmp_read_csr_addr, pmp_write_csr_addr, i);
+            INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_PMPADDR0+i), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_pmp_read_csr_addr, rv_core_pmp_write_csr_addr, i);
         #else
             INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_PMPADDR0+i), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
         #endif
@@ -1945,18 +2665,26 @@ static void rv_core_init_csr_regs(rv_core_td *rv_core)
     INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_SIP, CSR_ACCESS_RW(machine_mode) | CSR_ACCESS_RW(supervisor_mode), CSR_SIP_SIE_MASK, CSR_MASK_ZERO, &rv_core->trap, trap_s_read, trap_s_write, trap_reg_ip);
 
     /* Supervisor Address Translation and Protection */
-    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_SATP, CSR_ACCESS_RW(machine_mode) | CSR_ACCESS_RW(supervisor_mode), CSR_SATP_MASK, CSR_MASK_ZERO, &rv_core->mmu, mmu_read_csr, mmu_write_csr, 0);
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, CSR_ADDR_SATP, CSR_ACCESS_RW(machine_mode) | CSR_ACCESS_RW(supervisor_mode), CSR_SATP_MASK, CSR_MASK_ZERO, &rv_core->mmu, mmu_read_csr, mmu_write_csr, mmu_reg_satp);
 
     /* Performance Counters */
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_MCYCLE), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_MCYCLEH), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_MINSTRET), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_MINSTRETH), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_MCYCLE), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, rv_core_counter_write, counter_reg_cycle);
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_MINSTRET), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, rv_core_counter_write, counter_reg_instret);
+
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_CYCLE), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, NULL, counter_reg_cycle);
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_TIME), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, NULL, counter_reg_time);
 
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_CYCLE), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_CYCLEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_TIME), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
-    INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_TIMEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
+    #ifndef RV64
+        INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_MCYCLEH), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, rv_core_counter_write, counter_reg_cycleh);
+        INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_MINSTRETH), CSR_ACCESS_RW(machine_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, rv_core_counter_write, counter_reg_instreth);
+        INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_CYCLEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, NULL, counter_reg_cycleh);
+        INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_TIMEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, rv_core, rv_core_counter_read, NULL, counter_reg_timeh);
+    #else
+        INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_MCYCLEH), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
+        INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_MINSTRETH), CSR_ACCESS_RW(machine_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
+        INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_CYCLEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
+        INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_TIMEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_WR_ALL, CSR_MASK_ZERO);
+    #endif
 
     /* All others are WARL, they start at 3 */
     for(i=3;i<CSR_HPMCOUNTER_WARL_MAX;i++)
@@ -1968,9 +2696,62 @@ static void rv_core_init_csr_regs(rv_core_td *rv_core)
         INIT_CSR_REG_DEFAULT(rv_core->csr_regs, (CSR_ADDR_CYCLEH+i), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), 0, CSR_MASK_ZERO, CSR_MASK_ZERO);
 }
 
+/* The time CSRs follow the cycle counter unless they get an external time source */
+void rv_core_set_time_source(rv_core_td *rv_core, void *priv, csr_read_cb read_time)
+{
+    INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_TIME), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, priv, read_time, NULL, 0);
+    #ifndef RV64
+        INIT_CSR_REG_SPECIAL(rv_core->csr_regs, (CSR_ADDR_TIMEH), CSR_ACCESS_RO(machine_mode) | CSR_ACCESS_RO(supervisor_mode) | CSR_ACCESS_RO(user_mode), CSR_MASK_WR_ALL, CSR_MASK_ZERO, priv, read_time, NULL, 1);
+    #endif
+}
+
+/* Saves or restores the architectural state of the hart. Decoded instructions and translations
+ * are not part of it, after a restore they are rebuilt from the restored memory.
+ */
+void rv_core_snapshot(rv_core_td *rv_core, snapshot_td *snapshot)
+{
+    unsigned int i = 0;
+
+    SNAPSHOT_FIELD(snapshot, rv_core->curr_priv_mode);
+    SNAPSHOT_FIELD(snapshot, rv_core->curr_cycle);
+    SNAPSHOT_FIELD(snapshot, rv_core->x);
+    SNAPSHOT_FIELD(snapshot, rv_core->pc);
+    SNAPSHOT_FIELD(snapshot, rv_core->wfi);
+    SNAPSHOT_FIELD(snapshot, rv_core->cycle_offset);
+    SNAPSHOT_FIELD(snapshot, rv_core->instret_offset);
+    SNAPSHOT_FIELD(snapshot, rv_core->idle_cycles);
+    SNAPSHOT_FIELD(snapshot, rv_core->lr_valid);
+    SNAPSHOT_FIELD(snapshot, rv_core->lr_address);
+    SNAPSHOT_FIELD(snapshot, rv_core->lr_value);
+
+    /* the callbacks and masks of the CSRs are set up by rv_core_init() */
+    for(i=0;i<CSR_ADDR_MAX;i++)
+        SNAPSHOT_FIELD(snapshot, rv_core->csr_regs[i].value);
+
+    SNAPSHOT_FIELD(snapshot, rv_core->trap.regs_data);
+    SNAPSHOT_FIELD(snapshot, rv_core->pmp);
+    mmu_snapshot(&rv_core->mmu, snapshot);
+
+    if(!snapshot->restore)
+        return;
+
+    rv_core->next_pc = rv_core->pc;
+    rv_core->sync_trap_pending = 0;
+    rv_core->exit_request = 0;
+    rv_core->trap.irq_dirty = 1;
+
+    /* decode cache entries check the instruction word, blocks have to be dropped */
+    #ifdef BLOCK_CACHE_SUPPORT
+        if(rv_core->block_cache.blocks != NULL)
+            block_cache_flush(&rv_core->block_cache);
+    #endif
+}
+
 void rv_core_init(rv_core_td *rv_core,
+                  rv_uint_xlen hart_id,
                   void *priv,
-                  bus_access_func bus_access
+                  bus_access_func bus_access,
+                  bus_host_ptr_func bus_host_ptr
                   )
 {
     memset(rv_core, 0, sizeof(rv_core_td));
@@ -1980,9 +2761,18 @@ void rv_core_init(rv_core_td *rv_core,
 
     rv_core->priv = priv;
     rv_core->bus_access = bus_access;
+    rv_core->bus_host_ptr = bus_host_ptr;
 
     trap_init(&rv_core->trap);
-    mmu_init(&rv_core->mmu, pmp_checked_bus_access, rv_core);
+    #ifdef TLB_SUPPORT
+        mmu_init(&rv_core->mmu, pmp_checked_bus_access, pmp_checked_table_ptr, rv_core);
+    #else
+        mmu_init(&rv_core->mmu, pmp_checked_bus_access, NULL, rv_core);
+    #endif
+
+    #ifdef DECODE_CACHE_SUPPORT
+        decode_cache_init(&rv_core->decode_cache);
+    #endif
 
-    rv_core_init_csr_regs(rv_core);
+    rv_core_init_csr_regs(rv_core, hart_id);
 }
@@ -7,12 +7,28 @@
 #include <pmp.h>
 #include <trap.h>
 #include <clint.h>
+#include <snapshot.h>
 
 #define NR_RVI_REGS 32
 
+/* internal_reg of the counter CSRs, the high halves only exist on RV32 */
+typedef enum
+{
+    counter_reg_cycle = 0,
+    counter_reg_time,
+    counter_reg_instret,
+    counter_reg_cycleh,
+    counter_reg_timeh,
+    counter_reg_instreth
+
+} counter_internal_regs;
+
 typedef struct rv_core_struct rv_core_td;
 
 #include <mmu.h>
+#include <decode_cache.h>
+#include <block_cache.h>
+#include <jit.h>
 
 typedef struct rv_core_struct
 {
@@ -41,12 +57,26 @@ typedef struct rv_core_struct
     rv_uint_xlen sync_trap_cause;
     rv_uint_xlen sync_trap_tval;
 
+    /* set by WFI, the hart is stalled until an enabled interrupt becomes pending */
+    uint8_t wfi;
+
+    /* set from outside, e.g. after a device access, to make the run functions return early */
+    uint8_t exit_request;
+
+    /* The counter CSRs are computed from curr_cycle on read, see rv_core_counter_read().
+     * Idle cycles (WFI) advance mcycle but not minstret.
+     */
+    uint64_t cycle_offset;
+    uint64_t instret_offset;
+    uint64_t idle_cycles;
+
     /* points to the next instruction */
     void (*execute_cb)(rv_core_td *rv_core);
 
     /* externally hooked */
     void *priv;
     bus_access_func bus_access;
+    bus_host_ptr_func bus_host_ptr;
     // bus_read_mem read_mem;
     // bus_write_mem write_mem;
 
@@ -55,18 +85,49 @@ typedef struct rv_core_struct
     trap_td trap;
     mmu_td mmu;
 
+    #ifdef DECODE_CACHE_SUPPORT
+        decode_cache_td decode_cache;
+    #endif
+
+    #ifdef BLOCK_CACHE_SUPPORT
+        block_cache_td block_cache;
+    #endif
+
+    #ifdef JIT_SUPPORT
+        jit_td jit;
+    #endif
+
+    /* The reservation of LR, SC only succeeds if the memory still holds the loaded value */
     int lr_valid;
     rv_uint_xlen lr_address;
+    uint64_t lr_value;
+
+    /* Set if other harts run on the same memory at the same time, see instr_FENCE() */
+    uint8_t smp;
 
 } rv_core_td;
 
 void rv_core_run(rv_core_td *rv_core);
+uint64_t rv_core_run_n(rv_core_td *rv_core, uint64_t max_instr, rv_uint_xlen stop_pc);
+#ifdef BLOCK_CACHE_SUPPORT
+    void rv_core_enable_block_engine(rv_core_td *rv_core);
+    uint64_t rv_core_run_blocks(rv_core_td *rv_core, uint64_t max_instr, rv_uint_xlen stop_pc);
+#endif
+#ifdef JIT_SUPPORT
+    void rv_core_enable_jit(rv_core_td *rv_core);
+    uint8_t rv_core_jit_exec_instr(rv_core_td *rv_core, decode_cache_entry_td *entry);
+#endif
 void rv_core_process_interrupts(rv_core_td *rv_core, uint8_t mei, uint8_t mti, uint8_t msi);
+void rv_core_idle(rv_core_td *rv_core, uint64_t cycles);
+void rv_core_set_time_source(rv_core_td *rv_core, void *priv, csr_read_cb read_time);
+void rv_core_snapshot(rv_core_td *rv_core, snapshot_td *snapshot);
 void rv_core_reg_dump(rv_core_td *rv_core);
 void rv_core_reg_dump_more_regs(rv_core_td *rv_core);
 void rv_core_init(rv_core_td *rv_core,
+                  rv_uint_xlen hart_id,
                   void *priv,
-                  bus_access_func bus_access
+                  bus_access_func bus_access,
+                  bus_host_ptr_func bus_host_ptr
                   );
 
 typedef struct instruction_hook_struct
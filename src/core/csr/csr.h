@@ -30,6 +30,8 @@
 #define CSR_ADDR_MIE          0x304
 #define CSR_ADDR_MTVEC        0x305
 #define CSR_ADDR_MCOUNTEREN   0x306
+#define CSR_ADDR_MENVCFG      0x30A
+#define CSR_ADDR_MENVCFGH     0x31A
 
 #define CSR_ADDR_MSCRATCH     0x340
 #define CSR_ADDR_MEPC         0x341
@@ -102,15 +104,19 @@
     #define CSR_MTVEC_MASK 0xFFFFFFFFFFFFFFFC
 
     #define CSR_SSTATUS_MASK 0x80000003000DE133
-    #define CSR_SATP_MASK 0xF0000FFFFFFFFFFF
+    #define CSR_SATP_MASK 0xFFFFFFFFFFFFFFFF
+    /* ADUE */
+    #define CSR_MENVCFG_MASK 0x2000000000000000
 #else
     #define CSR_MASK_WR_ALL 0xFFFFFFFF
     #define CSR_MSTATUS_MASK 0x807FF9BB
     #define CSR_MTVEC_MASK 0xFFFFFFFC
 
     #define CSR_SSTATUS_MASK 0x800DE133
-    /* ASID (Bit 30-22) is not used here */
-    #define CSR_SATP_MASK 0x803FFFFF
+    #define CSR_SATP_MASK 0xFFFFFFFF
+    #define CSR_MENVCFG_MASK 0
+    /* ADUE */
+    #define CSR_MENVCFGH_MASK 0x20000000
 #endif
 #define CSR_MASK_ZERO 0
 #define CSR_MIP_MIE_MASK 0xBBB
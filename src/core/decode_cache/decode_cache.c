@@ -0,0 +1,14 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <decode_cache.h>
+#include <riscv_helper.h>
+
+void decode_cache_init(decode_cache_td *decode_cache)
+{
+    /* calloc leaves all entries without an execute_cb, which marks them as empty */
+    decode_cache->entries = calloc(DECODE_CACHE_NR_ENTRIES, sizeof(decode_cache_entry_td));
+
+    if(decode_cache->entries == NULL)
+        die_msg("Could not allocate decode cache!\n");
+}
@@ -0,0 +1,47 @@
+#ifndef RISCV_DECODE_CACHE_H
+#define RISCV_DECODE_CACHE_H
+
+#include <stdint.h>
+#include <riscv_types.h>
+
+typedef struct rv_core_struct rv_core_td;
+
+/* Everything rv_core_decode() extracts from the raw instruction word.
+ * The raw word itself is kept to validate the entry, so code which
+ * has been modified since it was decoded will simply miss.
+ */
+typedef struct decode_cache_entry_struct
+{
+    uint32_t instruction;
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t func3;
+    uint8_t func7;
+    uint8_t func6;
+    uint8_t func5;
+    rv_uint_xlen immediate;
+    rv_uint_xlen jump_offset;
+    void (*execute_cb)(rv_core_td *rv_core);
+
+} decode_cache_entry_td;
+
+typedef struct decode_cache_struct
+{
+    /* Direct mapped by physical PC, one slot per 4 byte aligned instruction.
+     * Consecutive physical pages occupy consecutive slot ranges, so a working
+     * set of up to DECODE_CACHE_NR_ENTRIES*4 bytes of code never conflicts.
+     */
+    decode_cache_entry_td *entries;
+
+} decode_cache_td;
+
+void decode_cache_init(decode_cache_td *decode_cache);
+
+static inline decode_cache_entry_td *decode_cache_lookup(decode_cache_td *decode_cache, uint64_t phys_addr)
+{
+    return &decode_cache->entries[(phys_addr >> 2) & (DECODE_CACHE_NR_ENTRIES-1)];
+}
+
+#endif /* RISCV_DECODE_CACHE_H */
@@ -0,0 +1,863 @@
+#define _GNU_SOURCE /* memfd_create() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <riscv_helper.h>
+#include <riscv_instr.h>
+#include <core.h>
+#include <jit.h>
+
+#ifdef JIT_SUPPORT
+
+// #define JIT_DEBUG_ENABLE
+#ifdef JIT_DEBUG_ENABLE
+#define JIT_DEBUG(...) do{ printf( __VA_ARGS__ ); } while( 0 )
+#else
+#define JIT_DEBUG(...) do{ } while ( 0 )
+#endif
+
+/* Max. size of the host code of one block, 32 instructions need about 3K in the worst case */
+#define JIT_MAX_BLOCK_CODE_SIZE 0x2000
+
+#ifdef RV64
+    #define JIT_REX_W 1
+#else
+    #define JIT_REX_W 0
+#endif
+
+/* x86-64 host registers */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R8 8
+#define R9 9
+#define R10 10
+#define R11 11
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+/* x86 condition codes */
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xC
+#define CC_GE 0xD
+
+/* Register usage of translated code:
+ * rbx: rv_core, rbp: virtual pc of the first instruction of the block,
+ * rax, rcx: scratch, the registers below hold the most used guest registers.
+ */
+static const uint8_t jit_cache_regs[] = { R12, R13, R14, R15, R8, R9, R10, R11 };
+
+#define GUEST_REG_OFFSET(reg) (offsetof(rv_core_td, x) + ((reg) * sizeof(rv_uint_xlen)))
+#define GUEST_PC_OFFSET offsetof(rv_core_td, pc)
+#define GUEST_NEXT_PC_OFFSET offsetof(rv_core_td, next_pc)
+#define GUEST_CYCLE_OFFSET offsetof(rv_core_td, curr_cycle)
+
+typedef struct jit_emitter_struct
+{
+    uint8_t *buf;
+    unsigned int len;
+    unsigned int size;
+    uint8_t overflow;
+
+    /* guest register -> host register, 0 (rax) means not cached */
+    uint8_t host_reg[NR_RVI_REGS];
+    uint8_t dirty[NR_RVI_REGS];
+
+    /* where translated code continues after calling back into the interpreter */
+    decode_cache_entry_td *entries;
+
+    /* number of instructions of the block already added to curr_cycle at this point of the code */
+    unsigned int nr_counted;
+
+} jit_emitter_td;
+
+/******************* x86-64 encoding *******************************/
+static void emit8(jit_emitter_td *e, uint8_t val)
+{
+    if(e->len >= e->size)
+    {
+        e->overflow = 1;
+        return;
+    }
+
+    e->buf[e->len++] = val;
+}
+
+static void emit32(jit_emitter_td *e, uint32_t val)
+{
+    int i = 0;
+
+    for(i=0;i<4;i++)
+        emit8(e, (val >> (i*8)) & 0xFF);
+}
+
+static void emit64(jit_emitter_td *e, uint64_t val)
+{
+    emit32(e, val & 0xFFFFFFFF);
+    emit32(e, val >> 32);
+}
+
+static void emit_rex(jit_emitter_td *e, uint8_t w, uint8_t reg, uint8_t rm)
+{
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+
+    if(rex != 0x40)
+        emit8(e, rex);
+}
+
+/* op reg, rm / op rm, reg depending on the opcode, both operands are registers */
+static void emit_op_rr(jit_emitter_td *e, uint8_t w, uint8_t op, uint8_t reg, uint8_t rm)
+{
+    emit_rex(e, w, reg, rm);
+    emit8(e, op);
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* memory operand is always [rbx + disp32] */
+static void emit_op_rm(jit_emitter_td *e, uint8_t w, uint8_t op, uint8_t reg, uint32_t disp)
+{
+    emit_rex(e, w, reg, RBX);
+    emit8(e, op);
+    emit8(e, 0x80 | ((reg & 7) << 3) | RBX);
+    emit32(e, disp);
+}
+
+/* group opcodes (0x81, 0xC1, 0xD3) with an opcode extension in the reg field */
+static void emit_op_ext(jit_emitter_td *e, uint8_t w, uint8_t op, uint8_t ext, uint8_t rm)
+{
+    emit_rex(e, w, 0, rm);
+    emit8(e, op);
+    emit8(e, 0xC0 | (ext << 3) | (rm & 7));
+}
+
+static void emit_mov_imm(jit_emitter_td *e, uint8_t reg, int32_t imm)
+{
+    if(JIT_REX_W)
+    {
+        /* sign extended to 64 bit */
+        emit_op_ext(e, 1, 0xC7, 0, reg);
+    }
+    else
+    {
+        emit_rex(e, 0, 0, reg);
+        emit8(e, 0xB8 + (reg & 7));
+    }
+    emit32(e, imm);
+}
+
+static void emit_mov_imm64(jit_emitter_td *e, uint8_t reg, uint64_t imm)
+{
+    emit_rex(e, 1, 0, reg);
+    emit8(e, 0xB8 + (reg & 7));
+    emit64(e, imm);
+}
+
+/* reg = rbp + disp, rbp holds the pc of the first instruction */
+static void emit_lea_pc(jit_emitter_td *e, uint8_t reg, int32_t disp)
+{
+    emit_rex(e, JIT_REX_W, reg, RBP);
+    emit8(e, 0x8D);
+    emit8(e, 0x80 | ((reg & 7) << 3) | RBP);
+    emit32(e, disp);
+}
+
+static void emit_setcc_rax(jit_emitter_td *e, uint8_t cc)
+{
+    /* setcc al; movzx eax, al */
+    emit8(e, 0x0F);
+    emit8(e, 0x90 | cc);
+    emit8(e, 0xC0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0xC0);
+}
+
+#ifdef RV64
+    static void emit_movsxd_rax(jit_emitter_td *e)
+    {
+        emit8(e, 0x48);
+        emit8(e, 0x63);
+        emit8(e, 0xC0);
+    }
+#endif
+
+static void emit_imul_rax_rcx(jit_emitter_td *e, uint8_t w)
+{
+    emit_rex(e, w, RAX, RCX);
+    emit8(e, 0x0F);
+    emit8(e, 0xAF);
+    emit8(e, 0xC0 | (RAX << 3) | RCX);
+}
+
+/* returns the position of the rel32 which has to be patched */
+static unsigned int emit_jcc(jit_emitter_td *e, uint8_t cc)
+{
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+
+    return e->len - 4;
+}
+
+static void patch_rel32(jit_emitter_td *e, unsigned int pos)
+{
+    uint32_t rel = e->len - (pos + 4);
+
+    if(e->overflow)
+        return;
+
+    memcpy(&e->buf[pos], &rel, sizeof(rel));
+}
+
+/******************* guest state handling *******************************/
+static void jit_load_guest(jit_emitter_td *e, uint8_t host, uint8_t reg)
+{
+    if(reg == 0)
+        emit_op_rr(e, 0, 0x31, host, host); /* xor host, host */
+    else if(e->host_reg[reg])
+        emit_op_rr(e, JIT_REX_W, 0x89, e->host_reg[reg], host);
+    else
+        emit_op_rm(e, JIT_REX_W, 0x8B, host, GUEST_REG_OFFSET(reg));
+}
+
+static void jit_store_guest(jit_emitter_td *e, uint8_t reg, uint8_t host)
+{
+    if(reg == 0)
+        return;
+
+    if(e->host_reg[reg])
+    {
+        emit_op_rr(e, JIT_REX_W, 0x89, host, e->host_reg[reg]);
+        e->dirty[reg] = 1;
+    }
+    else
+    {
+        emit_op_rm(e, JIT_REX_W, 0x89, host, GUEST_REG_OFFSET(reg));
+    }
+}
+
+/* write back modified guest registers */
+static void jit_flush_regs(jit_emitter_td *e)
+{
+    int i = 0;
+
+    for(i=1;i<NR_RVI_REGS;i++)
+    {
+        if(e->host_reg[i] && e->dirty[i])
+        {
+            emit_op_rm(e, JIT_REX_W, 0x89, e->host_reg[i], GUEST_REG_OFFSET(i));
+            e->dirty[i] = 0;
+        }
+    }
+}
+
+static void jit_reload_regs(jit_emitter_td *e)
+{
+    int i = 0;
+
+    for(i=1;i<NR_RVI_REGS;i++)
+    {
+        if(e->host_reg[i])
+            emit_op_rm(e, JIT_REX_W, 0x8B, e->host_reg[i], GUEST_REG_OFFSET(i));
+    }
+}
+
+static void jit_emit_prologue(jit_emitter_td *e)
+{
+    emit8(e, 0x53);                 /* push rbx */
+    emit8(e, 0x55);                 /* push rbp */
+    emit8(e, 0x41); emit8(e, 0x54); /* push r12 */
+    emit8(e, 0x41); emit8(e, 0x55); /* push r13 */
+    emit8(e, 0x41); emit8(e, 0x56); /* push r14 */
+    emit8(e, 0x41); emit8(e, 0x57); /* push r15 */
+    /* sub rsp, 8 to keep the stack 16 byte aligned for calls */
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x08);
+
+    emit_op_rr(e, 1, 0x89, RDI, RBX); /* mov rbx, rdi */
+    emit_op_rm(e, JIT_REX_W, 0x8B, RBP, GUEST_PC_OFFSET);
+
+    jit_reload_regs(e);
+}
+
+/* guest registers must already be written back */
+static void jit_emit_exit(jit_emitter_td *e, uint32_t nr_executed)
+{
+    emit8(e, 0xB8);                 /* mov eax, nr_executed */
+    emit32(e, nr_executed);
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08);
+    emit8(e, 0x41); emit8(e, 0x5F); /* pop r15 */
+    emit8(e, 0x41); emit8(e, 0x5E); /* pop r14 */
+    emit8(e, 0x41); emit8(e, 0x5D); /* pop r13 */
+    emit8(e, 0x41); emit8(e, 0x5C); /* pop r12 */
+    emit8(e, 0x5D);                 /* pop rbp */
+    emit8(e, 0x5B);                 /* pop rbx */
+    emit8(e, 0xC3);                 /* ret */
+}
+
+/* pc = rax, optionally next_pc too to let the block engine know the branch was taken */
+static void jit_emit_set_pc(jit_emitter_td *e, uint8_t taken)
+{
+    emit_op_rm(e, JIT_REX_W, 0x89, RAX, GUEST_PC_OFFSET);
+
+    if(taken)
+        emit_op_rm(e, JIT_REX_W, 0x89, RAX, GUEST_NEXT_PC_OFFSET);
+}
+
+/* Let the interpreter execute instruction nr, it also updates pc and counts the instruction.
+ * The block is left if the instruction trapped, modified code or accessed a device.
+ */
+static void jit_emit_interp_call(jit_emitter_td *e, unsigned int nr)
+{
+    uintptr_t helper = (uintptr_t)&rv_core_jit_exec_instr;
+    unsigned int patch_pos = 0;
+
+    jit_flush_regs(e);
+
+    emit_lea_pc(e, RAX, nr*4);
+    emit_op_rm(e, JIT_REX_W, 0x89, RAX, GUEST_PC_OFFSET);
+
+    /* the instruction sees the same cycle count as in the interpreter, e.g. for the timer */
+    if(nr > e->nr_counted)
+    {
+        emit_op_rm(e, 1, 0x81, 0, GUEST_CYCLE_OFFSET); /* add qword [rbx + curr_cycle], imm */
+        emit32(e, nr - e->nr_counted);
+    }
+    e->nr_counted = nr + 1;
+
+    emit_op_rr(e, 1, 0x89, RBX, RDI); /* mov rdi, rbx */
+    emit_mov_imm64(e, RSI, (uintptr_t)&e->entries[nr]);
+    emit_mov_imm64(e, RAX, helper);
+    emit8(e, 0xFF); emit8(e, 0xD0);   /* call rax */
+
+    emit8(e, 0x85); emit8(e, 0xC0);   /* test eax, eax */
+    patch_pos = emit_jcc(e, CC_E);
+    jit_emit_exit(e, nr + 1);
+    patch_rel32(e, patch_pos);
+
+    jit_reload_regs(e);
+}
+
+/******************* instruction translation *******************************/
+/* Integer computational instructions, returns 0 if it has to be interpreted */
+static int jit_translate_alu(jit_emitter_td *e, uint32_t instruction, unsigned int nr)
+{
+    uint8_t opcode = instruction & 0x7F;
+    uint8_t rd = (instruction >> 7) & 0x1F;
+    uint8_t func3 = (instruction >> 12) & 0x7;
+    uint8_t rs1 = (instruction >> 15) & 0x1F;
+    uint8_t rs2 = (instruction >> 20) & 0x1F;
+    uint8_t func7 = instruction >> 25;
+    int32_t imm_i = (int32_t)instruction >> 20;
+    int32_t imm_u = (int32_t)(instruction & 0xFFFFF000);
+    uint8_t shamt = imm_i & SHIFT_OP_MASK;
+    uint8_t shift_type = JIT_REX_W ? (instruction >> 26) : func7;
+
+    switch(opcode)
+    {
+        case INSTR_LUI:
+            if(rd)
+            {
+                emit_mov_imm(e, RAX, imm_u);
+                jit_store_guest(e, rd, RAX);
+            }
+            return 1;
+
+        case INSTR_AUIPC:
+            if(rd)
+            {
+                emit_lea_pc(e, RAX, (nr*4) + imm_u);
+                jit_store_guest(e, rd, RAX);
+            }
+            return 1;
+
+        case INSTR_ADDI_SLTI_SLTIU_XORI_ORI_ANDI_SLLI_SRLI_SRAI:
+            /* shift encodings use the upper immediate bits, check them like the decoder does */
+            if( (func3 == FUNC3_INSTR_SLLI) && (shift_type != 0) )
+                return 0;
+            if( (func3 == FUNC3_INSTR_SRLI_SRAI) &&
+                (shift_type != (JIT_REX_W ? FUNC6_INSTR_SRLI : FUNC7_INSTR_SRLI)) &&
+                (shift_type != (JIT_REX_W ? FUNC6_INSTR_SRAI : FUNC7_INSTR_SRAI)) )
+                return 0;
+
+            if(!rd)
+                return 1;
+
+            jit_load_guest(e, RAX, rs1);
+            switch(func3)
+            {
+                case FUNC3_INSTR_ADDI: emit_op_ext(e, JIT_REX_W, 0x81, 0, RAX); emit32(e, imm_i); break;
+                case FUNC3_INSTR_XORI: emit_op_ext(e, JIT_REX_W, 0x81, 6, RAX); emit32(e, imm_i); break;
+                case FUNC3_INSTR_ORI: emit_op_ext(e, JIT_REX_W, 0x81, 1, RAX); emit32(e, imm_i); break;
+                case FUNC3_INSTR_ANDI: emit_op_ext(e, JIT_REX_W, 0x81, 4, RAX); emit32(e, imm_i); break;
+                case FUNC3_INSTR_SLTI:
+                case FUNC3_INSTR_SLTIU:
+                    emit_op_ext(e, JIT_REX_W, 0x81, 7, RAX); emit32(e, imm_i);
+                    emit_setcc_rax(e, (func3 == FUNC3_INSTR_SLTI) ? CC_L : CC_B);
+                break;
+                case FUNC3_INSTR_SLLI: emit_op_ext(e, JIT_REX_W, 0xC1, 4, RAX); emit8(e, shamt); break;
+                case FUNC3_INSTR_SRLI_SRAI:
+                    emit_op_ext(e, JIT_REX_W, 0xC1, (shift_type == (JIT_REX_W ? FUNC6_INSTR_SRAI : FUNC7_INSTR_SRAI)) ? 7 : 5, RAX);
+                    emit8(e, shamt);
+                break;
+            }
+            jit_store_guest(e, rd, RAX);
+            return 1;
+
+        case INSTR_ADD_SUB_SLL_SLT_SLTU_XOR_SRL_SRA_OR_AND_MUL_MULH_MULHSU_MULHU_DIV_DIVU_REM_REMU:
+            if( !((func7 == FUNC7_INSTR_ADD) ||
+                  ((func7 == FUNC7_INSTR_SUB) && ((func3 == FUNC3_INSTR_ADD_SUB_MUL) || (func3 == FUNC3_INSTR_SRL_SRA_DIVU))) ||
+                  ((func7 == FUNC7_INSTR_MUL) && (func3 == FUNC3_INSTR_ADD_SUB_MUL))) )
+                return 0;
+
+            if(!rd)
+                return 1;
+
+            jit_load_guest(e, RAX, rs1);
+            jit_load_guest(e, RCX, rs2);
+            switch(func3)
+            {
+                case FUNC3_INSTR_ADD_SUB_MUL:
+                    if(func7 == FUNC7_INSTR_MUL)
+                        emit_imul_rax_rcx(e, JIT_REX_W);
+                    else
+                        emit_op_rr(e, JIT_REX_W, (func7 == FUNC7_INSTR_SUB) ? 0x29 : 0x01, RCX, RAX);
+                break;
+                case FUNC3_INSTR_SLL_MULH: emit_op_ext(e, JIT_REX_W, 0xD3, 4, RAX); break;
+                case FUNC3_INSTR_SLT_MULHSU:
+                case FUNC3_INSTR_SLTU_MULHU:
+                    emit_op_rr(e, JIT_REX_W, 0x39, RCX, RAX);
+                    emit_setcc_rax(e, (func3 == FUNC3_INSTR_SLT_MULHSU) ? CC_L : CC_B);
+                break;
+                case FUNC3_INSTR_XOR_DIV: emit_op_rr(e, JIT_REX_W, 0x31, RCX, RAX); break;
+                case FUNC3_INSTR_SRL_SRA_DIVU: emit_op_ext(e, JIT_REX_W, 0xD3, (func7 == FUNC7_INSTR_SRA) ? 7 : 5, RAX); break;
+                case FUNC3_INSTR_OR_REM: emit_op_rr(e, JIT_REX_W, 0x09, RCX, RAX); break;
+                case FUNC3_INSTR_AND_REMU: emit_op_rr(e, JIT_REX_W, 0x21, RCX, RAX); break;
+            }
+            jit_store_guest(e, rd, RAX);
+            return 1;
+
+        #ifdef RV64
+            case INSTR_ADDIW_SLLIW_SRLIW_SRAIW:
+                if( (func3 == FUNC3_INSTR_ADDIW) ||
+                    ((func3 == FUNC3_INSTR_SLLIW) && (func7 == 0)) ||
+                    ((func3 == FUNC3_INSTR_SRLIW_SRAIW) && ((func7 == FUNC7_INSTR_SRLIW) || (func7 == FUNC7_INSTR_SRAIW))) )
+                {
+                    if(!rd)
+                        return 1;
+
+                    jit_load_guest(e, RAX, rs1);
+                    if(func3 == FUNC3_INSTR_ADDIW)
+                    {
+                        emit_op_ext(e, 0, 0x81, 0, RAX);
+                        emit32(e, imm_i);
+                    }
+                    else
+                    {
+                        emit_op_ext(e, 0, 0xC1, (func3 == FUNC3_INSTR_SLLIW) ? 4 : ((func7 == FUNC7_INSTR_SRAIW) ? 7 : 5), RAX);
+                        emit8(e, imm_i & 0x1F);
+                    }
+                    emit_movsxd_rax(e);
+                    jit_store_guest(e, rd, RAX);
+                    return 1;
+                }
+                return 0;
+
+            case INSTR_ADDW_SUBW_SLLW_SRLW_SRAW_MULW_DIVW_DIVUW_REMW_REMUW:
+                if( !(((func3 == FUNC3_INSTR_ADDW_SUBW_MULW) && ((func7 == FUNC7_INSTR_ADDW) || (func7 == FUNC7_INSTR_SUBW) || (func7 == FUNC7_INSTR_MULW))) ||
+                      ((func3 == FUNC3_INSTR_SLLW) && (func7 == 0)) ||
+                      ((func3 == FUNC3_INSTR_SRLW_SRAW_DIVUW) && ((func7 == FUNC7_INSTR_SRLW) || (func7 == FUNC7_INSTR_SRAW)))) )
+                    return 0;
+
+                if(!rd)
+                    return 1;
+
+                jit_load_guest(e, RAX, rs1);
+                jit_load_guest(e, RCX, rs2);
+                if(func3 == FUNC3_INSTR_ADDW_SUBW_MULW)
+                {
+                    if(func7 == FUNC7_INSTR_MULW)
+                        emit_imul_rax_rcx(e, 0);
+                    else
+                        emit_op_rr(e, 0, (func7 == FUNC7_INSTR_SUBW) ? 0x29 : 0x01, RCX, RAX);
+                }
+                else
+                {
+                    emit_op_ext(e, 0, 0xD3, (func3 == FUNC3_INSTR_SLLW) ? 4 : ((func7 == FUNC7_INSTR_SRAW) ? 7 : 5), RAX);
+                }
+                emit_movsxd_rax(e);
+                jit_store_guest(e, rd, RAX);
+                return 1;
+        #endif
+
+        default:
+            return 0;
+    }
+}
+
+/* Control transfer at the end of a block, returns 0 if it has to be interpreted */
+static int jit_translate_jump(jit_emitter_td *e, uint32_t instruction, unsigned int nr)
+{
+    uint8_t opcode = instruction & 0x7F;
+    uint8_t rd = (instruction >> 7) & 0x1F;
+    uint8_t func3 = (instruction >> 12) & 0x7;
+    uint8_t rs1 = (instruction >> 15) & 0x1F;
+    uint8_t rs2 = (instruction >> 20) & 0x1F;
+    int32_t imm_i = (int32_t)instruction >> 20;
+    int32_t offset = 0;
+    unsigned int patch_pos = 0;
+    uint8_t cc = 0;
+
+    switch(opcode)
+    {
+        case INSTR_BEQ_BNE_BLT_BGE_BLTU_BGEU:
+            offset = (((int32_t)instruction >> 31) << 12) | (((instruction >> 7) & 0x1) << 11) |
+                     (((instruction >> 25) & 0x3F) << 5) | (((instruction >> 8) & 0xF) << 1);
+
+            switch(func3)
+            {
+                case FUNC3_INSTR_BEQ: cc = CC_E; break;
+                case FUNC3_INSTR_BNE: cc = CC_NE; break;
+                case FUNC3_INSTR_BLT: cc = CC_L; break;
+                case FUNC3_INSTR_BGE: cc = CC_GE; break;
+                case FUNC3_INSTR_BLTU: cc = CC_B; break;
+                case FUNC3_INSTR_BGEU: cc = CC_AE; break;
+                default: return 0;
+            }
+
+            /* misaligned targets are left to the interpreter */
+            if(offset & 0x3)
+                return 0;
+
+            jit_flush_regs(e);
+            jit_load_guest(e, RAX, rs1);
+            jit_load_guest(e, RCX, rs2);
+            emit_op_rr(e, JIT_REX_W, 0x39, RCX, RAX);
+            patch_pos = emit_jcc(e, cc);
+
+            emit_lea_pc(e, RAX, (nr*4) + 4);
+            jit_emit_set_pc(e, 0);
+            jit_emit_exit(e, nr + 1);
+
+            patch_rel32(e, patch_pos);
+            emit_lea_pc(e, RAX, (nr*4) + offset);
+            jit_emit_set_pc(e, 1);
+            jit_emit_exit(e, nr + 1);
+            return 1;
+
+        case INSTR_JAL:
+            offset = (((int32_t)instruction >> 31) << 20) | (instruction & 0xFF000) |
+                     (((instruction >> 20) & 0x1) << 11) | (((instruction >> 21) & 0x3FF) << 1);
+
+            if(offset & 0x3)
+                return 0;
+
+            emit_lea_pc(e, RCX, (nr*4) + 4);
+            jit_store_guest(e, rd, RCX);
+            jit_flush_regs(e);
+
+            emit_lea_pc(e, RAX, (nr*4) + offset);
+            jit_emit_set_pc(e, 1);
+            jit_emit_exit(e, nr + 1);
+            return 1;
+
+        case INSTR_JALR:
+            jit_flush_regs(e);
+            jit_load_guest(e, RAX, rs1);
+            emit_op_ext(e, JIT_REX_W, 0x81, 0, RAX); /* add rax, imm */
+            emit32(e, imm_i);
+            emit_op_ext(e, JIT_REX_W, 0x81, 4, RAX); /* and rax, ~1 */
+            emit32(e, 0xFFFFFFFE);
+            emit8(e, 0xA9);                          /* test eax, 3 */
+            emit32(e, 0x3);
+            patch_pos = emit_jcc(e, CC_NE);
+
+            emit_lea_pc(e, RCX, (nr*4) + 4);
+            jit_store_guest(e, rd, RCX);
+            jit_flush_regs(e);
+            jit_emit_set_pc(e, 1);
+            jit_emit_exit(e, nr + 1);
+
+            /* misaligned target, the interpreter raises the exception */
+            patch_rel32(e, patch_pos);
+            jit_emit_interp_call(e, nr);
+            jit_emit_exit(e, nr + 1);
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+/* Keep the most used guest registers in host registers */
+static void jit_alloc_regs(jit_emitter_td *e, jit_slot_td *slot)
+{
+    unsigned int use_count[NR_RVI_REGS] = {0};
+    unsigned int i = 0, j = 0, best = 0;
+    uint32_t instruction = 0;
+
+    for(i=0;i<slot->nr_instr;i++)
+    {
+        instruction = slot->instruction[i];
+        use_count[(instruction >> 7) & 0x1F]++;
+        use_count[(instruction >> 15) & 0x1F]++;
+        use_count[(instruction >> 20) & 0x1F]++;
+    }
+    use_count[0] = 0;
+
+    for(i=0;i<sizeof(jit_cache_regs);i++)
+    {
+        best = 0;
+        for(j=1;j<NR_RVI_REGS;j++)
+        {
+            if(use_count[j] > use_count[best])
+                best = j;
+        }
+
+        /* loading and writing back would cost more than it saves */
+        if(use_count[best] < 2)
+            break;
+
+        e->host_reg[best] = jit_cache_regs[i];
+        use_count[best] = 0;
+    }
+}
+
+/* returns the size of the translated code or 0 if the block can't be translated */
+static unsigned int jit_translate(jit_slot_td *slot, uint8_t *buf, unsigned int size)
+{
+    jit_emitter_td e;
+    unsigned int i = 0;
+    uint8_t last_interpreted = 0;
+    uint8_t opcode = 0;
+
+    memset(&e, 0, sizeof(e));
+    e.buf = buf;
+    e.size = size;
+    e.entries = slot->block->instr;
+
+    jit_alloc_regs(&e, slot);
+    jit_emit_prologue(&e);
+
+    for(i=0;i<slot->nr_instr;i++)
+    {
+        opcode = slot->instruction[i] & 0x7F;
+        last_interpreted = 0;
+
+        if( (opcode == INSTR_BEQ_BNE_BLT_BGE_BLTU_BGEU) || (opcode == INSTR_JAL) || (opcode == INSTR_JALR) )
+        {
+            if(jit_translate_jump(&e, slot->instruction[i], i))
+                break;
+        }
+        else if(jit_translate_alu(&e, slot->instruction[i], i))
+        {
+            continue;
+        }
+
+        /* loads, stores, atomics, div and the rest is left to the interpreter */
+        jit_emit_interp_call(&e, i);
+        last_interpreted = 1;
+    }
+
+    /* the block did not end with a translated jump */
+    if(i == slot->nr_instr)
+    {
+        if(!last_interpreted)
+        {
+            jit_flush_regs(&e);
+            emit_lea_pc(&e, RAX, slot->nr_instr*4);
+            jit_emit_set_pc(&e, 0);
+        }
+        jit_emit_exit(&e, slot->nr_instr);
+    }
+
+    if(e.overflow)
+        return 0;
+
+    return e.len;
+}
+
+/******************* compiler thread *******************************/
+static void *jit_thread(void *p)
+{
+    jit_td *jit = p;
+    jit_slot_td *slot = NULL;
+    uint8_t code[JIT_MAX_BLOCK_CODE_SIZE];
+    unsigned int code_len = 0;
+    int i = 0;
+
+    while(1)
+    {
+        pthread_mutex_lock(&jit->lock);
+
+        slot = NULL;
+        while(slot == NULL)
+        {
+            for(i=0;i<JIT_QUEUE_SIZE;i++)
+            {
+                if(jit->slots[i].state == jit_slot_requested)
+                {
+                    slot = &jit->slots[i];
+                    break;
+                }
+            }
+
+            if(slot == NULL)
+                pthread_cond_wait(&jit->cond, &jit->lock);
+        }
+
+        slot->state = jit_slot_compiling;
+        pthread_mutex_unlock(&jit->lock);
+
+        code_len = jit_translate(slot, code, sizeof(code));
+
+        pthread_mutex_lock(&jit->lock);
+
+        slot->code = NULL;
+        if( (code_len != 0) && (slot->flush_gen == jit->flush_gen) )
+        {
+            if((jit->code_used + code_len) <= JIT_CODE_BUFFER_SIZE)
+            {
+                slot->code = &jit->code_buf[jit->code_used];
+                memcpy(&jit->code_buf_rw[jit->code_used], code, code_len);
+                jit->code_used += code_len;
+            }
+            else
+            {
+                jit->code_full = 1;
+            }
+        }
+        JIT_DEBUG("JIT: block %lx %d instructions -> %d bytes\n", slot->block->phys_pc, slot->nr_instr, code_len);
+
+        slot->state = jit_slot_done;
+        __atomic_add_fetch(&jit->nr_done, 1, __ATOMIC_RELEASE);
+
+        pthread_mutex_unlock(&jit->lock);
+    }
+
+    return NULL;
+}
+
+/******************* Public functions *******************************/
+void jit_init(jit_td *jit)
+{
+    int fd = -1;
+
+    memset(jit, 0, sizeof(jit_td));
+
+    /* The code buffer is mapped twice, the compiler thread writes through one view and the
+     * cpu thread runs the code from the other one, so no page is writable and executable at once.
+     */
+    fd = memfd_create("riscv_em_jit", MFD_CLOEXEC);
+    if( (fd < 0) || (ftruncate(fd, JIT_CODE_BUFFER_SIZE) != 0) )
+        die_msg("Could not allocate JIT code buffer!\n");
+
+    jit->code_buf_rw = mmap(NULL, JIT_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    jit->code_buf = mmap(NULL, JIT_CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    if( (jit->code_buf_rw == MAP_FAILED) || (jit->code_buf == MAP_FAILED) )
+        die_msg("Could not map JIT code buffer!\n");
+
+    close(fd);
+
+    if( (pthread_mutex_init(&jit->lock, NULL) != 0) ||
+        (pthread_cond_init(&jit->cond, NULL) != 0) )
+        die_msg("JIT mutex init failed\n");
+
+    if(pthread_create(&jit->thread, NULL, jit_thread, jit) != 0)
+        die_msg("Could not start JIT thread!\n");
+}
+
+void jit_request(jit_td *jit, block_td *block)
+{
+    jit_slot_td *slot = NULL;
+    int i = 0;
+
+    pthread_mutex_lock(&jit->lock);
+
+    for(i=0;i<JIT_QUEUE_SIZE;i++)
+    {
+        if(jit->slots[i].state == jit_slot_free)
+        {
+            slot = &jit->slots[i];
+            break;
+        }
+    }
+
+    if(slot == NULL)
+    {
+        /* try again later */
+        block->exec_count = 0;
+        pthread_mutex_unlock(&jit->lock);
+        return;
+    }
+
+    slot->block = block;
+    slot->build_id = block->build_id;
+    slot->flush_gen = jit->flush_gen;
+    slot->nr_instr = block->nr_instr;
+    for(i=0;i<block->nr_instr;i++)
+        slot->instruction[i] = block->instr[i].instruction;
+    slot->state = jit_slot_requested;
+
+    block->jit_requested = 1;
+
+    pthread_cond_signal(&jit->cond);
+    pthread_mutex_unlock(&jit->lock);
+}
+
+/* Hands finished translations over to their blocks, this is called from the cpu thread only */
+void jit_install(jit_td *jit, block_cache_td *block_cache)
+{
+    jit_slot_td *slot = NULL;
+    unsigned int i = 0;
+
+    if(__atomic_load_n(&jit->nr_done, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    pthread_mutex_lock(&jit->lock);
+
+    for(i=0;i<JIT_QUEUE_SIZE;i++)
+    {
+        slot = &jit->slots[i];
+        if(slot->state != jit_slot_done)
+            continue;
+
+        /* the block might have been rebuilt in the meantime */
+        if( (slot->code != NULL) && (slot->flush_gen == jit->flush_gen) && (slot->block->build_id == slot->build_id) )
+            slot->block->jit_code = slot->code;
+
+        slot->state = jit_slot_free;
+    }
+    jit->nr_done = 0;
+
+    /* Start over with an empty code buffer, all blocks become interpreted until they get hot again */
+    if(jit->code_full)
+    {
+        for(i=0;i<BLOCK_CACHE_NR_BLOCKS;i++)
+        {
+            block_cache->blocks[i].jit_code = NULL;
+            block_cache->blocks[i].jit_requested = 0;
+            block_cache->blocks[i].exec_count = 0;
+        }
+        jit->code_used = 0;
+        jit->code_full = 0;
+        jit->flush_gen++;
+    }
+
+    pthread_mutex_unlock(&jit->lock);
+}
+
+#endif /* JIT_SUPPORT */
@@ -0,0 +1,80 @@
+#ifndef RISCV_JIT_H
+#define RISCV_JIT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <riscv_types.h>
+#include <block_cache.h>
+
+#ifdef JIT_SUPPORT
+
+typedef struct rv_core_struct rv_core_td;
+
+/* Translated blocks return the number of executed instructions,
+ * pc and next_pc are left the same way the interpreter would leave them.
+ */
+typedef uint64_t (*jit_block_func)(rv_core_td *rv_core);
+
+typedef enum
+{
+    jit_slot_free = 0,
+    jit_slot_requested,
+    jit_slot_compiling,
+    jit_slot_done
+
+} jit_slot_state;
+
+/* One translation job, the instruction words are copied so the compiler
+ * thread never touches blocks which might get rebuilt in the meantime.
+ */
+typedef struct jit_slot_struct
+{
+    jit_slot_state state;
+    block_td *block;
+    uint32_t build_id;
+    uint32_t flush_gen;
+    uint16_t nr_instr;
+    uint32_t instruction[BLOCK_CACHE_MAX_INSTR];
+    uint8_t *code;
+
+} jit_slot_td;
+
+typedef struct jit_struct
+{
+    /* executable and writable view of the same code buffer */
+    uint8_t *code_buf;
+    uint8_t *code_buf_rw;
+    uint64_t code_used;
+    uint8_t code_full;
+
+    /* bumped whenever the code buffer is recycled, outdated jobs are dropped */
+    uint32_t flush_gen;
+
+    jit_slot_td slots[JIT_QUEUE_SIZE];
+    unsigned int nr_done;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+} jit_td;
+
+void jit_init(jit_td *jit);
+void jit_request(jit_td *jit, block_td *block);
+void jit_install(jit_td *jit, block_cache_td *block_cache);
+
+static inline jit_block_func jit_block_get_func(block_td *block)
+{
+    jit_block_func func = NULL;
+
+    /* ISO C has no cast from object to function pointers */
+    memcpy(&func, &block->jit_code, sizeof(func));
+
+    return func;
+}
+
+#endif /* JIT_SUPPORT */
+
+#endif /* RISCV_JIT_H */
@@ -17,26 +17,114 @@
 /* simple macro to tranlsate this to the mmu arrangement */
 #define ACCESS_TYPE_TO_MMU(access_type) ((1 << access_type) << 1)
 
+/* Paging modes, the parameters are taken from the privileged spec */
+#ifdef RV64
+    static const mmu_mode_td mmu_mode_sv39 = { SV39_LEVELS, SV39_VPN_BITS, SV39_PTESIZE, 39, SV39_PPN_BITS };
+    static const mmu_mode_td mmu_mode_sv48 = { SV48_LEVELS, SV39_VPN_BITS, SV39_PTESIZE, 48, SV39_PPN_BITS };
+#else
+    static const mmu_mode_td mmu_mode_sv32 = { SV32_LEVELS, SV32_VPN_BITS, SV32_PTESIZE, 32, SV32_PPN_BITS };
+#endif
+
+static const mmu_mode_td *mmu_get_mode(uint8_t mode)
+{
+    #ifdef RV64
+        switch(mode)
+        {
+            case MMU_SATP_MODE_SV39:
+                return &mmu_mode_sv39;
+            case MMU_SATP_MODE_SV48:
+                return &mmu_mode_sv48;
+            default:
+                return NULL;
+        }
+    #else
+        return (mode == MMU_SATP_MODE_SV32) ? &mmu_mode_sv32 : NULL;
+    #endif
+}
+
 rv_ret mmu_read_csr(void *priv, privilege_level curr_priv_mode, uint16_t reg_index, rv_uint_xlen *out_val)
 {
     (void)curr_priv_mode;
-    (void) reg_index;
 
     mmu_td *mmu = priv;
-    *out_val = mmu->satp_reg;
+
+    switch(reg_index)
+    {
+        case mmu_reg_satp:
+            *out_val = mmu->satp_reg;
+            break;
+        #ifdef RV64
+            case mmu_reg_envcfg:
+                *out_val = (rv_uint_xlen)mmu->ad_update << MMU_ENVCFG_ADUE_BIT;
+                break;
+        #else
+            case mmu_reg_envcfg:
+                *out_val = 0;
+                break;
+            case mmu_reg_envcfgh:
+                *out_val = (rv_uint_xlen)mmu->ad_update << MMU_ENVCFGH_ADUE_BIT;
+                break;
+        #endif
+        default:
+            return rv_err;
+    }
+
     // printf("m read! %d %x\n", reg_index, *out_val);
     return rv_ok;
 }
 
+static void mmu_write_satp(mmu_td *mmu, rv_uint_xlen csr_val)
+{
+    uint8_t mode = extractxlen(csr_val, MMU_SATP_MODE_BIT, MMU_SATP_MODE_NR_BITS);
+
+    /* A write with an unsupported mode has no effect at all */
+    if(mode && (mmu_get_mode(mode) == NULL))
+        return;
+
+    #ifdef TLB_SUPPORT
+        /* Translations are tagged with their ASID, so switching between address spaces keeps them.
+         * Only a mode change or a new root table for the same ASID drops what can't be valid anymore.
+         */
+        if(mode != extractxlen(mmu->satp_reg, MMU_SATP_MODE_BIT, MMU_SATP_MODE_NR_BITS))
+            tlb_flush(&mmu->tlb);
+        else if(extractxlen(csr_val, MMU_SATP_ASID_BIT, MMU_SATP_ASID_NR_BITS) == mmu->tlb.asid)
+        {
+            if(csr_val != mmu->satp_reg)
+                tlb_flush_vma(&mmu->tlb, 0, 0, 1, mmu->tlb.asid);
+        }
+
+        mmu->tlb.asid = extractxlen(csr_val, MMU_SATP_ASID_BIT, MMU_SATP_ASID_NR_BITS);
+    #endif
+
+    mmu->satp_reg = csr_val;
+}
+
 rv_ret mmu_write_csr(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val)
 {
     (void) curr_priv;
-    (void) reg_index;
 
     mmu_td *mmu = priv;
 
-    /* we only have satp to write */
-    mmu->satp_reg = csr_val;
+    /* Only the ADUE bit of menvcfg is implemented, all others are read-only zero */
+    switch(reg_index)
+    {
+        case mmu_reg_satp:
+            mmu_write_satp(mmu, csr_val);
+            break;
+        #ifdef RV64
+            case mmu_reg_envcfg:
+                mmu->ad_update = extractxlen(csr_val, MMU_ENVCFG_ADUE_BIT, 1);
+                break;
+        #else
+            case mmu_reg_envcfg:
+                break;
+            case mmu_reg_envcfgh:
+                mmu->ad_update = extractxlen(csr_val, MMU_ENVCFGH_ADUE_BIT, 1);
+                break;
+        #endif
+        default:
+            return rv_err;
+    }
 
     return rv_ok;
 }
@@ -184,75 +272,113 @@ uint64_t mmu_virt_to_phys(mmu_td *mmu,
 }
 #endif
 
-#if 1
-uint64_t mmu_virt_to_phys(mmu_td *mmu, 
-                          privilege_level curr_priv, 
-                          rv_uint_xlen virt_addr, 
-                          bus_access_type access_type, 
-                          uint8_t mxr, 
-                          uint8_t sum, 
-                          mmu_ret *ret_val,
-                          rv_core_td *rv_core,
-                          rv_uint_xlen value)
+static inline uint64_t mmu_pte_ppn(const mmu_mode_td *paging, uint64_t pte)
 {
-    /* We only have these here for debug purposes */
-    (void) value;
-    (void) rv_core;
-
-    int i,j = 0;
-    rv_uint_xlen a = 0;
-    rv_uint_xlen pte = 0;
-    rv_uint_xlen pte_addr = 0;
-    uint8_t pte_flags = 0;
-    uint8_t user_page = 0;
-    *ret_val = mmu_ok;
-    uint8_t mode = extractxlen(mmu->satp_reg, MMU_SATP_MODE_BIT, MMU_SATP_MODE_NR_BITS);
+    return (pte >> 10) & ((1ULL << paging->ppn_bits) - 1);
+}
 
-    /* in machine mode we don't have address translation */
-    if( (curr_priv == machine_mode) || !mode )
+#ifdef TLB_SUPPORT
+    /* The part of the virtual page number above the given level, the root table is the same for all of them */
+    static inline rv_uint_xlen mmu_walk_prefix(const mmu_mode_td *paging, int level, rv_uint_xlen virt_addr)
     {
-        return virt_addr;
+        if(level == (paging->levels-1))
+            return 0;
+
+        return virt_addr >> (MMU_PAGE_SHIFT + ((level + 1) * paging->vpn_bits));
     }
 
-    rv_uint_xlen vpn[SV32_LEVELS] = 
+    static tlb_walk_td *mmu_walk_remember(mmu_td *mmu, const mmu_mode_td *paging, privilege_level curr_priv, int level,
+                                          rv_uint_xlen virt_addr, uint64_t table, uint8_t global)
     {
-        (virt_addr >> 12) & 0x3ff,
-        (virt_addr >> 22) & 0x3ff
-    };
-    // MMU_DEBUG("vpn[1] "PRINTF_FMT"\n", vpn[1]);
-    // MMU_DEBUG("vpn[0] "PRINTF_FMT"\n", vpn[0]);
+        rv_uint_xlen prefix = mmu_walk_prefix(paging, level, virt_addr);
+        tlb_walk_td *walk = tlb_walk_get(&mmu->tlb, level, prefix);
+        uint8_t *host_table = (mmu->table_ptr != NULL) ? mmu->table_ptr(mmu->priv, curr_priv, bus_read_access, table) : NULL;
+
+        tlb_walk_fill(walk, mmu->satp_reg, prefix, table, host_table, global);
+
+        return walk;
+    }
+#endif
+
+/* Steps 1 to 4 and 6 of the translation process, returns the level of the leaf pte or -1 on a page fault */
+static int mmu_walk(mmu_td *mmu, const mmu_mode_td *paging, privilege_level curr_priv, rv_uint_xlen virt_addr, uint64_t *leaf_pte, rv_uint_xlen *leaf_pte_addr)
+{
+    int i = 0;
+    rv_uint_xlen a = 0;
+    rv_uint_xlen pte_addr = 0;
+    rv_uint_xlen vpn = 0;
+    uint64_t pte = 0;
+    uint8_t pte_flags = 0;
+    uint8_t global = 0;
+    uint8_t *host_table = NULL;
 
     /*
      * 1. Let a be satp.ppn × PAGESIZE, and let i = LEVELS − 1. (For Sv32, PAGESIZE=2^12 and LEVELS=2.) 
      */
-    a = (mmu->satp_reg & 0x3FFFFF) * SV32_PAGE_SIZE;
-    MMU_DEBUG("satp: %x\n", mmu->satp_reg);
+    a = (mmu->satp_reg & ((1ULL << MMU_SATP_PPN_NR_BITS) - 1)) * MMU_PAGE_SIZE;
+    i = paging->levels-1;
+    MMU_DEBUG("satp: "PRINTF_FMT"\n", mmu->satp_reg);
+
+    #ifdef TLB_SUPPORT
+        /* Skip the levels above the lowest page table which is already known */
+        {
+            int level = 0;
+            tlb_walk_td *walk = NULL;
 
-    for(i=(SV32_LEVELS-1),j=0;i>=0;i--,j++)
+            for(level=0;level<paging->levels;level++)
+            {
+                walk = tlb_walk_get(&mmu->tlb, level, mmu_walk_prefix(paging, level, virt_addr));
+                if(tlb_walk_hit(walk, mmu->satp_reg, mmu_walk_prefix(paging, level, virt_addr)))
+                    break;
+            }
+
+            if(level == paging->levels)
+                walk = mmu_walk_remember(mmu, paging, curr_priv, paging->levels-1, virt_addr, a, 0);
+            else
+                i = level;
+
+            a = walk->table;
+            host_table = walk->host_table;
+            global = walk->global;
+        }
+    #endif
+
+    for(;i>=0;i--)
     {
         /*
         * 2. Let pte be the value of the PTE at address a+va.vpn[i]×PTESIZE. (For Sv32, PTESIZE=4.)
         * If accessing pte violates a PMA or PMP check, raise an access exception.
         */
-        pte_addr = a + (vpn[i] * SV32_PTESIZE);
+        vpn = (virt_addr >> (MMU_PAGE_SHIFT + (i * paging->vpn_bits))) & ((1 << paging->vpn_bits) - 1);
+        pte_addr = a + (vpn * paging->pte_size);
         MMU_DEBUG("address a: " PRINTF_FMT " pte_addr: "PRINTF_FMT"\n", a, pte_addr);
 
         /* Here we should raise an exception if PMP violation occurs, will be done automatically
-         * if read_mem is set to the "checked_read_mem()" function.
+         * if read_mem is set to the "checked_read_mem()" function. Tables which are plain memory
+         * and readable according to the PMP are read directly.
          */
-        mmu->bus_access(mmu->priv, curr_priv, bus_read_access, pte_addr, &pte, sizeof(rv_uint_xlen));
-        MMU_DEBUG("pte[%d] "PRINTF_FMT"\n", i, pte);
+        pte = 0;
+        if(host_table != NULL)
+            memcpy(&pte, host_table + (vpn * paging->pte_size), paging->pte_size);
+        else
+            mmu->bus_access(mmu->priv, curr_priv, bus_read_access, pte_addr, &pte, paging->pte_size);
+        MMU_DEBUG("pte[%d] %016lx\n", i, (unsigned long)pte);
         pte_flags = pte;
 
         /* 
          * 3. If pte.v = 0, or if pte.r = 0 and pte.w = 1, stop and raise a page-fault exception.
+         * The upper pte bits of Sv39 and Sv48 are reserved and have to be zero.
          */
-        if( (!(pte_flags & MMU_PAGE_VALID)) || ((!(pte_flags & MMU_PAGE_READ)) && (pte_flags & MMU_PAGE_WRITE)) )
+        if( (!(pte_flags & MMU_PAGE_VALID)) || ((!(pte_flags & MMU_PAGE_READ)) && (pte_flags & MMU_PAGE_WRITE)) ||
+            (pte >> (10 + paging->ppn_bits)) )
         {
-            MMU_DEBUG("page fault: pte.v = 0, or if pte.r = 0 and pte.w = 1 access_type: %d a: "PRINTF_FMT" virt_addr: "PRINTF_FMT" pte: "PRINTF_FMT" pte_addr: "PRINTF_FMT" flags: %x curr_priv: %d level: %d pc: "PRINTF_FMT" value: "PRINTF_FMT"\n", access_type, a, virt_addr, pte, pte_addr, pte_flags, curr_priv, i, rv_core->pc, value);
-            goto exit_page_fault;
+            MMU_DEBUG("page fault: pte.v = 0, or if pte.r = 0 and pte.w = 1 a: "PRINTF_FMT" virt_addr: "PRINTF_FMT" pte_addr: "PRINTF_FMT" flags: %x curr_priv: %d level: %d\n", a, virt_addr, pte_addr, pte_flags, curr_priv, i);
+            return -1;
         }
 
+        /* A global pointer makes all mappings below it global */
+        global |= pte_flags & MMU_PAGE_GLOB;
+
         /*
          * 4. Otherwise, the PTE is valid. If pte.r = 1 or pte.x = 1, go to step 5. Otherwise, this PTE is a
          * pointer to the next level of the page table. Let i = i − 1. If i < 0, stop and raise a page-fault
@@ -265,34 +391,54 @@ uint64_t mmu_virt_to_phys(mmu_td *mmu,
             break;
         }
 
-        a = (pte >> 10) * SV32_PAGE_SIZE;
+        a = mmu_pte_ppn(paging, pte) * MMU_PAGE_SIZE;
+        host_table = NULL;
+
+        #ifdef TLB_SUPPORT
+            if(i > 0)
+                host_table = mmu_walk_remember(mmu, paging, curr_priv, i-1, virt_addr, a, global)->host_table;
+        #endif
     }
 
     if(i<0)
     {
         MMU_DEBUG("page fault: i < 0\n");
-        goto exit_page_fault;
+        return -1;
     }
 
+    /*
+     * 6. If i > 0 and pa.ppn[i − 1 : 0] != 0, this is a misaligned superpage; stop and raise a page-fault exception.
+     */
+    if(mmu_pte_ppn(paging, pte) & ((1ULL << (i * paging->vpn_bits)) - 1))
+    {
+        MMU_DEBUG("misaligned superpage!\n");
+        return -1;
+    }
+
+    *leaf_pte = pte | global;
+    *leaf_pte_addr = pte_addr;
+    return i;
+}
+
+/* Steps 5 and 7 of the translation process, which only depend on the leaf pte */
+static mmu_ret mmu_check_leaf(uint8_t pte_flags, privilege_level curr_priv, bus_access_type access_type, uint8_t mxr, uint8_t sum, uint8_t ad_update)
+{
     /*
      * 5. A leaf PTE has been found. Determine if the requested memory access is allowed by the
      * pte.r, pte.w, pte.x, and pte.u bits, given the current privilege mode and the value of the SUM
      * and MXR fields of the mstatus register. If not, stop and raise a page-fault exception.
      */
-    user_page = pte_flags & MMU_PAGE_USER;
+    uint8_t user_page = pte_flags & MMU_PAGE_USER;
 
     /* User has only access to user pages */
     if ( (curr_priv == user_mode) && !user_page)
-    {
-        printf("page fault: user access to higher priv page!\n");
-        goto exit_page_fault;
-    }
+        return mmu_page_fault;
 
     /* Supervisor only has access to user pages if SUM = 1 */
     if( (curr_priv == supervisor_mode) && user_page && !sum )
     {
         MMU_DEBUG("page fault: supervisor access to user page!\n");
-        goto exit_page_fault;
+        return mmu_page_fault;
     }
 
     /* Check if MXR */
@@ -302,79 +448,228 @@ uint64_t mmu_virt_to_phys(mmu_td *mmu,
     if(!(ACCESS_TYPE_TO_MMU(access_type) & pte_flags ))
     {
         MMU_DEBUG("page fault: invalid RWX flags!\n");
-        goto exit_page_fault;
+        return mmu_page_fault;
     }
 
-    pte = pte << SV32_PTESHIFT;
-    /* physical addresses are 34 Bit wide!!! even on RV32 systems */
-    rv_uint_xlen ppn[SV32_LEVELS] = 
+    /*
+    * 7. If pte.a = 0, or if the memory access is a store and pte.d = 0, either raise a page-fault exception or:
+    *  - Set pte.a to 1 and, if the memory access is a store, also set pte.d to 1.
+    *  - If this access violates a PMA or PMP check, raise an access exception.
+    *  - This update and the loading of pte in step 2 must be atomic; in particular, no intervening store to the PTE may be perceived to have occurred in-between.
+    * The update is done by mmu_update_ad() if enabled in menvcfg (Svadu).
+    */
+    if( !ad_update && ((!(pte_flags & MMU_PAGE_ACCESSED)) || ((access_type == bus_write_access) && !(pte_flags & MMU_PAGE_DIRTY))) )
+    {
+        // printf("pta.a or pte.d page fault!\n");
+        return mmu_page_fault;
+    }
+
+    return mmu_ok;
+}
+
+/* Replaces a pte in host memory if it still holds the expected value */
+static int mmu_pte_exchange(uint8_t *host_pte, uint8_t pte_size, uint64_t expected, uint64_t desired)
+{
+    uint32_t expected_32 = expected;
+
+    if(pte_size == 4)
+        return __atomic_compare_exchange_n((uint32_t *)host_pte, &expected_32, (uint32_t)desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+
+    return __atomic_compare_exchange_n((uint64_t *)host_pte, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* Step 7 with Svadu, sets the missing A and D bits of the leaf pte. Other harts might change the pte at
+ * the same time, so in plain memory it is swapped in if it still holds what was read, otherwise and also
+ * if it changed since the walk, the walk has to be redone.
+ * Returns 0 if the pte is up to date, 1 if the walk has to be repeated and -1 on an access fault.
+ */
+static int mmu_update_ad(mmu_td *mmu, const mmu_mode_td *paging, privilege_level curr_priv, bus_access_type access_type, rv_uint_xlen pte_addr, uint64_t *pte)
+{
+    uint64_t ad_flags = MMU_PAGE_ACCESSED | ((access_type == bus_write_access) ? MMU_PAGE_DIRTY : 0);
+    uint64_t curr_pte = 0;
+    uint8_t *host_table = NULL;
+
+    if((*pte & ad_flags) == ad_flags)
+        return 0;
+
+    /* going over the bus lets the PMP check the write as well */
+    if(mmu->bus_access(mmu->priv, curr_priv, bus_read_access, pte_addr, &curr_pte, paging->pte_size) != rv_ok)
+        return -1;
+
+    /* the pte returned by the walk might have the G bit of a pointer pte set in addition */
+    if((curr_pte | (*pte & MMU_PAGE_GLOB)) != *pte)
+        return 1;
+
+    if(mmu->table_ptr != NULL)
+        host_table = mmu->table_ptr(mmu->priv, curr_priv, bus_write_access, pte_addr & ~(uint64_t)(MMU_PAGE_SIZE-1));
+
+    if(host_table != NULL)
     {
-        (pte >> 12) & 0x3ff,
-        (pte >> 22) & 0xfff
-    };
-    // MMU_DEBUG("ppn[1]: %x\n", ppn[1]);
-    // MMU_DEBUG("ppn[0]: %x\n", ppn[0]);
-
-    /* physical addresses are at least 34 Bits wide, so we need uint64_t here */
-    uint64_t phys_addr_translation[SV32_LEVELS] = 
+        if(!mmu_pte_exchange(&host_table[pte_addr & (MMU_PAGE_SIZE-1)], paging->pte_size, curr_pte, curr_pte | ad_flags))
+            return 1;
+    }
+    else
     {
-        (ppn[1] << 22) | (ppn[0] << 12) | (virt_addr & 0xfff),
-        (ppn[1] << 22) | (virt_addr & 0x3fffff)
-    };
+        curr_pte |= ad_flags;
+        if(mmu->bus_access(mmu->priv, curr_priv, bus_write_access, pte_addr, &curr_pte, paging->pte_size) != rv_ok)
+            return -1;
+    }
 
-    /*
-     * 6. If i > 0 and pa.ppn[i − 1 : 0] != 0, this is a misaligned superpage; stop and raise a page-fault exception.
-     */
-    if(i > 0 && ppn[i-1] != 0)
+    *pte |= ad_flags;
+    return 0;
+}
+
+uint64_t mmu_virt_to_phys(mmu_td *mmu, 
+                          privilege_level curr_priv, 
+                          rv_uint_xlen virt_addr, 
+                          bus_access_type access_type, 
+                          uint8_t mxr, 
+                          uint8_t sum, 
+                          mmu_ret *ret_val,
+                          rv_core_td *rv_core,
+                          rv_uint_xlen value)
+{
+    /* We only have these here for debug purposes */
+    (void) value;
+    (void) rv_core;
+
+    int i = -1;
+    int ad_ret = 0;
+    uint64_t pte = 0;
+    rv_uint_xlen pte_addr = 0;
+    uint64_t page_mask = 0;
+    uint64_t phys_addr = 0;
+    const mmu_mode_td *paging = NULL;
+    *ret_val = mmu_ok;
+    uint8_t mode = extractxlen(mmu->satp_reg, MMU_SATP_MODE_BIT, MMU_SATP_MODE_NR_BITS);
+
+    /* in machine mode we don't have address translation */
+    if( (curr_priv == machine_mode) || !mode )
     {
-        MMU_DEBUG("misaligned superpage!\n");
+        if(access_type == bus_instr_access)
+        {
+            mmu->last_phys_pc = virt_addr;
+            mmu->last_virt_pc = virt_addr;
+        }
+
+        #ifdef TLB_SUPPORT
+            mmu->last_global = 1;
+            mmu->last_page_shift = MMU_PAGE_SHIFT;
+        #endif
+
+        return virt_addr;
+    }
+
+    /* satp writes with unsupported modes are ignored, so this can't fail */
+    paging = mmu_get_mode(mode);
+
+    /* the bits above the virtual address have to be copies of its highest bit */
+    if( (paging->va_bits < XLEN) &&
+        ((rv_uint_xlen)(((rv_int_xlen)virt_addr << (XLEN - paging->va_bits)) >> (XLEN - paging->va_bits)) != virt_addr) )
+    {
+        MMU_DEBUG("page fault: virtual address not sign extended "PRINTF_FMT"\n", virt_addr);
         goto exit_page_fault;
     }
 
-    #if 1
-        /*
-        * 7. If pte.a = 0, or if the memory access is a store and pte.d = 0, either raise a page-fault exception or:
-        *  - Set pte.a to 1 and, if the memory access is a store, also set pte.d to 1.
-        *  - If this access violates a PMA or PMP check, raise an access exception.
-        *  - This update and the loading of pte in step 2 must be atomic; in particular, no intervening store to the PTE may be perceived to have occurred in-between.
-        */
-        if( (!(pte_flags & MMU_PAGE_ACCESSED)) || ((access_type == bus_write_access) && !(pte_flags & MMU_PAGE_DIRTY)) )
+    #ifdef TLB_SUPPORT
+        /* Superpages are cached as leaf ptes, the permissions are checked again on every use. If a
+         * cached pte denies the access it might just be outdated, so in that case do a real walk.
+         */
+        i = tlb_superpage_lookup(&mmu->tlb, paging->levels, paging->vpn_bits, virt_addr, &pte);
+        if( (i > 0) && (mmu_check_leaf((uint8_t)pte, curr_priv, access_type, mxr, sum, 0) != mmu_ok) )
+            i = -1;
+    #endif
+
+    while(i < 0)
+    {
+        i = mmu_walk(mmu, paging, curr_priv, virt_addr, &pte, &pte_addr);
+        if(i < 0)
+            goto exit_page_fault;
+
+        if(mmu_check_leaf((uint8_t)pte, curr_priv, access_type, mxr, sum, mmu->ad_update) != mmu_ok)
         {
-            // printf("pta.a or pte.d page fault!\n");
+            /* not reported by mmu_check_leaf(), as the cached superpages are checked silently */
+            if( (curr_priv == user_mode) && !(pte & MMU_PAGE_USER) )
+                printf("page fault: user access to higher priv page!\n");
             goto exit_page_fault;
         }
-    #endif
+
+        if(mmu->ad_update)
+        {
+            ad_ret = mmu_update_ad(mmu, paging, curr_priv, access_type, pte_addr, &pte);
+            if(ad_ret < 0)
+                goto exit_page_fault;
+            if(ad_ret > 0)
+            {
+                i = -1;
+                continue;
+            }
+        }
+
+        #ifdef TLB_SUPPORT
+            if(i > 0)
+                tlb_superpage_fill(&mmu->tlb, i, paging->vpn_bits, virt_addr, pte, (pte & MMU_PAGE_GLOB) ? 1 : 0);
+        #endif
+    }
 
     /*
      * 8. The translation is successful. The translated physical address is given as follows:
      * - pa.pgoff = va.pgoff.
      * - If i > 0, then this is a superpage translation and pa.ppn[i − 1 : 0] = va.vpn[i − 1 : 0].
      * - pa.ppn[LEVELS − 1 : i] = pte.ppn[LEVELS − 1 : i].
+     * physical addresses are 34 Bit wide even on RV32 systems, so we need uint64_t here
      */
+    page_mask = (1ULL << (MMU_PAGE_SHIFT + (i * paging->vpn_bits))) - 1;
+    phys_addr = ((mmu_pte_ppn(paging, pte) << MMU_PAGE_SHIFT) & ~page_mask) | (virt_addr & page_mask);
+
+    #ifdef TLB_SUPPORT
+        mmu->last_global = (pte & MMU_PAGE_GLOB) ? 1 : 0;
+        mmu->last_page_shift = MMU_PAGE_SHIFT + (i * paging->vpn_bits);
+    #endif
+
     if(access_type == bus_instr_access)
     {
-        mmu->last_phys_pc = phys_addr_translation[i];
+        mmu->last_phys_pc = phys_addr;
         mmu->last_virt_pc = virt_addr;
     }
 
-    return phys_addr_translation[i];
+    return phys_addr;
 
     exit_page_fault:
         // printf("page fault!!!\n");
         *ret_val = mmu_page_fault;
         return 0;
 }
-#endif
 
 void mmu_dump(mmu_td *mmu)
 {
     printf("satp_reg: " PRINTF_FMT"\n", mmu->satp_reg);
 }
 
-void mmu_init(mmu_td *mmu, bus_access_func bus_access, void *priv)
+/* Cached translations are not part of a snapshot, they are dropped on restore */
+void mmu_snapshot(mmu_td *mmu, snapshot_td *snapshot)
+{
+    SNAPSHOT_FIELD(snapshot, mmu->satp_reg);
+    SNAPSHOT_FIELD(snapshot, mmu->ad_update);
+
+    if(!snapshot->restore)
+        return;
+
+    #ifdef TLB_SUPPORT
+        tlb_flush(&mmu->tlb);
+        mmu->tlb.asid = extractxlen(mmu->satp_reg, MMU_SATP_ASID_BIT, MMU_SATP_ASID_NR_BITS);
+    #endif
+}
+
+void mmu_init(mmu_td *mmu, bus_access_func bus_access, mmu_table_ptr_func table_ptr, void *priv)
 {
     memset(mmu, 0, sizeof(mmu_td));
 
     mmu->bus_access = bus_access;
+    mmu->table_ptr = table_ptr;
     mmu->priv = priv;
+
+    #ifdef TLB_SUPPORT
+        tlb_init(&mmu->tlb);
+    #endif
 }
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <riscv_types.h>
 
+#include <tlb.h>
+#include <snapshot.h>
+
 #define MMU_PAGE_VALID (1<<0)
 #define MMU_PAGE_READ  (1<<1)
 #define MMU_PAGE_WRITE (1<<2)
@@ -14,21 +17,53 @@
 #define MMU_PAGE_DIRTY  (1<<7)
 
 #define MMU_SATP_MODE_SV32 1
+#define MMU_SATP_MODE_SV39 8
+#define MMU_SATP_MODE_SV48 9
+
+#define MMU_PAGE_SHIFT 12
+#define MMU_PAGE_SIZE (1UL << MMU_PAGE_SHIFT)
 
 #define SV32_LEVELS 2
 #define SV32_PAGE_SIZE 4096
 #define SV32_PAGE_TABLE_ENTRIES 1024
 #define SV32_PTESIZE 4
 #define SV32_PTESHIFT 2
+#define SV32_VPN_BITS 10
+#define SV32_PPN_BITS 22
+
+/* Sv48 only adds another level to Sv39 */
+#define SV39_LEVELS 3
+#define SV48_LEVELS 4
+#define SV39_PTESIZE 8
+#define SV39_VPN_BITS 9
+#define SV39_PPN_BITS 44
+
+#define MMU_MAX_LEVELS SV48_LEVELS
 
 #ifdef RV64
     #define MMU_SATP_MODE_BIT 60
     #define MMU_SATP_MODE_NR_BITS 4
+    #define MMU_SATP_ASID_BIT 44
+    #define MMU_SATP_ASID_NR_BITS 16
+    #define MMU_SATP_PPN_NR_BITS 44
 #else
     #define MMU_SATP_MODE_BIT 31
     #define MMU_SATP_MODE_NR_BITS 1
+    #define MMU_SATP_ASID_BIT 22
+    #define MMU_SATP_ASID_NR_BITS 9
+    #define MMU_SATP_PPN_NR_BITS 22
+#endif
+
+/* Svadu, hardware A/D bit updates are enabled by menvcfg.ADUE */
+#ifdef RV64
+    #define MMU_ENVCFG_ADUE_BIT 61
+#else
+    /* located in menvcfgh */
+    #define MMU_ENVCFGH_ADUE_BIT 29
 #endif
 
+#define MMU_ASID_MASK ((1UL << MMU_SATP_ASID_NR_BITS) - 1)
+
 typedef enum
 {
     mmu_ok = 0,
@@ -36,15 +71,41 @@ typedef enum
 
 } mmu_ret;
 
+/* CSRs handled by the mmu, used as their internal register index */
+typedef enum
+{
+    mmu_reg_satp = 0,
+    mmu_reg_envcfg,
+    mmu_reg_envcfgh
+
+} mmu_csr_reg;
+
+/* Returns the host memory of a page table page, or NULL if it has to be accessed over the bus */
+typedef uint8_t *(*mmu_table_ptr_func)(void *priv, privilege_level priv_level, bus_access_type access_type, uint64_t table_addr);
+
+typedef struct mmu_mode_struct
+{
+    uint8_t levels;
+    uint8_t vpn_bits;
+    uint8_t pte_size;
+    uint8_t va_bits;
+    uint8_t ppn_bits;
+
+} mmu_mode_td;
+
 typedef struct mmu_struct
 {
     /* satp register */
     rv_uint_xlen satp_reg;
 
+    /* menvcfg.ADUE, set A and D in the pte instead of raising a page fault */
+    uint8_t ad_update;
+
     /* bus access callbacks */
     // bus_read_mem read_mem;
     // bus_write_mem write_mem;
     bus_access_func bus_access;
+    mmu_table_ptr_func table_ptr;
 
     /* priv pointer for read and write mem cb */
     void *priv;
@@ -52,11 +113,19 @@ typedef struct mmu_struct
     rv_uint_xlen last_virt_pc;
     rv_uint_xlen last_phys_pc;    
 
+    #ifdef TLB_SUPPORT
+        tlb_td tlb;
+
+        /* describes the last successful translation, needed to fill the tlb */
+        uint8_t last_global;
+        uint8_t last_page_shift;
+    #endif
+
 } mmu_td;
 
 #include <core.h>
 
-void mmu_init(mmu_td *mmu, bus_access_func bus_access, void *priv);
+void mmu_init(mmu_td *mmu, bus_access_func bus_access, mmu_table_ptr_func table_ptr, void *priv);
 uint64_t mmu_virt_to_phys(mmu_td *mmu, 
                           privilege_level curr_priv, 
                           rv_uint_xlen virt_addr, 
@@ -82,6 +151,7 @@ mmu_ret mmu_mem_write(mmu_td *mmu,
                       uint8_t mxr, 
                       uint8_t sum);
 void mmu_dump(mmu_td *mmu);
+void mmu_snapshot(mmu_td *mmu, snapshot_td *snapshot);
 rv_ret mmu_read_csr(void *priv, privilege_level curr_priv_mode, uint16_t reg_index, rv_uint_xlen *out_val);
 rv_ret mmu_write_csr(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val);
 
@@ -9,8 +9,13 @@
 #define TEST_RAM_SIZE_BYTES 0x800000
 #define TEST_RAM_ADDR_OFFS 0x2000
 
+/* page tables of the Sv39 and Sv48 tests are taken from here on */
+#define TEST_TABLES_ADDR 0x100000
+
 mmu_td mmu_test = {0};
 uint8_t test_ram[TEST_RAM_SIZE_BYTES] = {0};
+static uint64_t test_next_table = 0;
+static unsigned int test_nr_reads = 0;
 
 static rv_ret mmu_phys_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen addr, void *value, uint8_t len)
 {
@@ -24,7 +29,10 @@ static rv_ret mmu_phys_bus_access(void *priv, privilege_level priv_level, bus_ac
         if(access_type == bus_write_access)
             memcpy(&test_ram[tmp_addr], value, len);
         else 
+        {
             memcpy(value, &test_ram[tmp_addr], len);
+            test_nr_reads++;
+        }
         return rv_ok;
     }
     return rv_err;
@@ -33,8 +41,16 @@ static rv_ret mmu_phys_bus_access(void *priv, privilege_level priv_level, bus_ac
 void setUp(void)
 {
     memset(&mmu_test, 0, sizeof(mmu_td));
-    mmu_init(&mmu_test, mmu_phys_bus_access, NULL);
-    mmu_write_csr(&mmu_test, supervisor_mode, 0, (MMU_SATP_MODE_SV32<<MMU_SATP_MODE_BIT) | (TEST_RAM_ADDR_OFFS >> 12) );
+    memset(test_ram, 0, sizeof(test_ram));
+    test_next_table = TEST_TABLES_ADDR;
+    test_nr_reads = 0;
+
+    mmu_init(&mmu_test, mmu_phys_bus_access, NULL, NULL);
+    #ifdef RV64
+        mmu_write_csr(&mmu_test, supervisor_mode, 0, ((rv_uint_xlen)MMU_SATP_MODE_SV39<<MMU_SATP_MODE_BIT) | (TEST_RAM_ADDR_OFFS >> 12) );
+    #else
+        mmu_write_csr(&mmu_test, supervisor_mode, 0, ((rv_uint_xlen)MMU_SATP_MODE_SV32<<MMU_SATP_MODE_BIT) | (TEST_RAM_ADDR_OFFS >> 12) );
+    #endif
 }
 
 void tearDown(void)
@@ -66,29 +82,29 @@ void mmu_map_test(mmu_td *mmu, rv_uint_xlen virt_addr, uint64_t phys_addr, uint8
     };
 
     rv_uint_xlen root_page_table_addr = mmu->satp_reg << 12;
-    printf("root page table: %x\n", root_page_table_addr);
+    printf("root page table: "PRINTF_FMT"\n", root_page_table_addr);
 
     printf("phys_addr: %lx\n", phys_addr);
-    printf("virt_addr: %x\n", virt_addr);
+    printf("virt_addr: "PRINTF_FMT"\n", virt_addr);
 
-    printf("vpn[1]: %x\n", vpn[1]);
-    printf("vpn[0]: %x\n", vpn[0]);
+    printf("vpn[1]: "PRINTF_FMT"\n", vpn[1]);
+    printf("vpn[0]: "PRINTF_FMT"\n", vpn[0]);
 
     /* First get root page table address */
     rv_uint_xlen a = root_page_table_addr + (vpn[1] * SV32_PTESIZE);
-    printf("a: %x\n", a);
+    printf("a: "PRINTF_FMT"\n", a);
 
     /* For now we only have 1 level so just point to the current page table */
     pte = ((root_page_table_addr >> 12) << 10) | MMU_PAGE_VALID;
-    printf("pte: %x\n", pte);
+    printf("pte: "PRINTF_FMT"\n", pte);
     mmu_phys_bus_access(NULL, machine_mode, bus_write_access, a, &pte, sizeof(rv_uint_xlen));
 
     /* get address of the second level page table, which actually points to the first level */
     a = ((pte >> 10) << 12) + (vpn[0] * SV32_PTESIZE);
-    printf("a: %x\n", a);
+    printf("a: "PRINTF_FMT"\n", a);
 
     pte = ((phys_addr >> 12) << 10) | pte_flags | MMU_PAGE_VALID;
-    printf("pte: %x\n", pte);
+    printf("pte: "PRINTF_FMT"\n", pte);
     mmu_phys_bus_access(NULL, machine_mode, bus_write_access, a, &pte, sizeof(rv_uint_xlen));
 }
 
@@ -105,7 +121,7 @@ void print_page_table(mmu_td *mmu)
         mmu_phys_bus_access(NULL, machine_mode, bus_read_access, root_pg_table_addr+i, &pte, sizeof(rv_uint_xlen));
         // pte = mmu->read_mem(NULL, root_pg_table_addr+i, sizeof(rv_uint_xlen), &err);
         if(pte != 0)
-            printf("PTE1[%d]: %x\n", i, pte);
+            printf("PTE1[%d]: "PRINTF_FMT"\n", i, pte);
     }
 
     for(i=0;i<(SV32_PAGE_SIZE);i+=SV32_PTESIZE)
@@ -113,7 +129,7 @@ void print_page_table(mmu_td *mmu)
         mmu_phys_bus_access(NULL, machine_mode, bus_read_access, root_pg_table_addr+(SV32_PAGE_TABLE_ENTRIES*SV32_PTESIZE)+i, &pte, sizeof(rv_uint_xlen));
         // pte = mmu->read_mem(NULL, root_pg_table_addr+(SV32_PAGE_TABLE_ENTRIES*SV32_PTESIZE)+i, sizeof(rv_uint_xlen), &err);
         if(pte != 0)
-            printf("PTE0[%d]: %x\n", i, pte);
+            printf("PTE0[%d]: "PRINTF_FMT"\n", i, pte);
     } 
     printf("\n");
 }
@@ -131,13 +147,13 @@ void test_MMU_simple(void)
     // print_page_table(&mmu_test);
 
     /* 4K page */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     printf("translated addr: %lx\n", translated_phys_addr);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
 
     // /* Superpage */
-    // translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x8106090, bus_read_access, 0, 0, &mmu_retval);
+    // translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x8106090, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     // TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     // TEST_ASSERT_EQUAL_HEX64(0x506090, translated_phys_addr);
 }
@@ -157,50 +173,50 @@ void test_MMU_access_flags(void)
     print_page_table(&mmu_test);
 
     /* 4K page */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
 
     /* Superpage */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x8106090, bus_read_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x8106090, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x0, translated_phys_addr);
 
     /* Only instruction access should be allowed */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x16080, bus_instr_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x16080, bus_instr_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x1080, translated_phys_addr);
 
     /* Write access is not allowed */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x16080, bus_write_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x16080, bus_write_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x0, translated_phys_addr);
 
     /* Read access is also not allowed */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x16080, bus_read_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x16080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x0, translated_phys_addr);
 
     /* Write only flag (with ACCESSED and DIRTY) seems to be not allowed so without read flag also write is not permitted  */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* Also set read flag, still not permitted without 'DIRTY' bit set */
     mmu_map_test(&mmu_test, 0x17000, 0x2000, SV32_LEVELS, MMU_PAGE_WRITE | MMU_PAGE_READ);
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* Also set dirty bit, this should still not be possible without accessed bit set */
     mmu_map_test(&mmu_test, 0x17000, 0x2000, SV32_LEVELS, MMU_PAGE_WRITE | MMU_PAGE_READ | MMU_PAGE_DIRTY);
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* Also set accessed bit, and finally write access should be possible */
     mmu_map_test(&mmu_test, 0x17000, 0x2000, SV32_LEVELS, MMU_PAGE_WRITE | MMU_PAGE_READ | MMU_PAGE_DIRTY | MMU_PAGE_ACCESSED);
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x17080, bus_write_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x2080, translated_phys_addr);
 }
@@ -217,7 +233,7 @@ void test_MMU_machine_mode(void)
     print_page_table(&mmu_test);
 
     /* in machinemode the translation should be virt_addr == phys_addr */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, machine_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, machine_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x12080, translated_phys_addr);
 }
@@ -235,13 +251,13 @@ void test_MMU_mxr(void)
     print_page_table(&mmu_test);
 
     /* read access for instruction pages is not allowed, if mxr = 0 */
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, mxr, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, mxr, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* But it should be allowed if mxr = 1 */
     mxr = 1;
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, mxr, 0, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, mxr, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
 }
@@ -260,41 +276,304 @@ void test_MMU_sum(void)
 
     /* user is not allowed to access non user pages */
     sum = 0;
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, user_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, user_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* Now set SUM to 1, this has no effect in user_mode */
     sum = 1;
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, user_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, user_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* everything should be fine in supervisor_mode */
     sum = 1;
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
 
     /* Now map the page as user page, access should fail if SUM = 0 */
     sum = 0;
     mmu_map_test(&mmu_test, 0x12000, 0x4000, SV32_LEVELS, MMU_PAGE_EXEC | MMU_PAGE_READ | MMU_PAGE_WRITE | MMU_PAGE_ACCESSED | MMU_PAGE_USER);
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x00, translated_phys_addr);
 
     /* Access should be granted if SUM = 1 */
     sum = 1;
     mmu_map_test(&mmu_test, 0x12000, 0x4000, SV32_LEVELS, MMU_PAGE_EXEC | MMU_PAGE_READ | MMU_PAGE_WRITE | MMU_PAGE_ACCESSED | MMU_PAGE_USER);
-    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, sum, &mmu_retval, NULL, 0);
+    TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+    TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
+}
+
+/* The page table walk is cached, changing the pointer to the second level table only takes
+ * effect after SFENCE.VMA without an address
+ */
+void test_MMU_walk_cache(void)
+{
+    mmu_ret mmu_retval = mmu_ok;
+    uint64_t translated_phys_addr = 0;
+    rv_uint_xlen root_page_table_addr = mmu_test.satp_reg << 12;
+    rv_uint_xlen new_table_addr = 0x10000;
+    rv_uint_xlen pte = 0;
+
+    mmu_map_test(&mmu_test, 0x12000, 0x4000, SV32_LEVELS, MMU_PAGE_WRITE | MMU_PAGE_READ | MMU_PAGE_EXEC | MMU_PAGE_ACCESSED);
+
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
+    TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+    TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
+
+    /* second level table somewhere else, which maps the page to another physical one */
+    pte = ((0x8000 >> 12) << 10) | MMU_PAGE_WRITE | MMU_PAGE_READ | MMU_PAGE_EXEC | MMU_PAGE_ACCESSED | MMU_PAGE_VALID;
+    mmu_phys_bus_access(NULL, machine_mode, bus_write_access, new_table_addr + (((0x12000 >> 12) & 0x3ff) * SV32_PTESIZE), &pte, SV32_PTESIZE);
+    pte = ((new_table_addr >> 12) << 10) | MMU_PAGE_VALID;
+    mmu_phys_bus_access(NULL, machine_mode, bus_write_access, root_page_table_addr + ((0x12000 >> 22) * SV32_PTESIZE), &pte, SV32_PTESIZE);
+
+    /* an address flush only covers leaf ptes */
+    tlb_flush_vma(&mmu_test.tlb, 1, 0x12000, 0, 0);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
     TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
     TEST_ASSERT_EQUAL_HEX64(0x4080, translated_phys_addr);
+
+    tlb_flush_vma(&mmu_test.tlb, 0, 0, 0, 0);
+    translated_phys_addr = mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x12080, bus_read_access, 0, 0, &mmu_retval, NULL, 0);
+    TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+    TEST_ASSERT_EQUAL_HEX64(0x8080, translated_phys_addr);
 }
 
+#ifdef RV64
+    static void mmu_set_mode(uint8_t mode)
+    {
+        mmu_write_csr(&mmu_test, supervisor_mode, 0, ((rv_uint_xlen)mode<<MMU_SATP_MODE_BIT) | (TEST_RAM_ADDR_OFFS >> 12) );
+    }
+
+    /* Sv39 and Sv48 version of mmu_map_test(), the leaf pte is put at the given level and missing tables are added */
+    static void mmu_map_test_64(uint8_t levels, rv_uint_xlen virt_addr, uint64_t phys_addr, int level, uint64_t pte_flags)
+    {
+        uint64_t table = TEST_RAM_ADDR_OFFS;
+        uint64_t pte_addr = 0;
+        uint64_t pte = 0;
+        int i = 0;
+
+        for(i=levels-1;i>=level;i--)
+        {
+            pte_addr = table + (((virt_addr >> (MMU_PAGE_SHIFT + (i * SV39_VPN_BITS))) & 0x1ff) * SV39_PTESIZE);
+
+            if(i == level)
+                break;
+
+            mmu_phys_bus_access(NULL, machine_mode, bus_read_access, pte_addr, &pte, SV39_PTESIZE);
+            if(!(pte & MMU_PAGE_VALID))
+            {
+                pte = ((test_next_table >> 12) << 10) | MMU_PAGE_VALID;
+                mmu_phys_bus_access(NULL, machine_mode, bus_write_access, pte_addr, &pte, SV39_PTESIZE);
+                test_next_table += MMU_PAGE_SIZE;
+            }
+
+            table = (pte >> 10) << 12;
+        }
+
+        pte = ((phys_addr >> 12) << 10) | pte_flags | MMU_PAGE_VALID;
+        mmu_phys_bus_access(NULL, machine_mode, bus_write_access, pte_addr, &pte, SV39_PTESIZE);
+        test_nr_reads = 0;
+    }
+
+    static uint64_t mmu_translate_test(rv_uint_xlen virt_addr, mmu_ret *mmu_retval)
+    {
+        return mmu_virt_to_phys(&mmu_test, supervisor_mode, virt_addr, bus_read_access, 0, 0, mmu_retval, NULL, 0);
+    }
+
+    /* 4K, 2M and 1G pages, the walk reads one pte per level down to the leaf */
+    static void mmu_test_page_sizes(uint8_t levels)
+    {
+        mmu_ret mmu_retval = mmu_ok;
+        uint64_t flags = MMU_PAGE_READ | MMU_PAGE_WRITE | MMU_PAGE_ACCESSED | MMU_PAGE_DIRTY;
+
+        mmu_map_test_64(levels, 0x12345000, 0x4000, 0, flags);
+        mmu_map_test_64(levels, 0x40200000, 0x600000, 1, flags);
+        mmu_map_test_64(levels, 0x80000000, 0x40000000, 2, flags);
+
+        TEST_ASSERT_EQUAL_HEX64(0x4abc, mmu_translate_test(0x12345abc, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+        TEST_ASSERT_EQUAL(levels, test_nr_reads);
+
+        tlb_flush(&mmu_test.tlb);
+        test_nr_reads = 0;
+        TEST_ASSERT_EQUAL_HEX64(0x712345, mmu_translate_test(0x40312345, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+        TEST_ASSERT_EQUAL(levels-1, test_nr_reads);
+
+        tlb_flush(&mmu_test.tlb);
+        test_nr_reads = 0;
+        TEST_ASSERT_EQUAL_HEX64(0x40abcdef, mmu_translate_test(0x80abcdef, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+        TEST_ASSERT_EQUAL(levels-2, test_nr_reads);
+
+        /* superpages come from the tlb once they were used */
+        TEST_ASSERT_EQUAL_HEX64(0x600000, mmu_translate_test(0x40200000, &mmu_retval));
+        test_nr_reads = 0;
+        TEST_ASSERT_EQUAL_HEX64(0x40000010, mmu_translate_test(0x80000010, &mmu_retval));
+        TEST_ASSERT_EQUAL_HEX64(0x7ffff8, mmu_translate_test(0x403ffff8, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+        TEST_ASSERT_EQUAL(0, test_nr_reads);
+
+        /* neighbours of the pages are not mapped */
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x12346000, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x40400000, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0xc0000000, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+    }
+
+    void test_MMU_sv39_page_sizes(void)
+    {
+        mmu_test_page_sizes(SV39_LEVELS);
+    }
+
+    void test_MMU_sv48_page_sizes(void)
+    {
+        mmu_ret mmu_retval = mmu_ok;
+
+        mmu_set_mode(MMU_SATP_MODE_SV48);
+        mmu_test_page_sizes(SV48_LEVELS);
+
+        /* vpn[3] selects another 512G region */
+        mmu_map_test_64(SV48_LEVELS, 0x8012345000, 0x5000, 0, MMU_PAGE_READ | MMU_PAGE_ACCESSED);
+        TEST_ASSERT_EQUAL_HEX64(0x5678, mmu_translate_test(0x8012345678, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x4678, mmu_translate_test(0x12345678, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+    }
+
+    /* A superpage whose ppn has bits set below its level must fault */
+    static void mmu_test_misaligned(uint8_t levels)
+    {
+        mmu_ret mmu_retval = mmu_ok;
+        uint64_t flags = MMU_PAGE_READ | MMU_PAGE_ACCESSED;
+
+        mmu_map_test_64(levels, 0x40200000, 0x601000, 1, flags);
+        mmu_map_test_64(levels, 0x80000000, 0x40200000, 2, flags);
+        mmu_map_test_64(levels, 0xc0000000, 0x80000000, 2, flags);
+
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x40200000, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x80000000, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+
+        /* nothing of it ended up in the tlb */
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x80000000, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+
+        TEST_ASSERT_EQUAL_HEX64(0x80000100, mmu_translate_test(0xc0000100, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+    }
+
+    void test_MMU_sv39_misaligned_superpage(void)
+    {
+        mmu_test_misaligned(SV39_LEVELS);
+    }
+
+    void test_MMU_sv48_misaligned_superpage(void)
+    {
+        mmu_set_mode(MMU_SATP_MODE_SV48);
+        mmu_test_misaligned(SV48_LEVELS);
+    }
+
+    /* The bits above the virtual address have to be copies of its highest bit */
+    void test_MMU_sv39_non_canonical(void)
+    {
+        mmu_ret mmu_retval = mmu_ok;
+
+        /* vpn[2] 0x100 is the first table entry of the upper half */
+        mmu_map_test_64(SV39_LEVELS, 0xffffffc000000000UL, 0x40000000, 2, MMU_PAGE_READ | MMU_PAGE_ACCESSED);
+
+        TEST_ASSERT_EQUAL_HEX64(0x40001234, mmu_translate_test(0xffffffc000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+
+        /* same table entry, but not sign extended */
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x0000004000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x7fffffc000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0xfffffe4000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+    }
+
+    void test_MMU_sv48_non_canonical(void)
+    {
+        mmu_ret mmu_retval = mmu_ok;
+
+        mmu_set_mode(MMU_SATP_MODE_SV48);
+
+        /* vpn[3] 0x100 is the first table entry of the upper half, valid in Sv48 but not in Sv39 */
+        mmu_map_test_64(SV48_LEVELS, 0xffff800000000000UL, 0x40000000, 2, MMU_PAGE_READ | MMU_PAGE_ACCESSED);
+        mmu_map_test_64(SV48_LEVELS, 0x0000004000000000UL, 0x80000000, 2, MMU_PAGE_READ | MMU_PAGE_ACCESSED);
+
+        TEST_ASSERT_EQUAL_HEX64(0x40001234, mmu_translate_test(0xffff800000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x80001234, mmu_translate_test(0x0000004000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x0000800000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_translate_test(0x7fff800000001234UL, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+    }
+
+    /* Superpages are kept in the tlb until they are flushed, but their permissions are checked on every use */
+    void test_MMU_superpage_tlb(void)
+    {
+        mmu_ret mmu_retval = mmu_ok;
+        uint64_t pte = 0;
+        uint64_t pte_addr = TEST_RAM_ADDR_OFFS + (2 * SV39_PTESIZE);
+
+        mmu_map_test_64(SV39_LEVELS, 0x80000000, 0x40000000, 2, MMU_PAGE_READ | MMU_PAGE_ACCESSED);
+        TEST_ASSERT_EQUAL_HEX64(0x40000080, mmu_translate_test(0x80000080, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+
+        pte = ((0xc0000000 >> 12) << 10) | MMU_PAGE_READ | MMU_PAGE_ACCESSED | MMU_PAGE_VALID;
+        mmu_phys_bus_access(NULL, machine_mode, bus_write_access, pte_addr, &pte, SV39_PTESIZE);
+
+        TEST_ASSERT_EQUAL_HEX64(0x40000080, mmu_translate_test(0x80000080, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+
+        /* a cached pte which denies the access is looked up again */
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_virt_to_phys(&mmu_test, supervisor_mode, 0x80000080, bus_write_access, 0, 0, &mmu_retval, NULL, 0));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+        TEST_ASSERT_EQUAL_HEX64(0x0, mmu_virt_to_phys(&mmu_test, user_mode, 0x80000080, bus_read_access, 0, 0, &mmu_retval, NULL, 0));
+        TEST_ASSERT_EQUAL(mmu_page_fault, mmu_retval);
+
+        tlb_flush_vma(&mmu_test.tlb, 1, 0x80001000, 0, 0);
+        TEST_ASSERT_EQUAL_HEX64(0xc0000080, mmu_translate_test(0x80000080, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+
+        /* a new root table drops them as well */
+        pte = ((0x40000000 >> 12) << 10) | MMU_PAGE_READ | MMU_PAGE_ACCESSED | MMU_PAGE_VALID;
+        mmu_phys_bus_access(NULL, machine_mode, bus_write_access, TEST_TABLES_ADDR + 0x10000 + (2 * SV39_PTESIZE), &pte, SV39_PTESIZE);
+        mmu_write_csr(&mmu_test, supervisor_mode, 0, ((rv_uint_xlen)MMU_SATP_MODE_SV39<<MMU_SATP_MODE_BIT) | ((TEST_TABLES_ADDR + 0x10000) >> 12) );
+        TEST_ASSERT_EQUAL_HEX64(0x40000080, mmu_translate_test(0x80000080, &mmu_retval));
+        TEST_ASSERT_EQUAL(mmu_ok, mmu_retval);
+    }
+#endif
+
 int main() 
 {
     UnityBegin("mmu/unit_tests.c");
-    RUN_TEST(test_MMU_simple, __LINE__);
+    #ifdef RV64
+        RUN_TEST(test_MMU_sv39_page_sizes, __LINE__);
+        RUN_TEST(test_MMU_sv48_page_sizes, __LINE__);
+        RUN_TEST(test_MMU_sv39_misaligned_superpage, __LINE__);
+        RUN_TEST(test_MMU_sv48_misaligned_superpage, __LINE__);
+        RUN_TEST(test_MMU_sv39_non_canonical, __LINE__);
+        RUN_TEST(test_MMU_sv48_non_canonical, __LINE__);
+        RUN_TEST(test_MMU_superpage_tlb, __LINE__);
+    #else
+        /* Sv32 only exists on RV32 */
+        RUN_TEST(test_MMU_simple, __LINE__);
+        RUN_TEST(test_MMU_walk_cache, __LINE__);
+    #endif
     // RUN_TEST(test_MMU_access_flags, __LINE__);
     // RUN_TEST(test_MMU_machine_mode, __LINE__);
     // RUN_TEST(test_MMU_mxr, __LINE__);
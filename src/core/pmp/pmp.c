@@ -32,6 +32,8 @@ rv_ret pmp_write_csr_cfg(void *priv, privilege_level curr_priv, uint16_t reg_ind
         }
     }
 
+    pmp_update_regions(pmp);
+
     return rv_ok;
 }
 
@@ -77,6 +79,8 @@ rv_ret pmp_write_csr_addr(void *priv, privilege_level curr_priv, uint16_t reg_in
 
     pmp->addr[reg_index] = csr_val;
 
+    pmp_update_regions(pmp);
+
     return rv_ok;
 }
 
@@ -102,106 +106,124 @@ static inline rv_uint_xlen get_pmp_napot_addr_from_pmpaddr(rv_uint_xlen addr)
     return (addr - mask) << 2;
 }
 
-rv_ret pmp_mem_check(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, uint8_t len, bus_access_type access_type)
+static void pmp_get_region(pmp_td *pmp, uint8_t addr_count, pmp_addr_matching addr_mode, rv_uint_xlen *start, rv_uint_xlen *size)
+{
+    switch(addr_mode)
+    {
+        case pmp_a_tor:
+            if(addr_count==0)
+            {
+                *start = 0;
+                *size = (pmp->addr[addr_count] << 2);
+            }
+            else
+            {
+                *start = (pmp->addr[addr_count-1] << 2);
+                *size = (pmp->addr[addr_count] << 2) - *start;
+            }
+        break;
+        case pmp_a_napot:
+            /* I couldn't find this case in the spec, but qemu seems to do it in a similar fashion
+             * https://github.com/qemu/qemu/blob/master/target/riscv/pmp.c
+             */
+            if(pmp->addr[addr_count] == (rv_uint_xlen)-1)
+            {
+                *size = -1;
+                *start = 0;
+            }
+            else
+            {
+                *size = get_pmp_napot_size_from_pmpaddr(pmp->addr[addr_count]);
+                *start = get_pmp_napot_addr_from_pmpaddr(pmp->addr[addr_count]);
+            }
+        break;
+        case pmp_a_na4:
+            *start = (pmp->addr[addr_count] << 2);
+            *size = 4;
+        break;
+        default:
+        break;
+    }
+}
+
+void pmp_update_regions(pmp_td *pmp)
 {
-    /* check if the address matches any enabled config */
-    /* lower cfgs have precedence over higher ones */
     uint8_t i = 0;
     uint8_t j = 0;
     uint8_t addr_count = 0;
     uint8_t *cfg_ptr = NULL;
     pmp_addr_matching addr_mode = pmp_a_off;
-    rv_uint_xlen addr_end = 0;
-    rv_uint_xlen pmp_addr_start = 0;
-    rv_uint_xlen pmp_addr_size = 0;
-    uint8_t curr_access_flags = (1 << access_type);
-    uint8_t allowed_access = 0;
-    uint8_t lower_addr_match = 0;
-    uint8_t upper_addr_match = 0;
+    pmp_region_td *region = NULL;
+
+    pmp->nr_regions = 0;
+    pmp->nr_locked_regions = 0;
 
+    /* lower cfgs have precedence over higher ones, so the order is kept */
     for(i=0;i<PMP_NR_CFG_REGS;i++)
     {
         cfg_ptr = (uint8_t *)&pmp->cfg[i];
         for(j=0;j<sizeof(pmp->cfg[0]);j++)
         {
-            lower_addr_match = 0;
-            upper_addr_match = 0;
-
-            /* We only have to check the locked regions in machine mode */
-            if( (curr_priv == machine_mode) && !CHECK_BIT(cfg_ptr[j], PMP_CFG_L_BIT) )
-                continue;
-
             addr_count = (i*sizeof(pmp->cfg[0])) + j;
-            PMP_DEBUG("pmpaddr: "PRINTF_FMT"\n", pmp->addr[addr_count]);
             addr_mode = extract8(cfg_ptr[j], PMP_CFG_A_BIT_OFFS, 2);
 
-            PMP_DEBUG("id: %d addr_mode: %x\n", j, addr_mode);
-
             if(!addr_mode)
                 continue;
 
-            allowed_access = cfg_ptr[j] & 0x7;
+            region = &pmp->regions[pmp->nr_regions++];
+            pmp_get_region(pmp, addr_count, addr_mode, &region->start, &region->size);
+            region->allowed_access = cfg_ptr[j] & 0x7;
+            region->locked = CHECK_BIT(cfg_ptr[j], PMP_CFG_L_BIT) ? 1 : 0;
 
-            switch(addr_mode)
-            {
-                case pmp_a_tor:
-                    if(addr_count==0)
-                    {
-                        pmp_addr_start = 0;
-                        pmp_addr_size = (pmp->addr[addr_count] << 2);
-                    }
-                    else
-                    {
-                        pmp_addr_start = (pmp->addr[addr_count-1] << 2);
-                        pmp_addr_size = (pmp->addr[addr_count] << 2) - pmp_addr_start;
-                    }
-                break;
-                case pmp_a_napot:
-                    /* I couldn't find this case in the spec, but qemu seems to do it in a similar fashion
-                     * https://github.com/qemu/qemu/blob/master/target/riscv/pmp.c
-                     */
-                    if(pmp->addr[addr_count] == (rv_uint_xlen)-1)
-                    {
-                        pmp_addr_size = -1;
-                        pmp_addr_start = 0;
-                    }
-                    else
-                    {
-                        pmp_addr_size = get_pmp_napot_size_from_pmpaddr(pmp->addr[addr_count]);
-                        pmp_addr_start = get_pmp_napot_addr_from_pmpaddr(pmp->addr[addr_count]);
-                    }
-                break;
-                case pmp_a_na4:
-                    pmp_addr_start = (pmp->addr[addr_count] << 2);
-                    pmp_addr_size = 4;
-                break;
-                default:
-                break;
-            }
+            if(region->locked)
+                pmp->nr_locked_regions++;
 
-            addr_end = addr + (len - 1);
+            PMP_DEBUG("region %d: start: "PRINTF_FMT" size: "PRINTF_FMT" access: %x locked: %d\n", addr_count, region->start, region->size, region->allowed_access, region->locked);
+        }
+    }
+}
 
-            PMP_DEBUG("addr: " PRINTF_FMT "\n", addr);
-            PMP_DEBUG("pmp_addr_start: " PRINTF_FMT "\n", pmp_addr_start);
-            PMP_DEBUG("addr_end: " PRINTF_FMT "\n", addr_end);
-            PMP_DEBUG("size: " PRINTF_FMT "\n", pmp_addr_size);
+rv_ret pmp_mem_check(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, uint8_t len, bus_access_type access_type)
+{
+    /* check if the address matches any enabled config */
+    uint8_t i = 0;
+    pmp_region_td *region = NULL;
+    rv_uint_xlen addr_end = addr + (len - 1);
+    uint8_t curr_access_flags = (1 << access_type);
+    uint8_t lower_addr_match = 0;
+    uint8_t upper_addr_match = 0;
 
-            /* Check if the access partially overlaps with configured mem regions */
-            lower_addr_match = ADDR_WITHIN(addr, pmp_addr_start, pmp_addr_size);
-            upper_addr_match = ADDR_WITHIN(addr_end, pmp_addr_start, pmp_addr_size);
+    /* We only have to check the locked regions in machine mode */
+    if( (curr_priv == machine_mode) && !pmp->nr_locked_regions )
+        return rv_ok;
 
-            /* lower addr is within, but upper not, so access not granted, except when we are in machine mode and RWX flags match */
-            if(lower_addr_match && !upper_addr_match)
-                return ( (curr_priv == machine_mode) && (curr_access_flags & allowed_access)) ? rv_ok : rv_err;
-            
-            /* upper addr is within, but lower not, so access not granted, except when we are in machine mode and RWX flags match */
-            if(upper_addr_match && !lower_addr_match)
-                return ( (curr_priv == machine_mode) && (curr_access_flags & allowed_access)) ? rv_ok : rv_err;
+    for(i=0;i<pmp->nr_regions;i++)
+    {
+        region = &pmp->regions[i];
 
-            /* Both are within the range, return with OK */
-            if(upper_addr_match && lower_addr_match)
-                return (curr_access_flags & allowed_access) ? rv_ok : rv_err;
-        }
+        if( (curr_priv == machine_mode) && !region->locked )
+            continue;
+
+        PMP_DEBUG("addr: " PRINTF_FMT "\n", addr);
+        PMP_DEBUG("pmp_addr_start: " PRINTF_FMT "\n", region->start);
+        PMP_DEBUG("addr_end: " PRINTF_FMT "\n", addr_end);
+        PMP_DEBUG("size: " PRINTF_FMT "\n", region->size);
+
+        /* Check if the access partially overlaps with configured mem regions */
+        lower_addr_match = ADDR_WITHIN(addr, region->start, region->size);
+        upper_addr_match = ADDR_WITHIN(addr_end, region->start, region->size);
+
+        /* lower addr is within, but upper not, so access not granted, except when we are in machine mode and RWX flags match */
+        if(lower_addr_match && !upper_addr_match)
+            return ( (curr_priv == machine_mode) && (curr_access_flags & region->allowed_access)) ? rv_ok : rv_err;
+
+        /* upper addr is within, but lower not, so access not granted, except when we are in machine mode and RWX flags match */
+        if(upper_addr_match && !lower_addr_match)
+            return ( (curr_priv == machine_mode) && (curr_access_flags & region->allowed_access)) ? rv_ok : rv_err;
+
+        /* Both are within the range, return with OK */
+        if(upper_addr_match && lower_addr_match)
+            return (curr_access_flags & region->allowed_access) ? rv_ok : rv_err;
     }
 
     /* If we get here in machine mode, access is granted */
@@ -212,6 +234,52 @@ rv_ret pmp_mem_check(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr,
     return rv_err;
 }
 
+/* Returns rv_ok only if the access is granted for every address of the range, which means the
+ * first entry touching the range has to cover it completely. A partial overlap is reported as an
+ * error even if both sides would grant the access, callers use this to decide if a whole page can
+ * be accessed without further checks.
+ */
+rv_ret pmp_mem_check_range(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, rv_uint_xlen len, bus_access_type access_type)
+{
+    uint8_t i = 0;
+    pmp_region_td *region = NULL;
+    rv_uint_xlen addr_last = addr + (len - 1);
+    rv_uint_xlen region_end = 0;
+    uint8_t curr_access_flags = (1 << access_type);
+
+    if( (curr_priv == machine_mode) && !pmp->nr_locked_regions )
+        return rv_ok;
+
+    for(i=0;i<pmp->nr_regions;i++)
+    {
+        region = &pmp->regions[i];
+
+        if( (curr_priv == machine_mode) && !region->locked )
+            continue;
+
+        region_end = region->start + region->size;
+
+        /* empty region, it does not match any address in pmp_mem_check() either */
+        if(region_end <= region->start)
+            continue;
+
+        /* no overlap at all */
+        if( (addr >= region_end) || (addr_last < region->start) )
+            continue;
+
+        /* only partially covered */
+        if( (addr < region->start) || (addr_last >= region_end) )
+            return rv_err;
+
+        return (curr_access_flags & region->allowed_access) ? rv_ok : rv_err;
+    }
+
+    if(curr_priv == machine_mode)
+        return rv_ok;
+
+    return rv_err;
+}
+
 void pmp_dump_cfg_regs(pmp_td *pmp)
 {
     uint8_t i = 0;
@@ -246,4 +314,14 @@ int pmp_mem_check(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, uin
     (void)access_type;
     return RV_ACCESS_OK;
 }
+
+rv_ret pmp_mem_check_range(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, rv_uint_xlen len, bus_access_type access_type)
+{
+    (void)pmp;
+    (void)curr_priv;
+    (void)addr;
+    (void)len;
+    (void)access_type;
+    return rv_ok;
+}
 #endif
@@ -34,6 +34,16 @@ typedef enum
 
 } pmp_addr_matching;
 
+/* Decoded pmpcfg/pmpaddr pair */
+typedef struct pmp_region_struct
+{
+    rv_uint_xlen start;
+    rv_uint_xlen size;
+    uint8_t allowed_access;
+    uint8_t locked;
+
+} pmp_region_td;
+
 typedef struct pmp_struct
 {
     union {
@@ -44,13 +54,20 @@ typedef struct pmp_struct
         rv_uint_xlen regs[PMP_NR_CFG_REGS+PMP_NR_ADDR_REGS];
     };
 
+    /* All enabled entries in priority order, rebuilt whenever a cfg or addr register is written */
+    pmp_region_td regions[PMP_NR_ADDR_REGS];
+    uint8_t nr_regions;
+    uint8_t nr_locked_regions;
+
 } pmp_td;
 
 rv_ret pmp_write_csr_cfg(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val);
 rv_ret pmp_read_csr_cfg(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen *out_val);
 rv_ret pmp_write_csr_addr(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val);
 rv_ret pmp_read_csr_addr(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen *out_val);
+void pmp_update_regions(pmp_td *pmp);
 rv_ret pmp_mem_check(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, uint8_t len, bus_access_type access_type);
+rv_ret pmp_mem_check_range(pmp_td *pmp, privilege_level curr_priv, rv_uint_xlen addr, rv_uint_xlen len, bus_access_type access_type);
 void pmp_dump_cfg_regs(pmp_td *pmp);
 
 #endif /* RISCV_PMP_H */
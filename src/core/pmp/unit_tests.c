@@ -8,54 +8,63 @@
 
 
 /* these are internal functions, actually only used for testing
-   the emulator will set those flags anyway using pmp_write_csr()
+   the emulator will set those flags anyway using pmp_write_csr(),
+   so they have to rebuild the region table on their own
  */
 static void pmp_set_cfg_l_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     SET_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_L_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_set_cfg_a_mode(pmp_td *pmp, unsigned int cfg_reg_index, pmp_addr_matching mode)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     cfg_ptr[cfg_reg_index] |= (mode << PMP_CFG_A_BIT_OFFS);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_set_cfg_x_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     SET_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_X_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_set_cfg_w_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     SET_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_W_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_set_cfg_r_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     SET_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_R_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_clear_cfg_x_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     CLEAR_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_X_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_clear_cfg_w_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     CLEAR_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_W_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_clear_cfg_r_flag(pmp_td *pmp, unsigned int cfg_reg_index)
 {
     uint8_t *cfg_ptr = (uint8_t *)&pmp->cfg[0];
     CLEAR_BIT(cfg_ptr[cfg_reg_index], PMP_CFG_R_BIT);
+    pmp_update_regions(pmp);
 }
 
 static void pmp_set_napot_addr(pmp_td *pmp, unsigned int cfg_reg_index, rv_uint_xlen base, rv_uint_xlen size)
@@ -63,6 +72,7 @@ static void pmp_set_napot_addr(pmp_td *pmp, unsigned int cfg_reg_index, rv_uint_
     rv_uint_xlen napot_size = ((size/2)-1);
     //napot_size = 0x7FFF
     pmp->addr[cfg_reg_index] = (base + napot_size) >> 2;
+    pmp_update_regions(pmp);
     //pmp_addr = 0x1000_01FF
 
     // printf("pmp addr: " PRINTF_FMT "\n", pmp->addr[cfg_reg_index]);
@@ -71,6 +81,7 @@ static void pmp_set_napot_addr(pmp_td *pmp, unsigned int cfg_reg_index, rv_uint_
 static void pmp_set_na4_tor_addr(pmp_td *pmp, unsigned int cfg_reg_index, rv_uint_xlen base)
 {
     pmp->addr[cfg_reg_index] = base >> 2;
+    pmp_update_regions(pmp);
 }
 
 
@@ -428,6 +439,39 @@ void test_PMP_napot_outofbounds_memcheck(void)
     TEST_ASSERT_EQUAL(rv_err, mem_check_result);
 }
 
+void test_PMP_napot_range_memcheck(void)
+{
+    /*
+     * A range is only granted if it is completely covered by the first matching region
+     */
+    pmp_set_cfg_a_mode(&tmp_pmp, 0, pmp_a_napot);
+    pmp_set_napot_addr(&tmp_pmp, 0, 0x40000000, 0x2000);
+    pmp_set_cfg_r_flag(&tmp_pmp, 0);
+
+    rv_ret mem_check_result = 0;
+
+    mem_check_result = pmp_mem_check_range(&tmp_pmp, supervisor_mode, 0x40000000, 0x1000, bus_read_access);
+    TEST_ASSERT_EQUAL(rv_ok, mem_check_result);
+
+    mem_check_result = pmp_mem_check_range(&tmp_pmp, supervisor_mode, 0x40001000, 0x1000, bus_read_access);
+    TEST_ASSERT_EQUAL(rv_ok, mem_check_result);
+
+    mem_check_result = pmp_mem_check_range(&tmp_pmp, supervisor_mode, 0x40000000, 0x1000, bus_write_access);
+    TEST_ASSERT_EQUAL(rv_err, mem_check_result);
+
+    /* only partially covered */
+    mem_check_result = pmp_mem_check_range(&tmp_pmp, supervisor_mode, 0x40001800, 0x1000, bus_read_access);
+    TEST_ASSERT_EQUAL(rv_err, mem_check_result);
+
+    /* not covered at all */
+    mem_check_result = pmp_mem_check_range(&tmp_pmp, supervisor_mode, 0x40002000, 0x1000, bus_read_access);
+    TEST_ASSERT_EQUAL(rv_err, mem_check_result);
+
+    /* machine mode is not affected by unlocked regions */
+    mem_check_result = pmp_mem_check_range(&tmp_pmp, machine_mode, 0x40000000, 0x1000, bus_write_access);
+    TEST_ASSERT_EQUAL(rv_ok, mem_check_result);
+}
+
 void test_PMP_napot_m_mode_locked_memcheck(void)
 {
     /*
@@ -606,6 +650,7 @@ int main()
     RUN_TEST(test_PMP_tor_memcheck_r_flag, __LINE__);
     RUN_TEST(test_PMP_tor_memcheck_rwx_flags, __LINE__);
     RUN_TEST(test_PMP_napot_outofbounds_memcheck, __LINE__);
+    RUN_TEST(test_PMP_napot_range_memcheck, __LINE__);
 
     #ifdef RV64
         RUN_TEST(test_PMP_read_write_csr_RV64, __LINE__);
@@ -5,6 +5,44 @@
 #define ATOMIC_SUPPORT
 #define MULTIPLY_SUPPORT
 #define PMP_SUPPORT
+#define DECODE_CACHE_SUPPORT
+
+/* Max. number of harts, if there is more than one each of them runs on its own host thread
+ * or they share a pool of worker threads, see rv_soc_set_workers()
+ */
+#define RV_MAX_HARTS 64
+
+/* Number of instructions a hart runs on a worker before the next hart in its run queue gets its turn */
+#define HART_TIME_SLICE (16 * RUN_QUANTUM)
+
+/* Max. number of instructions executed in one go before the run loop checks back, see rv_soc_run_quantum() */
+#define RUN_QUANTUM 1024
+
+/* Number of pre-decoded instructions kept by the decode cache, must be a power of two */
+#define DECODE_CACHE_NR_ENTRIES 0x10000UL
+
+/* Block engine (selected at runtime), all sizes must be a power of two except for the block length */
+#define BLOCK_CACHE_SUPPORT
+#define BLOCK_CACHE_NR_BLOCKS 0x1000UL
+#define BLOCK_CACHE_MAX_INSTR 32
+#define BLOCK_CACHE_JUMP_CACHE_SIZE 0x1000UL
+#define BLOCK_CACHE_NR_PAGES 0x10000UL
+#define BLOCK_CACHE_RAS_SIZE 16
+
+/* Translation of hot blocks to host code (selected at runtime), only available on x86-64 hosts */
+#if defined(__x86_64__) && defined(BLOCK_CACHE_SUPPORT)
+    #define JIT_SUPPORT
+#endif
+/* Number of block executions until a block gets translated */
+#define JIT_HOT_THRESHOLD 32
+#define JIT_CODE_BUFFER_SIZE 0x1000000UL
+#define JIT_QUEUE_SIZE 64
+
+/* Software TLB for loads, stores and instruction fetches which end up in plain memory, must be a power of two */
+#define TLB_SUPPORT
+#define TLB_NR_ENTRIES 256
+#define TLB_NR_SUPERPAGE_ENTRIES 16
+#define TLB_NR_WALK_ENTRIES 16
 
 #define MROM_BASE_ADDR 0x1000UL
 #define MROM_SIZE_BYTES 0xf000UL
@@ -17,12 +55,47 @@
 
 #define CLINT_BASE_ADDR 0x2000000UL
 #define CLINT_SIZE_BYTES 0x10000UL
+/* has to match the timebase-frequency of the device tree */
+#define CLINT_TIMEBASE_FREQ 10000000UL
+/* Number of ticks after which the timer deadline is checked again if mtime follows the host clock */
+#define CLINT_HOST_CLOCK_CHECK_TICKS 1024
+
+/* Max. number of pending device events */
+#define EVENT_QUEUE_SIZE 16
+
+/* Adaptive polling for host input before a hart in WFI goes to sleep, a max. of 0 disables it */
+#define HALT_POLL_NS_START 10000UL
+#define HALT_POLL_NS_MAX 200000UL
+
+/* Max. time guest output is held back on the host before it is written out. The debug build writes
+ * it out right away to keep it in order with the register dumps.
+ */
+#ifdef RISCV_EM_DEBUG
+    #define CONSOLE_FLUSH_LATENCY_NS 0
+#else
+    #define CONSOLE_FLUSH_LATENCY_NS 10000000UL
+#endif
+/* Input which does not fit into the uart fifo is offered again after this time */
+#define CONSOLE_INPUT_RETRY_US 100
+
+/* Max. host input held back while recording, and max. length of one chunk of the input log */
+#define INPUT_LOG_BUF_SIZE 256
+
+/* Memory in a snapshot is stored page by page, pages which only hold zeros are left out of the file.
+ * The memories and their place in the file are aligned such that they can be mapped on hosts with up to 64K pages.
+ */
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_MEM_ALIGN 0x10000
+/* Max. number of threads writing out the memory */
+#define SNAPSHOT_MAX_THREADS 8
 
 #define SIMPLE_UART_TX_REG_ADDR 0x3000000UL
 #define SIMPLE_UART_SIZE_BYTES 0x2
 
 #define PLIC_BASE_ADDR 0x0C000000UL
 #define PLIC_SIZE_BYTES 0x3FFF004UL
+/* Every hart has two contexts, see interrupts-extended of the plic in the device trees */
+#define PLIC_NR_CONTEXTS (2 * RV_MAX_HARTS)
 
 #define UART8250_TX_REG_ADDR 0x10000000UL
 
@@ -98,6 +98,11 @@
         #define FUNC7_INSTR_MRET 0x18
             #define FUNC5_INSTR_MRET 0x2
         #define FUNC7_INSTR_SFENCEVMA 0x9
+        /* Svinval */
+        #define FUNC7_INSTR_SINVALVMA 0xB
+        #define FUNC7_INSTR_SFENCE_W_INVAL_INVAL_IR 0xC
+            #define FUNC5_INSTR_SFENCE_W_INVAL 0x0
+            #define FUNC5_INSTR_SFENCE_INVAL_IR 0x1
     #define FUNC3_INSTR_CSRRW 0x1
     #define FUNC3_INSTR_CSRRS 0x2
     #define FUNC3_INSTR_CSRRC 0x3
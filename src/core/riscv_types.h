@@ -46,5 +46,7 @@ typedef enum
 } bus_access_type;
 
 typedef rv_ret (*bus_access_func)(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen addr, void *value, uint8_t len);
+/* Returns a host pointer to addr if the whole range is plain memory, NULL otherwise */
+typedef uint8_t *(*bus_host_ptr_func)(void *priv, rv_uint_xlen addr, rv_uint_xlen len);
 
 #endif /* RISCV_TYPES_H */
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <tlb.h>
+
+void tlb_init(tlb_td *tlb)
+{
+    tlb_flush(tlb);
+}
+
+void tlb_flush(tlb_td *tlb)
+{
+    /* a zero tag never matches, as valid tags always have TLB_TAG_VALID set */
+    memset(tlb->entries, 0, sizeof(tlb->entries));
+    memset(tlb->superpages, 0, sizeof(tlb->superpages));
+    memset(tlb->walks, 0, sizeof(tlb->walks));
+    tlb->split_superpages = 0;
+}
+
+void tlb_flush_access_type(tlb_td *tlb, bus_access_type access_type)
+{
+    int i = 0;
+
+    for(i=0;i<priv_level_max;i++)
+        memset(tlb->entries[i][access_type], 0, sizeof(tlb->entries[i][access_type]));
+}
+
+/* The SFENCE.VMA rules: global translations are kept when flushing by ASID, an address
+ * flush drops every translation containing that address.
+ */
+static inline int tlb_flush_match(rv_uint_xlen tag, uint16_t entry_asid, uint8_t global, unsigned int page_shift,
+                                  uint8_t by_addr, rv_uint_xlen virt_addr, uint8_t by_asid, uint16_t asid)
+{
+    if(!(tag & TLB_TAG_VALID))
+        return 0;
+
+    if(by_asid && (global || (entry_asid != asid)))
+        return 0;
+
+    if(by_addr && ((tag ^ virt_addr) >> page_shift))
+        return 0;
+
+    return 1;
+}
+
+void tlb_flush_vma(tlb_td *tlb, uint8_t by_addr, rv_uint_xlen virt_addr, uint8_t by_asid, uint16_t asid)
+{
+    int i = 0;
+    int j = 0;
+    unsigned int k = 0;
+    unsigned int first = 0;
+    unsigned int last = TLB_NR_ENTRIES - 1;
+    tlb_entry_td *entry = NULL;
+    tlb_superpage_td *superpage = NULL;
+
+    if(!by_addr && !by_asid)
+    {
+        tlb_flush(tlb);
+        return;
+    }
+
+    /* Changed pointer ptes need a flush without an address, so the page tables stay known otherwise */
+    if(!by_addr)
+        memset(tlb->walks, 0, sizeof(tlb->walks));
+
+    /* Parts of a superpage may sit in any slot, otherwise an address can only be in its own one */
+    if(by_addr && !(tlb->split_superpages & (by_asid ? TLB_SPLIT_PRIVATE : (TLB_SPLIT_PRIVATE | TLB_SPLIT_GLOBAL))))
+    {
+        first = (virt_addr >> TLB_PAGE_SHIFT) & (TLB_NR_ENTRIES-1);
+        last = first;
+    }
+
+    for(i=0;i<priv_level_max;i++)
+    {
+        for(j=0;j<bus_access_type_max;j++)
+        {
+            for(k=first;k<=last;k++)
+            {
+                entry = &tlb->entries[i][j][k];
+                if(tlb_flush_match(entry->tag, entry->asid, entry->global, entry->page_shift, by_addr, virt_addr, by_asid, asid))
+                    entry->tag = 0;
+            }
+        }
+    }
+
+    for(i=0;i<TLB_SUPERPAGE_LEVELS;i++)
+    {
+        for(k=0;k<TLB_NR_SUPERPAGE_ENTRIES;k++)
+        {
+            superpage = &tlb->superpages[i][k];
+            if(tlb_flush_match(superpage->tag, superpage->asid, superpage->global, superpage->page_shift, by_addr, virt_addr, by_asid, asid))
+                superpage->tag = 0;
+        }
+    }
+}
@@ -0,0 +1,217 @@
+#ifndef RISCV_TLB_H
+#define RISCV_TLB_H
+
+#include <stdint.h>
+#include <string.h>
+#include <riscv_types.h>
+
+#define TLB_PAGE_SHIFT 12
+#define TLB_PAGE_SIZE (1UL << TLB_PAGE_SHIFT)
+#define TLB_PAGE_MASK (TLB_PAGE_SIZE - 1)
+
+/* The low bits of a tag hold what else the translation depended on */
+#define TLB_TAG_VALID (1<<0)
+#define TLB_TAG_MXR   (1<<1)
+#define TLB_TAG_SUM   (1<<2)
+
+/* Sv48 has superpages on the levels 1 to 3 */
+#define TLB_SUPERPAGE_LEVELS 3
+
+/* Sv48 has page tables on the levels 0 to 3 */
+#define TLB_WALK_LEVELS 4
+
+/* Kinds of superpage translations which were spread over the 4K entries */
+#define TLB_SPLIT_PRIVATE (1<<0)
+#define TLB_SPLIT_GLOBAL  (1<<1)
+
+/* A translation of a virtual page which ends up in plain memory, where the
+ * access was allowed by the page tables and by the PMP for the whole page.
+ */
+typedef struct tlb_entry_struct
+{
+    rv_uint_xlen tag;
+    uint8_t *host_page;
+    uint64_t phys_page;
+
+    /* Global entries are valid in every address space. The page shift is the one of the
+     * translation the entry came from, SFENCE.VMA has to drop all parts of a superpage.
+     */
+    uint16_t asid;
+    uint8_t global;
+    uint8_t page_shift;
+
+} tlb_entry_td;
+
+/* Leaf pte of a superpage, the permissions are checked on every use so one entry serves all accesses */
+typedef struct tlb_superpage_struct
+{
+    rv_uint_xlen tag;
+    uint64_t pte;
+    uint16_t asid;
+    uint8_t global;
+    uint8_t page_shift;
+
+} tlb_superpage_td;
+
+/* A page table the walk went through, found by the root of the address space and the part of the
+ * virtual page number which selected it. If the table is plain memory it is read directly.
+ */
+typedef struct tlb_walk_struct
+{
+    rv_uint_xlen satp;
+    rv_uint_xlen tag;
+    uint64_t table;
+    uint8_t *host_table;
+    uint8_t global;
+
+} tlb_walk_td;
+
+typedef struct tlb_struct
+{
+    /* direct mapped by virtual page number, separate for every privilege level and access type */
+    tlb_entry_td entries[priv_level_max][bus_access_type_max][TLB_NR_ENTRIES];
+
+    /* Translations of superpages, direct mapped by their virtual number. They spare the
+     * page walk when a missing 4K entry of a huge mapping has to be filled.
+     */
+    tlb_superpage_td superpages[TLB_SUPERPAGE_LEVELS][TLB_NR_SUPERPAGE_ENTRIES];
+
+    /* Page tables by their level, a walk starts at the lowest one already known */
+    tlb_walk_td walks[TLB_WALK_LEVELS][TLB_NR_WALK_ENTRIES];
+
+    /* ASID of the current address space, taken from satp */
+    uint16_t asid;
+
+    /* TLB_SPLIT_* flags, if set an address flush has to search all entries */
+    uint8_t split_superpages;
+
+} tlb_td;
+
+void tlb_init(tlb_td *tlb);
+void tlb_flush(tlb_td *tlb);
+void tlb_flush_access_type(tlb_td *tlb, bus_access_type access_type);
+void tlb_flush_vma(tlb_td *tlb, uint8_t by_addr, rv_uint_xlen virt_addr, uint8_t by_asid, uint16_t asid);
+
+static inline rv_uint_xlen tlb_make_tag(rv_uint_xlen virt_addr, uint8_t mxr, uint8_t sum)
+{
+    return (virt_addr & ~(rv_uint_xlen)TLB_PAGE_MASK) | (mxr ? TLB_TAG_MXR : 0) | (sum ? TLB_TAG_SUM : 0) | TLB_TAG_VALID;
+}
+
+static inline tlb_entry_td *tlb_get_entry(tlb_td *tlb, privilege_level priv, bus_access_type access_type, rv_uint_xlen virt_addr)
+{
+    return &tlb->entries[priv][access_type][(virt_addr >> TLB_PAGE_SHIFT) & (TLB_NR_ENTRIES-1)];
+}
+
+static inline int tlb_match(tlb_td *tlb, tlb_entry_td *entry, rv_uint_xlen tag)
+{
+    return (entry->tag == tag) && ((entry->asid == tlb->asid) || entry->global);
+}
+
+/* Accesses crossing a page boundary always take the slow path */
+static inline int tlb_hit(tlb_td *tlb, tlb_entry_td *entry, rv_uint_xlen tag, rv_uint_xlen virt_addr, uint8_t len)
+{
+    return tlb_match(tlb, entry, tag) && (((virt_addr & TLB_PAGE_MASK) + len) <= TLB_PAGE_SIZE);
+}
+
+static inline void tlb_fill(tlb_td *tlb, tlb_entry_td *entry, rv_uint_xlen tag, uint8_t *host_page, uint64_t phys_page, uint8_t global, uint8_t page_shift)
+{
+    entry->tag = tag;
+    entry->host_page = host_page;
+    entry->phys_page = phys_page;
+    entry->asid = tlb->asid;
+    entry->global = global;
+    entry->page_shift = page_shift;
+
+    if(page_shift > TLB_PAGE_SHIFT)
+        tlb->split_superpages |= global ? TLB_SPLIT_GLOBAL : TLB_SPLIT_PRIVATE;
+}
+
+static inline unsigned int tlb_superpage_shift(int level, uint8_t vpn_bits)
+{
+    return TLB_PAGE_SHIFT + (level * vpn_bits);
+}
+
+/* Returns the level of the cached superpage containing virt_addr or -1 */
+static inline int tlb_superpage_lookup(tlb_td *tlb, int levels, uint8_t vpn_bits, rv_uint_xlen virt_addr, uint64_t *pte)
+{
+    int i = 0;
+    unsigned int shift = 0;
+    tlb_superpage_td *superpage = NULL;
+
+    for(i=1;i<levels;i++)
+    {
+        shift = tlb_superpage_shift(i, vpn_bits);
+        superpage = &tlb->superpages[i-1][(virt_addr >> shift) & (TLB_NR_SUPERPAGE_ENTRIES-1)];
+
+        if( (superpage->tag == (((virt_addr >> shift) << shift) | TLB_TAG_VALID)) &&
+            ((superpage->asid == tlb->asid) || superpage->global) )
+        {
+            *pte = superpage->pte;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static inline void tlb_superpage_fill(tlb_td *tlb, int level, uint8_t vpn_bits, rv_uint_xlen virt_addr, uint64_t pte, uint8_t global)
+{
+    unsigned int shift = tlb_superpage_shift(level, vpn_bits);
+    tlb_superpage_td *superpage = &tlb->superpages[level-1][(virt_addr >> shift) & (TLB_NR_SUPERPAGE_ENTRIES-1)];
+
+    superpage->tag = ((virt_addr >> shift) << shift) | TLB_TAG_VALID;
+    superpage->pte = pte;
+    superpage->asid = tlb->asid;
+    superpage->global = global;
+    superpage->page_shift = shift;
+}
+
+static inline tlb_walk_td *tlb_walk_get(tlb_td *tlb, int level, rv_uint_xlen prefix)
+{
+    return &tlb->walks[level][prefix & (TLB_NR_WALK_ENTRIES-1)];
+}
+
+static inline int tlb_walk_hit(tlb_walk_td *walk, rv_uint_xlen satp, rv_uint_xlen prefix)
+{
+    return (walk->tag == ((prefix << 1) | TLB_TAG_VALID)) && (walk->satp == satp);
+}
+
+static inline void tlb_walk_fill(tlb_walk_td *walk, rv_uint_xlen satp, rv_uint_xlen prefix, uint64_t table, uint8_t *host_table, uint8_t global)
+{
+    walk->satp = satp;
+    walk->tag = (prefix << 1) | TLB_TAG_VALID;
+    walk->table = table;
+    walk->host_table = host_table;
+    walk->global = global;
+}
+
+static inline void tlb_access(tlb_entry_td *entry, bus_access_type access_type, rv_uint_xlen virt_addr, void *value, uint8_t len)
+{
+    uint8_t *host_addr = entry->host_page + (virt_addr & TLB_PAGE_MASK);
+
+    /* fixed sizes let the compiler turn the copies into plain moves */
+    if(access_type == bus_write_access)
+    {
+        switch(len)
+        {
+            case 1: memcpy(host_addr, value, 1); break;
+            case 2: memcpy(host_addr, value, 2); break;
+            case 4: memcpy(host_addr, value, 4); break;
+            case 8: memcpy(host_addr, value, 8); break;
+            default: memcpy(host_addr, value, len); break;
+        }
+    }
+    else
+    {
+        switch(len)
+        {
+            case 1: memcpy(value, host_addr, 1); break;
+            case 2: memcpy(value, host_addr, 2); break;
+            case 4: memcpy(value, host_addr, 4); break;
+            case 8: memcpy(value, host_addr, 8); break;
+            default: memcpy(value, host_addr, len); break;
+        }
+    }
+}
+
+#endif /* RISCV_TLB_H */
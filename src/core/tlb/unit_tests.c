@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <tlb.h>
+#include <riscv_helper.h>
+
+#include <unity.h>
+
+/* shift of the 4K entries which were spread from a superpage one level up */
+#define TEST_SUPERPAGE_SHIFT (TLB_PAGE_SHIFT + 9)
+#define TEST_SUPERPAGE_ADDR 0x40000000
+
+static tlb_td tlb_test = {0};
+static uint8_t test_page[TLB_PAGE_SIZE] = {0};
+
+/* these bypass the page walk, the translations are made up just as the mmu would fill them */
+static void tlb_test_fill(privilege_level priv, bus_access_type access_type, rv_uint_xlen virt_addr, uint16_t asid, uint8_t global, uint8_t page_shift)
+{
+    tlb_entry_td *entry = tlb_get_entry(&tlb_test, priv, access_type, virt_addr);
+
+    tlb_test.asid = asid;
+    tlb_fill(&tlb_test, entry, tlb_make_tag(virt_addr, 0, 0), test_page, virt_addr & ~(rv_uint_xlen)TLB_PAGE_MASK, global, page_shift);
+}
+
+static int tlb_test_cached(privilege_level priv, bus_access_type access_type, rv_uint_xlen virt_addr, uint16_t asid)
+{
+    tlb_entry_td *entry = tlb_get_entry(&tlb_test, priv, access_type, virt_addr);
+
+    tlb_test.asid = asid;
+    return tlb_hit(&tlb_test, entry, tlb_make_tag(virt_addr, 0, 0), virt_addr, 4);
+}
+
+void setUp(void)
+{
+    memset(&tlb_test, 0, sizeof(tlb_td));
+    tlb_init(&tlb_test);
+}
+
+void tearDown(void)
+{
+}
+
+void test_TLB_hit(void)
+{
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x12000, 1, 0, TLB_PAGE_SHIFT);
+
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12ffc, 1));
+
+    /* other privilege levels, access types and address spaces have their own entries */
+    TEST_ASSERT_FALSE(tlb_test_cached(user_mode, bus_read_access, 0x12000, 1));
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_write_access, 0x12000, 1));
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12000, 2));
+
+    /* accesses crossing the end of the page take the slow path */
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12ffe, 1));
+
+    /* global entries are valid in every address space */
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x13000, 1, 1, TLB_PAGE_SHIFT);
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, 0x13000, 2));
+}
+
+/* SFENCE.VMA x0, x0 */
+void test_TLB_flush_vma_all(void)
+{
+    uint64_t pte = 0;
+
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x12000, 1, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(user_mode, bus_write_access, 0x13000, 2, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_instr_access, 0x14000, 1, 1, TLB_PAGE_SHIFT);
+    tlb_superpage_fill(&tlb_test, 1, 9, TEST_SUPERPAGE_ADDR, 0xcf, 1);
+
+    tlb_flush_vma(&tlb_test, 0, 0, 0, 0);
+
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12000, 1));
+    TEST_ASSERT_FALSE(tlb_test_cached(user_mode, bus_write_access, 0x13000, 2));
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_instr_access, 0x14000, 1));
+    TEST_ASSERT_EQUAL(-1, tlb_superpage_lookup(&tlb_test, 2, 9, TEST_SUPERPAGE_ADDR, &pte));
+}
+
+/* SFENCE.VMA x0, asid */
+void test_TLB_flush_vma_asid(void)
+{
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x12000, 1, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x13000, 2, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x14000, 1, 1, TLB_PAGE_SHIFT);
+
+    tlb_flush_vma(&tlb_test, 0, 0, 1, 1);
+
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12000, 1));
+
+    /* other address spaces and global translations are kept */
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, 0x13000, 2));
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, 0x14000, 1));
+}
+
+/* SFENCE.VMA addr, x0 */
+void test_TLB_flush_vma_addr(void)
+{
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x12000, 1, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_write_access, 0x12000, 2, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(user_mode, bus_instr_access, 0x12000, 1, 1, TLB_PAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x13000, 1, 0, TLB_PAGE_SHIFT);
+
+    tlb_flush_vma(&tlb_test, 1, 0x12abc, 0, 0);
+
+    /* every translation of the page is gone, no matter the address space */
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12000, 1));
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_write_access, 0x12000, 2));
+    TEST_ASSERT_FALSE(tlb_test_cached(user_mode, bus_instr_access, 0x12000, 1));
+
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, 0x13000, 1));
+}
+
+/* SFENCE.VMA addr, asid */
+void test_TLB_flush_vma_addr_asid(void)
+{
+    tlb_test_fill(supervisor_mode, bus_read_access, 0x12000, 1, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_write_access, 0x12000, 2, 0, TLB_PAGE_SHIFT);
+    tlb_test_fill(user_mode, bus_instr_access, 0x12000, 1, 1, TLB_PAGE_SHIFT);
+    tlb_test_fill(user_mode, bus_read_access, 0x13000, 1, 0, TLB_PAGE_SHIFT);
+
+    tlb_flush_vma(&tlb_test, 1, 0x12000, 1, 1);
+
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, 0x12000, 1));
+
+    /* only the page of that address space goes, global translations stay */
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_write_access, 0x12000, 2));
+    TEST_ASSERT_TRUE(tlb_test_cached(user_mode, bus_instr_access, 0x12000, 1));
+    TEST_ASSERT_TRUE(tlb_test_cached(user_mode, bus_read_access, 0x13000, 1));
+}
+
+/* The 4K entries of a superpage sit in other slots than the flushed address, they have to go as well */
+void test_TLB_flush_vma_superpage_split(void)
+{
+    uint64_t pte = 0;
+
+    tlb_test_fill(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + 0x1000, 1, 0, TEST_SUPERPAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_write_access, TEST_SUPERPAGE_ADDR + 0x5000, 1, 0, TEST_SUPERPAGE_SHIFT);
+    tlb_test_fill(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + (1 << TEST_SUPERPAGE_SHIFT), 1, 0, TLB_PAGE_SHIFT);
+    tlb_superpage_fill(&tlb_test, 1, 9, TEST_SUPERPAGE_ADDR, 0xcf, 0);
+    TEST_ASSERT_EQUAL_HEX8(TLB_SPLIT_PRIVATE, tlb_test.split_superpages);
+
+    tlb_test.asid = 1;
+    TEST_ASSERT_EQUAL(1, tlb_superpage_lookup(&tlb_test, 2, 9, TEST_SUPERPAGE_ADDR + 0x3000, &pte));
+    TEST_ASSERT_EQUAL_HEX64(0xcf, pte);
+
+    tlb_flush_vma(&tlb_test, 1, TEST_SUPERPAGE_ADDR + 0x3000, 1, 1);
+
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + 0x1000, 1));
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_write_access, TEST_SUPERPAGE_ADDR + 0x5000, 1));
+    TEST_ASSERT_EQUAL(-1, tlb_superpage_lookup(&tlb_test, 2, 9, TEST_SUPERPAGE_ADDR + 0x3000, &pte));
+
+    /* the page right behind the superpage is not part of it */
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + (1 << TEST_SUPERPAGE_SHIFT), 1));
+}
+
+/* Flushing one address space by address can't hit global superpages, which are kept anyway */
+void test_TLB_flush_vma_global_superpage_split(void)
+{
+    tlb_test_fill(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + 0x1000, 1, 1, TEST_SUPERPAGE_SHIFT);
+    TEST_ASSERT_EQUAL_HEX8(TLB_SPLIT_GLOBAL, tlb_test.split_superpages);
+
+    tlb_flush_vma(&tlb_test, 1, TEST_SUPERPAGE_ADDR + 0x3000, 1, 1);
+    TEST_ASSERT_TRUE(tlb_test_cached(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + 0x1000, 1));
+
+    tlb_flush_vma(&tlb_test, 1, TEST_SUPERPAGE_ADDR + 0x3000, 0, 0);
+    TEST_ASSERT_FALSE(tlb_test_cached(supervisor_mode, bus_read_access, TEST_SUPERPAGE_ADDR + 0x1000, 1));
+
+    /* a full flush forgets about the split superpages */
+    tlb_flush(&tlb_test);
+    TEST_ASSERT_EQUAL_HEX8(0, tlb_test.split_superpages);
+}
+
+/* Page tables are kept on address flushes, a changed pointer pte needs a flush without an address */
+void test_TLB_walk_cache(void)
+{
+    rv_uint_xlen satp = 0x80000010;
+    tlb_walk_td *walk = tlb_walk_get(&tlb_test, 0, 0x48);
+
+    tlb_walk_fill(walk, satp, 0x48, 0x11000, test_page, 0);
+    TEST_ASSERT_TRUE(tlb_walk_hit(walk, satp, 0x48));
+
+    /* the walk cache is keyed by satp, another address space or root table never hits */
+    TEST_ASSERT_FALSE(tlb_walk_hit(walk, satp + 1, 0x48));
+    TEST_ASSERT_FALSE(tlb_walk_hit(walk, satp, 0x58));
+
+    tlb_flush_vma(&tlb_test, 1, 0x12000000, 0, 0);
+    TEST_ASSERT_TRUE(tlb_walk_hit(walk, satp, 0x48));
+
+    tlb_flush_vma(&tlb_test, 1, 0x12000000, 1, 1);
+    TEST_ASSERT_TRUE(tlb_walk_hit(walk, satp, 0x48));
+
+    tlb_flush_vma(&tlb_test, 0, 0, 1, 1);
+    TEST_ASSERT_FALSE(tlb_walk_hit(walk, satp, 0x48));
+
+    tlb_walk_fill(walk, satp, 0x48, 0x11000, test_page, 1);
+    tlb_flush_vma(&tlb_test, 0, 0, 0, 0);
+    TEST_ASSERT_FALSE(tlb_walk_hit(walk, satp, 0x48));
+}
+
+int main() 
+{
+    UnityBegin("tlb/unit_tests.c");
+    RUN_TEST(test_TLB_hit, __LINE__);
+    RUN_TEST(test_TLB_flush_vma_all, __LINE__);
+    RUN_TEST(test_TLB_flush_vma_asid, __LINE__);
+    RUN_TEST(test_TLB_flush_vma_addr, __LINE__);
+    RUN_TEST(test_TLB_flush_vma_addr_asid, __LINE__);
+    RUN_TEST(test_TLB_flush_vma_superpage_split, __LINE__);
+    RUN_TEST(test_TLB_flush_vma_global_superpage_split, __LINE__);
+    RUN_TEST(test_TLB_walk_cache, __LINE__);
+
+    return (UnityEnd());
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include <trap.h>
 #include <riscv_helper.h>
@@ -78,6 +79,8 @@ void trap_init(trap_td *trap)
     trap->u.regs[trap_reg_cause] = &trap->regs_data.u_handling.cause;
     trap->u.regs[trap_reg_tval] = &trap->regs_data.u_handling.tval;
     trap->u.regs[trap_reg_ip] = &trap->regs_data.shared.ip;
+
+    trap->irq_dirty = 1;
 }
 
 rv_ret trap_m_write(void *priv, privilege_level curr_priv, uint16_t reg_index, rv_uint_xlen csr_val)
@@ -85,6 +88,7 @@ rv_ret trap_m_write(void *priv, privilege_level curr_priv, uint16_t reg_index, r
     (void)curr_priv;
     trap_td *trap = priv;
     *trap->m.regs[reg_index] = csr_val;
+    trap->irq_dirty = 1;
     // printf("val written %d "PRINTF_FMT"\n", reg_index, *trap->m.regs[reg_index]);
     return rv_ok;
 }
@@ -109,6 +113,7 @@ rv_ret trap_s_write(void *priv, privilege_level curr_priv, uint16_t reg_index, r
     (void)curr_priv;
     trap_td *trap = priv;
     *trap->s.regs[reg_index] = csr_val;
+    trap->irq_dirty = 1;
     // printf("val written %x\n", trap->regs[internal_reg]);
     return rv_ok;
 }
@@ -126,6 +131,7 @@ rv_ret trap_u_write(void *priv, privilege_level curr_priv, uint16_t reg_index, r
     (void)curr_priv;
     trap_td *trap = priv;
     *trap->u.regs[reg_index] = csr_val;
+    trap->irq_dirty = 1;
     // printf("val written %x\n", trap->regs[internal_reg]);
     return rv_ok;
 }
@@ -144,6 +150,7 @@ void trap_set_pending_bits(trap_td *trap, uint8_t ext_int, uint8_t tim_int, uint
        other bits are actually pure SW interrupts, set for e.g. by m-mode context
      */
     trap_regs_p_td *x = get_priv_regs(trap, machine_mode);
+    rv_uint_xlen prev_ip = *x->regs[trap_reg_ip];
 
     /* "Additionally, the platformlevel interrupt controller may generate supervisor-level external interrupts. The logical-OR of the
     software-writeable bit and the signal from the external interrupt controller is used to generate
@@ -166,6 +173,9 @@ void trap_set_pending_bits(trap_td *trap, uint8_t ext_int, uint8_t tim_int, uint
 
     if(CHECK_BIT(*x->regs[trap_reg_ie], trap_cause_machine_swi))
         assign_xlen_bit(x->regs[trap_reg_ip], trap_cause_machine_swi, sw_int);
+
+    if(*x->regs[trap_reg_ip] != prev_ip)
+        trap->irq_dirty = 1;
 }
 
 trap_ret trap_check_interrupt_pending(trap_td *trap, privilege_level curr_priv_mode, trap_cause_interrupt irq, privilege_level *serving_priv_level )
@@ -282,6 +292,8 @@ rv_uint_xlen trap_serve_interrupt(trap_td *trap,
     /* Also set tval */
     *x->regs[trap_reg_tval] = tval;
 
+    trap->irq_dirty = 1;
+
     return *x->regs[trap_reg_tvec];
 }
 
@@ -306,5 +318,30 @@ privilege_level trap_restore_irq_settings(trap_td *trap, privilege_level serving
     assign_xlen_bit(x->regs[trap_reg_status], serving_priv_mode, pie);
     CLEAR_BIT(*x->regs[trap_reg_status], (TRAP_XSTATUS_UPIE_BIT + serving_priv_mode));
 
+    trap->irq_dirty = 1;
+
     return previous_priv_level;
 }
+
+void trap_update_deliverable_irqs(trap_td *trap, privilege_level curr_priv_mode)
+{
+    /* only the standard interrupt causes are checked */
+    rv_uint_xlen pending = trap->regs_data.shared.ip & trap->regs_data.shared.ie & ((1 << (trap_cause_machine_exti + 1)) - 1);
+    privilege_level serving_priv_level = machine_mode;
+    trap_cause_interrupt irq = 0;
+
+    trap->deliverable_irqs = 0;
+
+    while(pending)
+    {
+        irq = ffs(pending) - 1;
+
+        if(trap_check_interrupt_pending(trap, curr_priv_mode, irq, &serving_priv_level) == trap_ret_irq_pending)
+            trap->deliverable_irqs |= (1 << irq);
+
+        pending &= (pending - 1);
+    }
+
+    trap->irq_priv_mode = curr_priv_mode;
+    trap->irq_dirty = 0;
+}
@@ -175,6 +175,13 @@ typedef struct trap_struct
     trap_regs_p_td s;
     trap_regs_p_td u;
 
+    /* Interrupts which would be taken in irq_priv_mode, one bit per cause.
+     * Only recomputed if irq_dirty got set, i.e. after a write to xstatus, xie, xip or xideleg.
+     */
+    rv_uint_xlen deliverable_irqs;
+    privilege_level irq_priv_mode;
+    uint8_t irq_dirty;
+
 } trap_td;
 
 void trap_init(trap_td *trap);
@@ -207,4 +214,14 @@ rv_uint_xlen trap_serve_interrupt(trap_td *trap,
 
 privilege_level trap_restore_irq_settings(trap_td *trap, privilege_level serving_priv_mode);
 
+void trap_update_deliverable_irqs(trap_td *trap, privilege_level curr_priv_mode);
+
+static inline rv_uint_xlen trap_get_deliverable_irqs(trap_td *trap, privilege_level curr_priv_mode)
+{
+    if(trap->irq_dirty || (trap->irq_priv_mode != curr_priv_mode))
+        trap_update_deliverable_irqs(trap, curr_priv_mode);
+
+    return trap->deliverable_irqs;
+}
+
 #endif /* RISCV_TRAP_H */
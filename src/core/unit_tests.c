@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <core.h>
+#include <riscv_helper.h>
+#include <riscv_instr.h>
+
+#include <unity.h>
+
+/* plain memory starts at the reset vector, the page after it is only reachable over the bus */
+#define TEST_RAM_ADDR MROM_BASE_ADDR
+#define TEST_RAM_SIZE_BYTES 0x2000
+#define TEST_DEV_ADDR (TEST_RAM_ADDR + TEST_RAM_SIZE_BYTES)
+#define TEST_DEV_SIZE_BYTES 0x1000
+#define TEST_DATA_ADDR (TEST_RAM_ADDR + 0x1000)
+
+#define TEST_AMO(_func5, _func3, _rd, _rs1, _rs2) \
+    (((_func5) << 27) | ((_rs2) << 20) | ((_rs1) << 15) | ((_func3) << 12) | ((_rd) << 7) | INSTR_AMO_W_D_LR_SC_SWAP_ADD_XOR_AND_OR_MIN_MAX_MINU_MAXU)
+#define TEST_AMO_W 2
+#define TEST_AMO_D 3
+
+static rv_core_td core;
+static uint8_t test_mem[TEST_RAM_SIZE_BYTES + TEST_DEV_SIZE_BYTES];
+static unsigned int test_nr_bus_writes = 0;
+
+static rv_ret core_test_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen addr, void *value, uint8_t len)
+{
+    (void) priv;
+    (void) priv_level;
+
+    if( (addr < TEST_RAM_ADDR) || ((addr + len) > (TEST_DEV_ADDR + TEST_DEV_SIZE_BYTES)) )
+        return rv_err;
+
+    if(access_type == bus_write_access)
+    {
+        memcpy(&test_mem[addr - TEST_RAM_ADDR], value, len);
+        test_nr_bus_writes++;
+    }
+    else
+    {
+        memcpy(value, &test_mem[addr - TEST_RAM_ADDR], len);
+    }
+
+    return rv_ok;
+}
+
+static uint8_t *core_test_bus_host_ptr(void *priv, rv_uint_xlen addr, rv_uint_xlen len)
+{
+    (void) priv;
+
+    if( (addr < TEST_RAM_ADDR) || ((addr + len) > TEST_DEV_ADDR) )
+        return NULL;
+
+    return &test_mem[addr - TEST_RAM_ADDR];
+}
+
+void setUp(void)
+{
+    memset(test_mem, 0, sizeof(test_mem));
+    test_nr_bus_writes = 0;
+
+    rv_core_init(&core, 0, NULL, core_test_bus_access, core_test_bus_host_ptr);
+}
+
+void tearDown(void)
+{
+}
+
+/* Runs the single instruction at the reset vector */
+static void core_test_exec(uint32_t instruction)
+{
+    memcpy(test_mem, &instruction, sizeof(instruction));
+    rv_core_run_n(&core, 1, 0);
+}
+
+static uint32_t core_test_read32(rv_uint_xlen addr)
+{
+    uint32_t val = 0;
+
+    memcpy(&val, &test_mem[addr - TEST_RAM_ADDR], sizeof(val));
+    return val;
+}
+
+static void core_test_write32(rv_uint_xlen addr, uint32_t val)
+{
+    memcpy(&test_mem[addr - TEST_RAM_ADDR], &val, sizeof(val));
+}
+
+void test_CORE_amo(void)
+{
+    core_test_write32(TEST_DATA_ADDR, 10);
+    core.x[1] = TEST_DATA_ADDR;
+    core.x[2] = 5;
+
+    core_test_exec(TEST_AMO(FUNC5_INSTR_AMO_ADD, TEST_AMO_W, 3, 1, 2));
+    TEST_ASSERT_EQUAL(0, core.sync_trap_pending);
+    TEST_ASSERT_EQUAL(10, core.x[3]);
+    TEST_ASSERT_EQUAL(15, core_test_read32(TEST_DATA_ADDR));
+}
+
+/* An AMO which is not naturally aligned raises a store/AMO address misaligned trap and leaves
+ * memory alone, instead of being split into a separate load and store another hart could get in between
+ */
+static void core_test_amo_misaligned(rv_uint_xlen addr, uint8_t func5, uint8_t func3)
+{
+    core_test_write32(addr & ~0x3UL, 0x11223344);
+    core_test_write32((addr & ~0x3UL) + 4, 0x55667788);
+    core.x[1] = addr;
+    core.x[2] = 0xffffffff;
+    core.x[3] = 0x42;
+
+    core_test_exec(TEST_AMO(func5, func3, 3, 1, 2));
+    TEST_ASSERT_EQUAL(1, core.sync_trap_pending);
+    TEST_ASSERT_EQUAL(trap_cause_store_amo_addr_fault, core.sync_trap_cause);
+    TEST_ASSERT_EQUAL_HEX(addr, core.sync_trap_tval);
+    TEST_ASSERT_EQUAL(0x42, core.x[3]);
+    TEST_ASSERT_EQUAL_HEX32(0x11223344, core_test_read32(addr & ~0x3UL));
+    TEST_ASSERT_EQUAL_HEX32(0x55667788, core_test_read32((addr & ~0x3UL) + 4));
+    TEST_ASSERT_EQUAL(0, test_nr_bus_writes);
+}
+
+void test_CORE_amo_misaligned(void)
+{
+    core_test_amo_misaligned(TEST_DATA_ADDR + 2, FUNC5_INSTR_AMO_ADD, TEST_AMO_W);
+    setUp();
+    core_test_amo_misaligned(TEST_DATA_ADDR + 1, FUNC5_INSTR_AMO_SWAP, TEST_AMO_W);
+    #ifdef RV64
+        setUp();
+        core_test_amo_misaligned(TEST_DATA_ADDR + 4, FUNC5_INSTR_AMO_ADD, TEST_AMO_D);
+    #endif
+}
+
+/* Same for memory which is only reachable over the bus */
+void test_CORE_amo_misaligned_bus(void)
+{
+    core_test_amo_misaligned(TEST_DEV_ADDR + 2, FUNC5_INSTR_AMO_OR, TEST_AMO_W);
+}
+
+void test_CORE_lr_sc_misaligned(void)
+{
+    core.x[1] = TEST_DATA_ADDR + 2;
+    core.x[3] = 0x42;
+
+    core_test_exec(TEST_AMO(FUNC5_INSTR_AMO_LR, TEST_AMO_W, 3, 1, 0));
+    TEST_ASSERT_EQUAL(1, core.sync_trap_pending);
+    TEST_ASSERT_EQUAL(trap_cause_load_addr_misalign, core.sync_trap_cause);
+    TEST_ASSERT_EQUAL_HEX(TEST_DATA_ADDR + 2, core.sync_trap_tval);
+    TEST_ASSERT_EQUAL(0, core.lr_valid);
+
+    /* an SC without reservation traps as well */
+    setUp();
+    core_test_amo_misaligned(TEST_DATA_ADDR + 2, FUNC5_INSTR_AMO_SC, TEST_AMO_W);
+}
+
+int main()
+{
+    UnityBegin("core/unit_tests.c");
+    RUN_TEST(test_CORE_amo, __LINE__);
+    RUN_TEST(test_CORE_amo_misaligned, __LINE__);
+    RUN_TEST(test_CORE_amo_misaligned_bus, __LINE__);
+    RUN_TEST(test_CORE_lr_sc_misaligned, __LINE__);
+
+    return (UnityEnd());
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <console.h>
+#include <host_clock.h>
+
+void console_init(console_td *console, int fd, uint64_t flush_latency_ns)
+{
+    memset(console, 0, sizeof(console_td));
+
+    console->fd = fd;
+    console->flush_latency_ns = flush_latency_ns;
+}
+
+void console_flush(console_td *console)
+{
+    unsigned int written = 0;
+    ssize_t ret = 0;
+
+    if(!console->len)
+        return;
+
+    /* keep the order with anything else printed through stdio */
+    fflush(stdout);
+
+    while(written < console->len)
+    {
+        ret = write(console->fd, &console->buf[written], console->len - written);
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            /* nobody to tell, the output is dropped */
+            break;
+        }
+
+        written += ret;
+    }
+
+    console->len = 0;
+}
+
+/* writes out the buffer once the oldest character waited long enough */
+void console_poll(console_td *console)
+{
+    if(!console->len)
+        return;
+
+    if( console->flush_latency_ns &&
+        ((host_clock_ns() - console->first_pending_ns) < console->flush_latency_ns) )
+        return;
+
+    console_flush(console);
+}
+
+void console_putc(console_td *console, uint8_t c)
+{
+    if(console->len == CONSOLE_BUF_SIZE)
+        console_flush(console);
+
+    if((console->len == 0) && console->flush_latency_ns)
+        console->first_pending_ns = host_clock_ns();
+
+    console->buf[console->len++] = c;
+}
+
+/* terminal settings from before console_set_raw_input(), restored on exit */
+static struct termios console_saved_termios;
+static int console_raw_fd = -1;
+
+static void console_restore_input(void)
+{
+    if(console_raw_fd >= 0)
+        tcsetattr(console_raw_fd, TCSANOW, &console_saved_termios);
+}
+
+static void console_restore_input_signal(int sig)
+{
+    console_restore_input();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* Switches a terminal to unbuffered input without echo, once for the whole run
+ * instead of around every single read. Anything else (pipes, files) is left as it is.
+ */
+void console_set_raw_input(int fd)
+{
+    struct termios raw;
+
+    if(!isatty(fd) || (tcgetattr(fd, &console_saved_termios) < 0))
+        return;
+
+    raw = console_saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    if(tcsetattr(fd, TCSANOW, &raw) < 0)
+    {
+        perror("tcsetattr");
+        return;
+    }
+
+    console_raw_fd = fd;
+    atexit(console_restore_input);
+    signal(SIGINT, console_restore_input_signal);
+    signal(SIGTERM, console_restore_input_signal);
+}
+
+/* Waits until input is available and reads as much of it as fits into buf.
+ * Returns the number of bytes read or -1 at the end of the input.
+ */
+long console_read_input(int fd, uint8_t *buf, unsigned int len)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    ssize_t ret = 0;
+
+    while(1)
+    {
+        if(poll(&pfd, 1, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        ret = read(fd, buf, len);
+        if(ret > 0)
+            return ret;
+
+        if((ret < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+            continue;
+
+        /* end of file, hangup or error */
+        return -1;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_BUF_SIZE 4096
+#define CONSOLE_INPUT_BUF_SIZE 4096
+
+/* Host side output buffer for the UARTs. Characters are collected and written out
+ * with a single write() once the buffer is full or the oldest one waited for longer
+ * than flush_latency_ns. A latency of 0 writes out everything on every console_poll().
+ */
+typedef struct console_struct
+{
+    int fd;
+    uint64_t flush_latency_ns;
+    /* host time at which the first buffered character came in */
+    uint64_t first_pending_ns;
+
+    unsigned int len;
+    uint8_t buf[CONSOLE_BUF_SIZE];
+
+} console_td;
+
+void console_init(console_td *console, int fd, uint64_t flush_latency_ns);
+void console_putc(console_td *console, uint8_t c);
+void console_flush(console_td *console);
+void console_poll(console_td *console);
+
+/* May be called without holding the lock which protects the console, a stale result only
+ * delays the output to the next poll.
+ */
+static inline int console_pending(console_td *console)
+{
+    return __atomic_load_n(&console->len, __ATOMIC_RELAXED) != 0;
+}
+
+/* Input side, used by the uart RX thread */
+void console_set_raw_input(int fd);
+long console_read_input(int fd, uint8_t *buf, unsigned int len);
+
+#endif /* CONSOLE_H */
@@ -2,12 +2,27 @@
 #include <string.h>
 #include "fifo.h"
 
+/*
+ * The writer only ever stores in, the reader only ever stores out. Each side
+ * publishes its index with release and reads the other one with acquire, so
+ * the data copied before an index update is visible once the index is.
+ */
+static inline unsigned int fifo_load_in(fifo_t *fifo)
+{
+        return __atomic_load_n(&fifo->in, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned int fifo_load_out(fifo_t *fifo)
+{
+        return __atomic_load_n(&fifo->out, __ATOMIC_ACQUIRE);
+}
+
 /*
  * internal helper to calculate the unused elements in a fifo
  */
 static inline unsigned int fifo_unused(fifo_t *fifo)
 {
-        return (fifo->mask + 1) - (fifo->in - fifo->out);
+        return (fifo->mask + 1) - (fifo->in - fifo_load_out(fifo));
 }
 
 /**
@@ -25,7 +40,8 @@ void fifo_init(fifo_t * fifo, uint8_t *data_arr, unsigned int data_arr_size)
 
 void fifo_reset(fifo_t * fifo) 
 {
-        fifo->in    = fifo->out   = 0;
+        /* done by the reader, so only out is touched */
+        __atomic_store_n(&fifo->out, fifo_load_in(fifo), __ATOMIC_RELEASE);
 }
 
 /**
@@ -45,7 +61,7 @@ unsigned int fifo_len(fifo_t * fifo)
 {
     // two usigned will not make this negative 
     // even if in or out overflow as long as in is ahead of out
-    return fifo->in - fifo->out;
+    return fifo_load_in(fifo) - fifo_load_out(fifo);
 }
 
 /**
@@ -54,7 +70,7 @@ unsigned int fifo_len(fifo_t * fifo)
  */
 int fifo_is_empty(fifo_t * fifo)
 {
-     return fifo->in == fifo->out;
+     return fifo_load_in(fifo) == fifo_load_out(fifo);
 }
 
 /**
@@ -81,7 +97,7 @@ int fifo_put(fifo_t * fifo, uint8_t val)
         ret = !fifo_is_full(fifo);
         if (ret) {
                 fifo->data[fifo->in & fifo->mask] = val;
-                fifo->in++;
+                __atomic_store_n(&fifo->in, fifo->in + 1, __ATOMIC_RELEASE);
         }
         return ret;
 }
@@ -92,7 +108,7 @@ int fifo_get(fifo_t * fifo, uint8_t * val)
         ret = !fifo_is_empty(fifo);   
         if (ret) { 
                 *val = fifo->data[fifo->out & fifo->mask];
-                fifo->out++;
+                __atomic_store_n(&fifo->out, fifo->out + 1, __ATOMIC_RELEASE);
         }
         return ret;
 }
@@ -117,7 +133,7 @@ unsigned int fifo_out_peek(fifo_t *fifo,
 {
         unsigned int l;
 
-        l = fifo->in - fifo->out;
+        l = fifo_load_in(fifo) - fifo->out;
         if (len > l)
                 len = l;
 
@@ -128,7 +144,7 @@ unsigned int fifo_out_peek(fifo_t *fifo,
 unsigned int fifo_out(fifo_t * fifo, uint8_t * buf, unsigned long n) 
 { 
         unsigned long len = fifo_out_peek(fifo, buf, n);
-        fifo->out += len;
+        __atomic_store_n(&fifo->out, fifo->out + len, __ATOMIC_RELEASE);
         return len;
 }
 
@@ -157,6 +173,6 @@ unsigned int fifo_in(fifo_t *fifo,
                 len = l;
 
         fifo_copy_in(fifo, buf, len, fifo->in);
-        fifo->in += len;
+        __atomic_store_n(&fifo->in, fifo->in + len, __ATOMIC_RELEASE);
         return len;
 }
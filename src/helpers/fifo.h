@@ -19,7 +19,7 @@ void fifo_init(fifo_t * fifo, uint8_t *data_arr, unsigned int data_arr_size);
 
 /**
  * fifo_resets - resets a fifo structure
- * 	requires a protected and exclusive access 
+ * 	drops all elements, must be called by the reader
  * @fifo: address of the fifo to be used
  */
 void fifo_reset(fifo_t * fifo);
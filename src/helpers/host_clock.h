@@ -0,0 +1,35 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define HOST_CLOCK_NS_PER_SEC 1000000000UL
+
+/* monotonic host time in ns */
+static inline uint64_t host_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * HOST_CLOCK_NS_PER_SEC) + ts.tv_nsec;
+}
+
+/* converts ticks of a clock running at freq Hz to ns, saturates at UINT64_MAX */
+static inline uint64_t host_clock_ticks_to_ns(uint64_t ticks, uint64_t freq)
+{
+    uint64_t secs = ticks / freq;
+
+    if(secs >= (UINT64_MAX / HOST_CLOCK_NS_PER_SEC))
+        return UINT64_MAX;
+
+    return (secs * HOST_CLOCK_NS_PER_SEC) + (((ticks % freq) * HOST_CLOCK_NS_PER_SEC) / freq);
+}
+
+static inline uint64_t host_clock_ns_to_ticks(uint64_t ns, uint64_t freq)
+{
+    return ((ns / HOST_CLOCK_NS_PER_SEC) * freq) + (((ns % HOST_CLOCK_NS_PER_SEC) * freq) / HOST_CLOCK_NS_PER_SEC);
+}
+
+#endif /* HOST_CLOCK_H */
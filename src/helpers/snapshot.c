@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <riscv_helper.h>
+#include <snapshot.h>
+
+#define SNAPSHOT_MAGIC "RVEMSNAP"
+#define SNAPSHOT_VERSION 1
+
+/* Writes the non-zero pages of one slice of a memory region */
+typedef struct snapshot_writer_struct
+{
+    pthread_t thread;
+    int fd;
+    uint8_t *mem;
+    /* file offset of the start of the region */
+    off_t offset;
+    uint64_t start;
+    uint64_t end;
+
+} snapshot_writer_td;
+
+static void snapshot_check(snapshot_td *snapshot, int ok)
+{
+    if(!ok)
+        die_msg("Could not %s snapshot %s!\n", snapshot->restore ? "read" : "write", snapshot->file_name);
+}
+
+void snapshot_open(snapshot_td *snapshot, char *file_name, uint8_t restore)
+{
+    char magic[sizeof(SNAPSHOT_MAGIC)-1] = SNAPSHOT_MAGIC;
+    uint32_t version = SNAPSHOT_VERSION;
+
+    memset(snapshot, 0, sizeof(snapshot_td));
+    snapshot->restore = restore;
+    snapshot->file_name = file_name;
+
+    if(restore)
+    {
+        snapshot->file = fopen(file_name, "rb");
+    }
+    else
+    {
+        /* the memory might still be mapped from the file it replaces */
+        snapshot->tmp_file_name = malloc(strlen(file_name) + sizeof(".tmp"));
+        if(snapshot->tmp_file_name == NULL)
+            die_msg("Could not allocate snapshot file name!\n");
+
+        sprintf(snapshot->tmp_file_name, "%s.tmp", file_name);
+        snapshot->file = fopen(snapshot->tmp_file_name, "wb");
+    }
+
+    if(snapshot->file == NULL)
+        die_msg("Could not open snapshot %s!\n", file_name);
+
+    if(restore)
+    {
+        snapshot_check(snapshot, fread(magic, sizeof(magic), 1, snapshot->file) == 1);
+        snapshot_check(snapshot, fread(&version, sizeof(version), 1, snapshot->file) == 1);
+
+        if( (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) || (version != SNAPSHOT_VERSION) )
+            die_msg("%s is not a snapshot of this emulator version!\n", file_name);
+    }
+    else
+    {
+        snapshot_check(snapshot, fwrite(magic, sizeof(magic), 1, snapshot->file) == 1);
+        snapshot_check(snapshot, fwrite(&version, sizeof(version), 1, snapshot->file) == 1);
+    }
+}
+
+void snapshot_close(snapshot_td *snapshot)
+{
+    off_t end = 0;
+
+    if(!snapshot->restore)
+    {
+        /* zero pages at the end of the last memory region did not extend the file */
+        end = ftello(snapshot->file);
+        snapshot_check(snapshot, (fflush(snapshot->file) == 0) && (ftruncate(fileno(snapshot->file), end) == 0));
+    }
+
+    snapshot_check(snapshot, fclose(snapshot->file) == 0);
+
+    if(!snapshot->restore)
+    {
+        if(rename(snapshot->tmp_file_name, snapshot->file_name) != 0)
+            die_msg("Could not replace snapshot %s!\n", snapshot->file_name);
+
+        free(snapshot->tmp_file_name);
+    }
+
+    snapshot->file = NULL;
+}
+
+/* Every field has its length in front, which catches snapshots taken by a different build */
+void snapshot_data(snapshot_td *snapshot, void *data, uint32_t len)
+{
+    uint32_t saved_len = len;
+
+    if(snapshot->restore)
+    {
+        snapshot_check(snapshot, fread(&saved_len, sizeof(saved_len), 1, snapshot->file) == 1);
+        if(saved_len != len)
+            die_msg("Snapshot %s does not match this build of the emulator!\n", snapshot->file_name);
+
+        snapshot_check(snapshot, fread(data, len, 1, snapshot->file) == 1);
+    }
+    else
+    {
+        snapshot_check(snapshot, fwrite(&saved_len, sizeof(saved_len), 1, snapshot->file) == 1);
+        snapshot_check(snapshot, fwrite(data, len, 1, snapshot->file) == 1);
+    }
+}
+
+static int snapshot_page_is_zero(uint8_t *page, uint64_t len)
+{
+    static const uint8_t zero_page[SNAPSHOT_PAGE_SIZE] = { 0 };
+
+    return memcmp(page, zero_page, len) == 0;
+}
+
+static void snapshot_pwrite(int fd, uint8_t *buf, uint64_t len, off_t offset)
+{
+    ssize_t written = 0;
+
+    while(len > 0)
+    {
+        written = pwrite(fd, buf, len, offset);
+        if(written <= 0)
+            die_msg("Could not write snapshot memory!\n");
+
+        buf += written;
+        len -= written;
+        offset += written;
+    }
+}
+
+static void *snapshot_writer_thread(void *p)
+{
+    snapshot_writer_td *writer = p;
+    uint64_t pos = writer->start;
+    uint64_t run_start = 0;
+
+    #define PAGE_LEN(_pos) ASSIGN_MIN(SNAPSHOT_PAGE_SIZE, writer->end - (_pos))
+
+    while(pos < writer->end)
+    {
+        while( (pos < writer->end) && snapshot_page_is_zero(&writer->mem[pos], PAGE_LEN(pos)) )
+            pos += PAGE_LEN(pos);
+
+        run_start = pos;
+        while( (pos < writer->end) && !snapshot_page_is_zero(&writer->mem[pos], PAGE_LEN(pos)) )
+            pos += PAGE_LEN(pos);
+
+        if(pos > run_start)
+            snapshot_pwrite(writer->fd, &writer->mem[run_start], pos - run_start, writer->offset + run_start);
+    }
+
+    #undef PAGE_LEN
+
+    return NULL;
+}
+
+/* Scanning for zero pages and writing out the rest is spread over several threads */
+static void snapshot_write_memory(snapshot_td *snapshot, uint8_t *mem, uint64_t size, off_t offset)
+{
+    snapshot_writer_td writers[SNAPSHOT_MAX_THREADS];
+    uint64_t nr_pages = (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+    uint64_t pages_per_writer = 0;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int nr_writers = (nr_cpus > 0) ? ASSIGN_MIN((unsigned long)nr_cpus, SNAPSHOT_MAX_THREADS) : 1;
+    unsigned int i = 0;
+
+    pages_per_writer = (nr_pages + nr_writers - 1) / nr_writers;
+
+    for(i=0;i<nr_writers;i++)
+    {
+        writers[i].fd = fileno(snapshot->file);
+        writers[i].mem = mem;
+        writers[i].offset = offset;
+        writers[i].start = ASSIGN_MIN(i * pages_per_writer * SNAPSHOT_PAGE_SIZE, size);
+        writers[i].end = ASSIGN_MIN((i + 1) * pages_per_writer * SNAPSHOT_PAGE_SIZE, size);
+
+        if(pthread_create(&writers[i].thread, NULL, snapshot_writer_thread, &writers[i]) != 0)
+            die_msg("Could not start snapshot thread!\n");
+    }
+
+    for(i=0;i<nr_writers;i++)
+        pthread_join(writers[i].thread, NULL);
+}
+
+/* Maps the memory from the file if the host page size allows it, it is copied on write */
+static void snapshot_read_memory(snapshot_td *snapshot, uint8_t *mem, uint64_t size, off_t offset)
+{
+    int fd = fileno(snapshot->file);
+    long host_page_size = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    ssize_t result = 0;
+    uint64_t done = 0;
+
+    /* a mapping beyond the end of the file would fault on access */
+    snapshot_check(snapshot, (fstat(fd, &st) == 0) && ((uint64_t)st.st_size >= (offset + size)));
+
+    if( (host_page_size > 0) &&
+        (((uintptr_t)mem % host_page_size) == 0) &&
+        ((offset % host_page_size) == 0) &&
+        ((size % host_page_size) == 0) )
+    {
+        if(mmap(mem, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED)
+            die_msg("Could not map snapshot memory!\n");
+
+        return;
+    }
+
+    while(done < size)
+    {
+        result = pread(fd, &mem[done], size - done, offset + done);
+        snapshot_check(snapshot, result > 0);
+        done += result;
+    }
+}
+
+void snapshot_memory(snapshot_td *snapshot, uint8_t *mem, uint64_t size)
+{
+    uint64_t saved_size = size;
+    off_t offset = 0;
+
+    SNAPSHOT_FIELD(snapshot, saved_size);
+    if(saved_size != size)
+        die_msg("Snapshot %s does not match this build of the emulator!\n", snapshot->file_name);
+
+    offset = ftello(snapshot->file);
+    snapshot_check(snapshot, offset >= 0);
+    offset = (offset + SNAPSHOT_MEM_ALIGN - 1) / SNAPSHOT_MEM_ALIGN * SNAPSHOT_MEM_ALIGN;
+
+    if(snapshot->restore)
+    {
+        snapshot_read_memory(snapshot, mem, size, offset);
+    }
+    else
+    {
+        snapshot_check(snapshot, fflush(snapshot->file) == 0);
+        snapshot_write_memory(snapshot, mem, size, offset);
+    }
+
+    snapshot_check(snapshot, fseeko(snapshot->file, offset + size, SEEK_SET) == 0);
+}
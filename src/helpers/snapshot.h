@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* A snapshot file holds the state of the machine as a sequence of fields, each one with
+ * its length in front. Saving and restoring walk through the same sequence, the same
+ * functions do both depending on the restore flag. Memory is stored page aligned at the
+ * end of its field, pages which only hold zeros are left as holes in the file, and on
+ * restore the memory gets mapped from the file instead of being read.
+ */
+typedef struct snapshot_struct
+{
+    FILE *file;
+    uint8_t restore;
+
+    /* a snapshot is written to a temporary file first, which replaces file_name once it is complete */
+    char *file_name;
+    char *tmp_file_name;
+
+} snapshot_td;
+
+void snapshot_open(snapshot_td *snapshot, char *file_name, uint8_t restore);
+void snapshot_close(snapshot_td *snapshot);
+void snapshot_data(snapshot_td *snapshot, void *data, uint32_t len);
+void snapshot_memory(snapshot_td *snapshot, uint8_t *mem, uint64_t size);
+
+#define SNAPSHOT_FIELD(_snapshot, _field) snapshot_data(_snapshot, &(_field), sizeof(_field))
+
+#endif /* SNAPSHOT_H */
@@ -3,78 +3,98 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 
 /* for uart RX thread */
-#include <termios.h>
 #include <pthread.h>
 
 #include <riscv_helper.h>
 #include <riscv_example_soc.h>
-#include <simple_uart.h>
-
-char getch() 
-{
-    char buf = 0;
-    struct termios old = {0};
-
-    if (tcgetattr(0, &old) < 0)
-        perror("tcsetattr()");
-
-    old.c_lflag &= ~ICANON;
-    old.c_lflag &= ~ECHO;
-    old.c_cc[VMIN] = 1;
-    old.c_cc[VTIME] = 0;
-
-    if (tcsetattr(0, TCSANOW, &old) < 0)
-        perror("tcsetattr ICANON");
-
-    if (read(0, &buf, 1) < 0)
-        perror ("read()");
-
-    old.c_lflag |= ICANON;
-    old.c_lflag |= ECHO;
-
-    if (tcsetattr(0, TCSADRAIN, &old) < 0)
-        perror ("tcsetattr ~ICANON");
-
-    return (buf);
-}
+#include <console.h>
 
 void *uart_rx_thread(void* p)
 {
     // (void)p;
     rv_soc_td *rv_soc = p;
-    char x = 0;
+    uint8_t buf[CONSOLE_INPUT_BUF_SIZE];
+    unsigned int len = 0;
+    unsigned int done = 0;
+    unsigned int added = 0;
+    long ret = 0;
 
     printf("Uart RX Thread running...\n");
 
+    console_set_raw_input(STDIN_FILENO);
+
     while(1)
     {
-        // x = getchar();
-        x = getch();
-        // printf("Press: %c PC: "PRINTF_FMT" virt: "PRINTF_FMT" phys: "PRINTF_FMT"\n", x , rv_soc->rv_core0.pc, rv_soc->rv_core0.mmu.last_virt_pc, rv_soc->rv_core0.mmu.last_phys_pc);
-
-        #ifdef USE_SIMPLE_UART
-            simple_uart_add_rx_char(&rv_soc->uart, x);
-        #else
-            uart_add_rx_char(&rv_soc->uart8250, x);
-        #endif
+        /* only read more once everything was passed on to the uart */
+        if(done == len)
+        {
+            ret = console_read_input(STDIN_FILENO, buf, sizeof(buf));
+            if(ret < 0)
+                break;
+
+            len = ret;
+            done = 0;
+        }
+
+        added = rv_soc_add_input(rv_soc, &buf[done], len - done);
+        if(added)
+        {
+            done += added;
+            rv_soc_notify_input(rv_soc);
+        }
+
+        /* the fifo is full, give the guest some time to read it */
+        if(done < len)
+            usleep(CONSOLE_INPUT_RETRY_US);
     }
+
+    return NULL;
 }
 
 void start_uart_rx_thread(void *p)
 {
     pthread_t uart_rx_th_id;
+    rv_soc_enable_host_input(p);
     pthread_create(&uart_rx_th_id, NULL, uart_rx_thread, p);
 }
 
+/* SIGUSR1 ends the run, e.g. to take a snapshot once the guest has booted */
+static rv_soc_td *stop_soc = NULL;
+
+static void stop_signal_handler(int sig)
+{
+    (void)sig;
+
+    rv_soc_request_stop(stop_soc);
+}
+
+typedef enum
+{
+    engine_interp = 0,
+    engine_block,
+    engine_jit
+
+} engine_type;
+
 static void parse_options(int argc, 
                           char** argv, 
                           char **fw_file, 
                           char **dtb_file,
                           char **initrd_file,
                           rv_uint_xlen *success_pc, 
-                          uint64_t *num_cycles)
+                          uint64_t *num_cycles,
+                          engine_type *engine,
+                          uint8_t *host_clock,
+                          uint64_t *console_latency_ns,
+                          unsigned int *nr_harts,
+                          unsigned int *nr_workers,
+                          char **record_file,
+                          char **replay_file,
+                          char **save_file,
+                          char **load_file)
 {
     int c;
     char *arg_fw_file = NULL;
@@ -82,8 +102,13 @@ static void parse_options(int argc,
     char *arg_initrd_file = NULL;
     char *arg_success_pc = NULL;
     char *arg_num_cycles = NULL;
+    char *arg_engine = NULL;
+    char *arg_timer = NULL;
+    char *arg_console_latency = NULL;
+    char *arg_nr_harts = NULL;
+    char *arg_nr_workers = NULL;
 
-    while ((c = getopt(argc, argv, "s:f:d:i:n:")) != -1)
+    while ((c = getopt(argc, argv, "s:f:d:i:n:e:t:l:c:w:r:p:S:L:")) != -1)
     {
         switch (c)
         {
@@ -130,6 +155,96 @@ static void parse_options(int argc,
                 }
                 break;
             }
+            case 'e':
+            {
+                arg_engine = optarg;
+                if(strcmp(arg_engine, "block") == 0)
+                {
+                    *engine = engine_block;
+                }
+                else if(strcmp(arg_engine, "jit") == 0)
+                {
+                    *engine = engine_jit;
+                }
+                else if(strcmp(arg_engine, "interp") != 0)
+                {
+                    printf("Unknown engine %s! Use interp, block or jit\n", arg_engine);
+                    exit(1);
+                }
+                break;
+            }
+            case 't':
+            {
+                arg_timer = optarg;
+                if(strcmp(arg_timer, "host") == 0)
+                {
+                    *host_clock = 1;
+                }
+                else if(strcmp(arg_timer, "cycles") != 0)
+                {
+                    printf("Unknown timer source %s! Use cycles or host\n", arg_timer);
+                    exit(1);
+                }
+                break;
+            }
+            case 'l':
+            {
+                /* max. time in us the uart output is held back, 0 for interactive use */
+                arg_console_latency = optarg;
+                if (arg_console_latency)
+                {
+                    *console_latency_ns = strtoull(arg_console_latency, NULL, 10) * 1000;
+                }
+                break;
+            }
+            case 'c':
+            {
+                /* number of harts, each one gets its own host thread */
+                arg_nr_harts = optarg;
+                *nr_harts = strtoul(arg_nr_harts, NULL, 10);
+                if((*nr_harts < 1) || (*nr_harts > RV_MAX_HARTS))
+                {
+                    printf("Invalid number of harts %s! Use 1 to %d\n", arg_nr_harts, RV_MAX_HARTS);
+                    exit(1);
+                }
+                break;
+            }
+            case 'w':
+            {
+                /* harts share this many host threads instead of having one each */
+                arg_nr_workers = optarg;
+                *nr_workers = strtoul(arg_nr_workers, NULL, 10);
+                if((*nr_workers < 1) || (*nr_workers > RV_MAX_HARTS))
+                {
+                    printf("Invalid number of workers %s! Use 1 to %d\n", arg_nr_workers, RV_MAX_HARTS);
+                    exit(1);
+                }
+                break;
+            }
+            case 'r':
+            {
+                /* log the input together with the cycle it reached the guest at */
+                *record_file = optarg;
+                break;
+            }
+            case 'p':
+            {
+                /* play back a log written with -r instead of reading input */
+                *replay_file = optarg;
+                break;
+            }
+            case 'S':
+            {
+                /* save a snapshot of the machine once the run ended */
+                *save_file = optarg;
+                break;
+            }
+            case 'L':
+            {
+                /* start from a snapshot instead of the reset vector */
+                *load_file = optarg;
+                break;
+            }
             case '?':
             {
                 break;
@@ -140,7 +255,7 @@ static void parse_options(int argc,
         }
     }
 
-    if(arg_fw_file == NULL)
+    if((arg_fw_file == NULL) && (*load_file == NULL))
     {
         printf("Please specify firwmare file!\n");
         exit(1);
@@ -156,7 +271,16 @@ static void parse_options(int argc,
         printf("No initrd specified!\n");
     }
 
-    printf("FW file: %s\n", arg_fw_file);
+    if((*record_file != NULL) && (*replay_file != NULL))
+    {
+        printf("Input can either be recorded or replayed!\n");
+        exit(1);
+    }
+
+    if(*load_file != NULL)
+        printf("Snapshot: %s\n", *load_file);
+    else
+        printf("FW file: %s\n", arg_fw_file);
     printf("Success PC: " PRINTF_FMT "\n", *success_pc);
     printf("Num Cycles: %ld\n", *num_cycles);
 
@@ -173,19 +297,72 @@ int main(int argc, char *argv[])
     char *initrd_file = NULL;
     rv_uint_xlen success_pc = 0;
     uint64_t num_cycles = 0;
+    engine_type engine = engine_interp;
+    uint8_t host_clock = 0;
+    uint64_t console_latency_ns = CONSOLE_FLUSH_LATENCY_NS;
+    unsigned int nr_harts = 1;
+    unsigned int nr_workers = 0;
+    char *record_file = NULL;
+    char *replay_file = NULL;
+    char *save_file = NULL;
+    char *load_file = NULL;
+
+    parse_options(argc, argv, &fw_file, &dtb_file, &initrd_file, &success_pc, &num_cycles, &engine, &host_clock, &console_latency_ns,
+                  &nr_harts, &nr_workers, &record_file, &replay_file, &save_file, &load_file);
+
+    /* static, the uart RX thread keeps using it until the process is gone */
+    static rv_soc_td rv_soc;
+    rv_soc_init(&rv_soc, fw_file, dtb_file, initrd_file, nr_harts);
+    rv_soc_set_workers(&rv_soc, nr_workers);
+
+    #ifdef BLOCK_CACHE_SUPPORT
+        if(engine == engine_block)
+            rv_soc_enable_block_engine(&rv_soc);
+    #endif
 
-    parse_options(argc, argv, &fw_file, &dtb_file, &initrd_file, &success_pc, &num_cycles);
+    #ifdef JIT_SUPPORT
+        if(engine == engine_jit)
+            rv_soc_enable_jit(&rv_soc);
+    #else
+        if(engine == engine_jit)
+            printf("JIT not available on this host, falling back to the interpreter\n");
+    #endif
+
+    if(host_clock)
+        rv_soc_enable_host_clock(&rv_soc);
+
+    rv_soc_set_console_latency(&rv_soc, console_latency_ns);
 
-    rv_soc_td rv_soc;
-    rv_soc_init(&rv_soc, fw_file, dtb_file, initrd_file);
+    if(load_file != NULL)
+        rv_soc_load_snapshot(&rv_soc, load_file);
+
+    if(record_file != NULL)
+        rv_soc_record_input(&rv_soc, record_file);
+
+    if(replay_file != NULL)
+        rv_soc_replay_input(&rv_soc, replay_file);
 
     #ifndef RISCV_EM_DEBUG
-        start_uart_rx_thread(&rv_soc);
+        /* a replay gets all of its input from the log */
+        if(replay_file == NULL)
+            start_uart_rx_thread(&rv_soc);
     #endif
 
     // rv_soc_dump_mem(&rv_soc);
 
     printf("Now starting rvI core, loaded program file will now be started...\n\n\n");
 
+    if(save_file != NULL)
+    {
+        stop_soc = &rv_soc;
+        signal(SIGUSR1, stop_signal_handler);
+    }
+
     rv_soc_run(&rv_soc, success_pc, num_cycles);
+
+    if(save_file != NULL)
+    {
+        rv_soc_save_snapshot(&rv_soc, save_file);
+        printf("\nSnapshot saved to %s\n", save_file);
+    }
 }
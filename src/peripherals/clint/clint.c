@@ -2,81 +2,290 @@
 #include <string.h>
 
 #include <riscv_helper.h>
+#include <host_clock.h>
 
 #include <clint.h>
 
 #define CLINT_MSIP_OFFS       0x0000
 #define CLINT_MTIMECMP_OFFS   0x4000
 #define CLINT_MTIME_OFFS      0xBFF8
+#define CLINT_MSIP_SIZE_BYTES 4
 #define CLINT_REG_SIZE_BYTES  8
 
-static rv_int_xlen get_u8_arr_index_offs(rv_uint_xlen address)
+/* Returns the register the address belongs to, clint_reg_max if there is none */
+static clint_regs clint_find_reg(clint_td *clint, rv_uint_xlen address, unsigned int *hart, rv_uint_xlen *offs)
 {
-    if(address < (CLINT_MSIP_OFFS + CLINT_REG_SIZE_BYTES))
+    if(address < (CLINT_MSIP_OFFS + (clint->nr_harts * CLINT_MSIP_SIZE_BYTES)))
     {
-        return (0*CLINT_REG_SIZE_BYTES);
+        *hart = (address - CLINT_MSIP_OFFS) / CLINT_MSIP_SIZE_BYTES;
+        *offs = (address - CLINT_MSIP_OFFS) % CLINT_MSIP_SIZE_BYTES;
+        return clint_msip;
     }
-    else if(ADDR_WITHIN(address, CLINT_MTIMECMP_OFFS, CLINT_REG_SIZE_BYTES))
+    else if(ADDR_WITHIN(address, CLINT_MTIMECMP_OFFS, (clint->nr_harts * CLINT_REG_SIZE_BYTES)))
     {
-        return (1*CLINT_REG_SIZE_BYTES);
+        *hart = (address - CLINT_MTIMECMP_OFFS) / CLINT_REG_SIZE_BYTES;
+        *offs = (address - CLINT_MTIMECMP_OFFS) % CLINT_REG_SIZE_BYTES;
+        return clint_mtimecmp;
     }
     else if(ADDR_WITHIN(address, CLINT_MTIME_OFFS, CLINT_REG_SIZE_BYTES))
     {
-        // printf("NOOOOO!\n");
-        // while(1);
-        return (2*CLINT_REG_SIZE_BYTES);
+        *offs = address - CLINT_MTIME_OFFS;
+        return clint_mtime;
     }
 
-    return -1;
+    return clint_reg_max;
+}
+
+static void clint_update_deadline(clint_td *clint, unsigned int hart)
+{
+    uint64_t mtimecmp = clint->harts[hart].mtimecmp;
+    uint64_t deadline_ns = 0;
+    uint64_t ns = 0;
+
+    if(mtimecmp <= clint->mtime_base)
+    {
+        deadline_ns = clint->host_base_ns;
+    }
+    else
+    {
+        ns = host_clock_ticks_to_ns(mtimecmp - clint->mtime_base, CLINT_TIMEBASE_FREQ);
+        deadline_ns = (ns > (UINT64_MAX - clint->host_base_ns)) ? UINT64_MAX : (clint->host_base_ns + ns);
+    }
+
+    /* harts poll their own deadline without holding the device lock, see clint_poll_irqs() */
+    __atomic_store_n(&clint->harts[hart].deadline_ns, deadline_ns, __ATOMIC_RELAXED);
+}
+
+static uint64_t clint_read_reg(clint_td *clint, clint_regs reg, unsigned int hart)
+{
+    switch(reg)
+    {
+        case clint_msip:
+            return clint->harts[hart].msip;
+        case clint_mtimecmp:
+            return clint->harts[hart].mtimecmp;
+        default:
+            return clint_get_mtime(clint);
+    }
+}
+
+static void clint_write_reg(clint_td *clint, clint_regs reg, unsigned int hart, uint64_t val)
+{
+    unsigned int i = 0;
+
+    switch(reg)
+    {
+        case clint_msip:
+            /* only bit 0 is implemented */
+            __atomic_store_n(&clint->harts[hart].msip, val & 0x1, __ATOMIC_RELEASE);
+            clint->harts[hart].changed = 1;
+        break;
+        case clint_mtimecmp:
+            clint->harts[hart].mtimecmp = val;
+            clint->harts[hart].changed = 1;
+            if(clint->host_clock)
+            {
+                clint_update_deadline(clint, hart);
+                clint_check_deadline(clint);
+            }
+        break;
+        default:
+            clint->mtime = val;
+            if(clint->host_clock)
+            {
+                clint->mtime_base = val;
+                clint->host_base_ns = host_clock_ns();
+
+                for(i=0;i<clint->nr_harts;i++)
+                {
+                    clint_update_deadline(clint, i);
+                    clint->harts[i].changed = 1;
+                }
+                clint_check_deadline(clint);
+            }
+    }
+}
+
+void clint_init(clint_td *clint, unsigned int nr_harts)
+{
+    memset(clint, 0, sizeof(clint_td));
+    clint->nr_harts = nr_harts;
 }
 
 rv_ret clint_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len)
 {
     (void) priv_level;
     clint_td *clint = priv;
-    rv_uint_xlen tmp_addr = 0;
-    uint8_t *tmp_u8 = (uint8_t *)clint->regs;
-    rv_int_xlen arr_index_offs = -1;
+    unsigned int hart = 0;
+    rv_uint_xlen offs = 0;
+    clint_regs reg = clint_find_reg(clint, address, &hart, &offs);
+    uint8_t reg_size = (reg == clint_msip) ? CLINT_MSIP_SIZE_BYTES : CLINT_REG_SIZE_BYTES;
+    uint64_t reg_val = 0;
+
+    /* accesses must not go beyond the register, partial ones work on its current value */
+    if( (reg == clint_reg_max) || ((offs + len) > reg_size) )
+        return rv_ok;
+
+    reg_val = clint_read_reg(clint, reg, hart);
+
+    if(access_type == bus_write_access)
+    {
+        memcpy((uint8_t *)&reg_val + offs, value, len);
+        clint_write_reg(clint, reg, hart, reg_val);
+    }
+    else
+    {
+        memcpy(value, (uint8_t *)&reg_val + offs, len);
+    }
+
+    return rv_ok;
+}
+
+/* Lets ticks pass, in host clock mode they just count down to the next deadline check */
+void clint_update(clint_td *clint, uint64_t ticks)
+{
+    if(clint->host_clock)
+    {
+        if(ticks >= clint->ticks_until_check)
+            clint_check_deadline(clint);
+        else
+            clint->ticks_until_check -= ticks;
+    }
+    else
+    {
+        clint->mtime += ticks;
+    }
+}
+
+/* Interrupt lines of a hart as of the last update */
+void clint_get_irqs(clint_td *clint, unsigned int hart, uint8_t *msi, uint8_t *mti)
+{
+    if(clint->host_clock)
+        *mti = clint->harts[hart].mti;
+    else
+        *mti = (clint->mtime >= clint->harts[hart].mtimecmp);
+
+    *msi = __atomic_load_n(&clint->harts[hart].msip, __ATOMIC_ACQUIRE);
+}
+
+/* Interrupt lines of a hart straight from the host clock, this is what the harts use
+ * if they run on their own threads, as it does not need the device lock.
+ */
+void clint_poll_irqs(clint_td *clint, unsigned int hart, uint8_t *msi, uint8_t *mti)
+{
+    *mti = (host_clock_ns() >= __atomic_load_n(&clint->harts[hart].deadline_ns, __ATOMIC_RELAXED));
+    *msi = __atomic_load_n(&clint->harts[hart].msip, __ATOMIC_ACQUIRE);
+}
+
+/* Returns whether msip or mtimecmp of the hart got written since the last call */
+uint8_t clint_take_changed(clint_td *clint, unsigned int hart)
+{
+    uint8_t changed = clint->harts[hart].changed;
+
+    clint->harts[hart].changed = 0;
+
+    return changed;
+}
 
-    arr_index_offs = get_u8_arr_index_offs(address);
+/* From now on mtime follows the host clock at CLINT_TIMEBASE_FREQ, starting from its current value */
+void clint_enable_host_clock(clint_td *clint)
+{
+    unsigned int i = 0;
+
+    clint->host_clock = 1;
+    clint->mtime_base = clint->mtime;
+    clint->host_base_ns = host_clock_ns();
+
+    for(i=0;i<clint->nr_harts;i++)
+        clint_update_deadline(clint, i);
 
-    if(arr_index_offs >= 0)
+    clint_check_deadline(clint);
+}
+
+/* In host clock mode mtime continues from the value it had when the snapshot was taken */
+void clint_snapshot(clint_td *clint, snapshot_td *snapshot)
+{
+    uint64_t mtime = clint_get_mtime(clint);
+    unsigned int i = 0;
+
+    SNAPSHOT_FIELD(snapshot, mtime);
+    for(i=0;i<clint->nr_harts;i++)
     {
-        tmp_addr = (address & 0x7) + arr_index_offs;
-        if(access_type == bus_write_access)
+        SNAPSHOT_FIELD(snapshot, clint->harts[i].msip);
+        SNAPSHOT_FIELD(snapshot, clint->harts[i].mtimecmp);
+    }
+
+    if(!snapshot->restore)
+        return;
+
+    clint->mtime = mtime;
+    for(i=0;i<clint->nr_harts;i++)
+        clint->harts[i].changed = 1;
+
+    if(clint->host_clock)
+        clint_enable_host_clock(clint);
+}
+
+uint64_t clint_get_mtime(clint_td *clint)
+{
+    if(!clint->host_clock)
+        return clint->mtime;
+
+    return clint->mtime_base + host_clock_ns_to_ticks(host_clock_ns() - clint->host_base_ns, CLINT_TIMEBASE_FREQ);
+}
+
+void clint_check_deadline(clint_td *clint)
+{
+    uint64_t now = host_clock_ns();
+    unsigned int i = 0;
+
+    for(i=0;i<clint->nr_harts;i++)
+        clint->harts[i].mti = (now >= clint->harts[i].deadline_ns);
+
+    clint->ticks_until_check = CLINT_HOST_CLOCK_CHECK_TICKS;
+}
+
+/* Ticks until one of the timer interrupt lines changes on its own, UINT64_MAX if none will */
+uint64_t clint_ticks_until_update(clint_td *clint)
+{
+    uint64_t ticks = UINT64_MAX;
+    unsigned int i = 0;
+
+    for(i=0;i<clint->nr_harts;i++)
+    {
+        if(clint->host_clock)
         {
-            memcpy(&tmp_u8[tmp_addr], value, len);
-            // rv_uint_xlen tmp_xlen = 0;
-            // memcpy(&tmp_xlen, value, len);
-            // printf("addr: %x CMP %d cmp reg: %ld time reg: %ld len %d arr index offs %d tmp_addr: %d\n", address, tmp_u32, clint->regs[clint_mtimecmp], clint->regs[clint_mtime], len, arr_index_offs, tmp_addr);
-            // if(address == 0xBFF8)
-            //     printf("addr: "PRINTF_FMT" CMP %ld cmp reg: %lu time reg: %lu tmp_addr "PRINTF_FMT"\n", address, tmp_xlen, clint->regs[clint_mtimecmp], clint->regs[clint_mtime], tmp_addr);
+            if(!clint->harts[i].mti)
+                return clint->ticks_until_check;
         }
-        else
+        else if(clint->mtime < clint->harts[i].mtimecmp)
         {
-            memcpy(value, &tmp_u8[tmp_addr], len);
-            // if(address == 0xBFF8)
-            // {
-            //     printf("0xBFF8!!!!!!!!!!!!!!\n");
-            //     while(1);
-            // }
+            ticks = ASSIGN_MIN(ticks, clint->harts[i].mtimecmp - clint->mtime);
         }
     }
 
-    return rv_ok;
+    return ticks;
 }
 
-void clint_update(clint_td *clint, uint8_t *msi, uint8_t *mti)
+/* Host time left until the timer of the hart fires, UINT64_MAX if it never does */
+uint64_t clint_ns_until_deadline(clint_td *clint, unsigned int hart)
 {
-    static int i = 1;
-    if(i%1 == 0)
-        clint->regs[clint_mtime]+=1;
+    uint64_t deadline_ns = __atomic_load_n(&clint->harts[hart].deadline_ns, __ATOMIC_RELAXED);
+    uint64_t now = host_clock_ns();
 
-    i++;
+    if(deadline_ns == UINT64_MAX)
+        return UINT64_MAX;
 
-    *mti = (clint->regs[clint_mtime] >= clint->regs[clint_mtimecmp]);
-    *msi = (clint->regs[clint_msip] & 0x1);
+    return (deadline_ns > now) ? (deadline_ns - now) : 0;
+}
+
+/* read callback for the time CSRs, reg_index 1 is timeh on RV32 */
+rv_ret clint_read_time(void *priv, privilege_level curr_priv_mode, uint16_t reg_index, rv_uint_xlen *out_val)
+{
+    (void) curr_priv_mode;
+    uint64_t mtime = clint_get_mtime(priv);
 
-    // if(*mti)
-    //     printf("MTI!!! time: %ld cmp: %ld\n", clint->regs[clint_mtime], clint->regs[clint_mtimecmp]);
+    *out_val = reg_index ? (mtime >> 32) : mtime;
+
+    return rv_ok;
 }
@@ -2,6 +2,7 @@
 #define RISCV_CLINT_H
 
 #include <riscv_types.h>
+#include <snapshot.h>
 
 typedef enum 
 {
@@ -13,13 +14,52 @@ typedef enum
 
 } clint_regs;
 
+typedef struct clint_hart_struct
+{
+    uint32_t msip;
+    uint64_t mtimecmp;
+
+    /* host clock mode: host time at which the timer interrupt is due, and its state at the last check */
+    uint64_t deadline_ns;
+    uint8_t mti;
+
+    /* set when msip or mtimecmp got written, see clint_take_changed() */
+    uint8_t changed;
+
+} clint_hart_td;
+
 typedef struct clint_struct
 {
-    uint64_t regs[clint_reg_max];
+    /* msip at 0x0 + 4*hart, mtimecmp at 0x4000 + 8*hart */
+    clint_hart_td harts[RV_MAX_HARTS];
+    unsigned int nr_harts;
+
+    uint64_t mtime;
+
+    /* In host clock mode mtime is mtime_base plus the host time passed since host_base_ns,
+     * the timer interrupts are then host time deadlines which are only looked at every
+     * CLINT_HOST_CLOCK_CHECK_TICKS ticks, or right away if mtime or mtimecmp get written.
+     */
+    uint8_t host_clock;
+    uint64_t mtime_base;
+    uint64_t host_base_ns;
+    uint64_t ticks_until_check;
 
 } clint_td;
 
+void clint_init(clint_td *clint, unsigned int nr_harts);
 rv_ret clint_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len);
-void clint_update(clint_td *clint, uint8_t *msi, uint8_t *mti);
+void clint_update(clint_td *clint, uint64_t ticks);
+void clint_get_irqs(clint_td *clint, unsigned int hart, uint8_t *msi, uint8_t *mti);
+void clint_poll_irqs(clint_td *clint, unsigned int hart, uint8_t *msi, uint8_t *mti);
+uint8_t clint_take_changed(clint_td *clint, unsigned int hart);
+
+void clint_enable_host_clock(clint_td *clint);
+uint64_t clint_get_mtime(clint_td *clint);
+void clint_check_deadline(clint_td *clint);
+uint64_t clint_ticks_until_update(clint_td *clint);
+uint64_t clint_ns_until_deadline(clint_td *clint, unsigned int hart);
+void clint_snapshot(clint_td *clint, snapshot_td *snapshot);
+rv_ret clint_read_time(void *priv, privilege_level curr_priv_mode, uint16_t reg_index, rv_uint_xlen *out_val);
 
 #endif /* RISCV_CLINT_H */
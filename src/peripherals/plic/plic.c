@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 
 #include <riscv_helper.h>
 #include <plic.h>
@@ -22,6 +23,7 @@
 
 #define PLIC_IRQ_ENABLE_ADDR_OFFS 0x2000
 #define PLIC_IRQ_ENABLE_SIZE_BYTES 0x20
+#define PLIC_IRQ_ENABLE_CONTEXT_STRIDE 0x80
 
 #define PLIC_PRIO_THRESH_ADDR_OFFS 0x200000
 #define PLIC_PRIO_THRESH_SIZE_BYTES 0x4
@@ -29,10 +31,27 @@
 #define PLIC_PRIO_CLAIM_ADDR_OFFS 0x200004
 #define PLIC_PRIO_CLAIM_SIZE_BYTES 0x4
 
-static uint8_t *get_u8_reg_ptr(plic_td *plic, rv_uint_xlen address, uint8_t *is_claim_complete)
+#define PLIC_CONTEXT_STRIDE 0x1000
+
+static uint8_t *get_u8_reg_ptr(plic_td *plic, rv_uint_xlen address, plic_context_td **context, uint8_t *is_claim_complete)
 {
     uint8_t *ret_ptr = NULL;
     rv_uint_xlen tmp_address = 0;
+    unsigned int context_nr = 0;
+
+    /* per context registers, the context is found by the stride and handled as if it was the first one */
+    if(ADDR_WITHIN(address, PLIC_IRQ_ENABLE_ADDR_OFFS, plic->nr_contexts * PLIC_IRQ_ENABLE_CONTEXT_STRIDE))
+    {
+        context_nr = (address - PLIC_IRQ_ENABLE_ADDR_OFFS) / PLIC_IRQ_ENABLE_CONTEXT_STRIDE;
+        address -= context_nr * PLIC_IRQ_ENABLE_CONTEXT_STRIDE;
+    }
+    else if(ADDR_WITHIN(address, PLIC_PRIO_THRESH_ADDR_OFFS, plic->nr_contexts * PLIC_CONTEXT_STRIDE))
+    {
+        context_nr = (address - PLIC_PRIO_THRESH_ADDR_OFFS) / PLIC_CONTEXT_STRIDE;
+        address -= context_nr * PLIC_CONTEXT_STRIDE;
+    }
+
+    *context = &plic->contexts[context_nr];
 
     if(address < PLIC_PRIORITY_SIZE_BYTES)
     {
@@ -53,19 +72,19 @@ static uint8_t *get_u8_reg_ptr(plic_td *plic, rv_uint_xlen address, uint8_t *is_
     else if(ADDR_WITHIN(address, PLIC_IRQ_ENABLE_ADDR_OFFS, PLIC_IRQ_ENABLE_SIZE_BYTES))
     {
         tmp_address = address - PLIC_IRQ_ENABLE_ADDR_OFFS;
-        ret_ptr = (uint8_t *)plic->enable_bits;
+        ret_ptr = (uint8_t *)(*context)->enable_bits;
         return &ret_ptr[tmp_address];
     }
     else if(ADDR_WITHIN(address, PLIC_PRIO_THRESH_ADDR_OFFS, PLIC_PRIO_THRESH_SIZE_BYTES))
     {
         tmp_address = address - PLIC_PRIO_THRESH_ADDR_OFFS;
-        ret_ptr = (uint8_t *)&plic->priority_threshold;
+        ret_ptr = (uint8_t *)&(*context)->priority_threshold;
         return &ret_ptr[tmp_address];
     }
     else if(ADDR_WITHIN(address, PLIC_PRIO_CLAIM_ADDR_OFFS, PLIC_PRIO_CLAIM_SIZE_BYTES))
     {
         tmp_address = address - PLIC_PRIO_CLAIM_ADDR_OFFS;
-        ret_ptr = (uint8_t *)&plic->claim_complete;
+        ret_ptr = (uint8_t *)&(*context)->claim_complete;
         *is_claim_complete = 1;
         return &ret_ptr[tmp_address];
     }
@@ -73,6 +92,17 @@ static uint8_t *get_u8_reg_ptr(plic_td *plic, rv_uint_xlen address, uint8_t *is_
     return ret_ptr;
 }
 
+static void plic_update_prio_bits(plic_td *plic)
+{
+    uint32_t i = 0;
+
+    memset(plic->prio_bits, 0, sizeof(plic->prio_bits));
+
+    /* id 0 does not exist, so it is never part of any level */
+    for(i=1;i<NR_PRIO_MEM_REGS;i++)
+        plic->prio_bits[plic->priority[i]][i/32] |= (1U << (i%32));
+}
+
 static void plic_check_sanity(plic_td *plic)
 {
     uint32_t i = 0;
@@ -82,61 +112,110 @@ static void plic_check_sanity(plic_td *plic)
         plic->priority[i] = plic->priority[i] & 0x7;
     }
 
-    plic->priority_threshold = plic->priority_threshold & 0x7;
+    for(i=0;i<plic->nr_contexts;i++)
+        plic->contexts[i].priority_threshold = plic->contexts[i].priority_threshold & 0x7;
 }
 
-void plic_update_pending(plic_td *plic, uint32_t interrupt_id, uint8_t pending)
+/* qemu also seems to clear pending bit if it was already claimed */
+static void plic_clear_claimed(plic_td *plic, plic_context_td *context)
 {
-    uint32_t irq_reg = interrupt_id/32;
-    uint32_t irq_bit = interrupt_id%32;
-    assign_u32_bit(&plic->pending_bits[irq_reg], irq_bit, pending);
+    uint32_t above_threshold[NR_ENABLE_REGS] = {0};
+    uint32_t prio = 0;
+    uint32_t i = 0;
+
+    /* same levels as the arbitration, the threshold itself included */
+    for(prio=context->priority_threshold;prio<NR_PRIO_LEVELS;prio++)
+    {
+        for(i=0;i<NR_ENABLE_REGS;i++)
+            above_threshold[i] |= plic->prio_bits[prio][i];
+    }
+
+    for(i=0;i<NR_ENABLE_REGS;i++)
+        plic->pending_bits[i] &= ~(context->enable_bits[i] & above_threshold[i] & plic->claimed_bits[i]);
 }
 
-uint8_t plic_update(plic_td *plic)
+static void plic_arbitrate_context(plic_td *plic, plic_context_td *context)
 {
-    uint32_t i,j = 0;
-    uint32_t irq_id_count = 0;
-    uint32_t irq_to_trigger = 0;
-    uint8_t highest_prio = 0;
+    uint32_t candidates = 0;
+    int prio = 0;
+    uint32_t i = 0;
 
-    /* check for any enabled interrupt and threshold */
-    for(i=0;i<NR_ENABLE_REGS;i++)
-    {
-        if( (!plic->enable_bits[i]) || (!plic->pending_bits[i]) )
-            continue;
+    context->irq_to_trigger = 0;
 
-        for(j=0;j<sizeof(plic->enable_bits[0])*8;j++)
+    /* highest prio first, within one level the lowest id wins. Sources with a prio equal to
+     * the threshold are still delivered, only lower ones are masked out.
+     */
+    for(prio=NR_PRIO_LEVELS-1;prio>=(int)context->priority_threshold;prio--)
+    {
+        for(i=0;i<NR_ENABLE_REGS;i++)
         {
-            if( CHECK_BIT(plic->enable_bits[i], j) && 
-                CHECK_BIT(plic->pending_bits[i], j) && 
-                (plic->priority[irq_id_count] >= plic->priority_threshold) )
+            candidates = context->enable_bits[i] & plic->pending_bits[i] & plic->prio_bits[prio][i];
+            if(candidates)
             {
-                if(CHECK_BIT(plic->claimed_bits[i], j))
-                {
-                    /* qemu also seems to clear pending bit if it was already claimed */
-                    assign_u32_bit(&plic->pending_bits[i], j, 0);
-                }
-                else if((plic->priority[irq_id_count] >= highest_prio))
-                {
-                    /* find irq with highest prio */
-                    highest_prio = plic->priority[irq_id_count];
-                    irq_to_trigger = irq_id_count;
-                }
+                context->irq_to_trigger = i*32 + ffs(candidates) - 1;
+                return;
             }
-
-            irq_id_count++;
         }
     }
+}
+
+static void plic_arbitrate(plic_td *plic)
+{
+    unsigned int i = 0;
 
-    if(irq_to_trigger > 0)
+    if(!plic->dirty)
+        return;
+
+    for(i=0;i<plic->nr_contexts;i++)
+        plic_clear_claimed(plic, &plic->contexts[i]);
+
+    for(i=0;i<plic->nr_contexts;i++)
+        plic_arbitrate_context(plic, &plic->contexts[i]);
+
+    plic->dirty = 0;
+}
+
+void plic_init(plic_td *plic, unsigned int nr_contexts)
+{
+    memset(plic, 0, sizeof(plic_td));
+    plic->nr_contexts = nr_contexts;
+    plic_update_prio_bits(plic);
+}
+
+/* The plic holds no pointers, all of it goes into the snapshot */
+void plic_snapshot(plic_td *plic, snapshot_td *snapshot)
+{
+    SNAPSHOT_FIELD(snapshot, *plic);
+
+    if(snapshot->restore)
+        plic->dirty = 1;
+}
+
+void plic_update_pending(plic_td *plic, uint32_t interrupt_id, uint8_t pending)
+{
+    uint32_t irq_reg = interrupt_id/32;
+    uint32_t irq_bit = interrupt_id%32;
+
+    if((CHECK_BIT(plic->pending_bits[irq_reg], irq_bit) ? 1 : 0) != (pending ? 1 : 0))
     {
-        PLIC_DBG("plic !!IRQ!! trigger! %d\n", irq_to_trigger);
-        plic->claim_complete = irq_to_trigger;
-        return 1;
+        assign_u32_bit(&plic->pending_bits[irq_reg], irq_bit, pending);
+        plic->dirty = 1;
     }
-    else
+}
+
+/* Returns the interrupt line of the context */
+uint8_t plic_update(plic_td *plic, unsigned int context_nr)
+{
+    plic_context_td *context = &plic->contexts[context_nr];
+
+    plic_arbitrate(plic);
+
+    context->claim_complete = context->irq_to_trigger;
+
+    if(context->irq_to_trigger > 0)
     {
-        plic->claim_complete = 0;
+        PLIC_DBG("plic !!IRQ!! trigger! %d\n", context->irq_to_trigger);
+        return 1;
     }
 
     return 0;
@@ -146,10 +225,11 @@ rv_ret plic_bus_access(void *priv, privilege_level priv_level, bus_access_type a
 {
     (void) priv_level;
     plic_td *plic = priv;
+    plic_context_td *context = NULL;
     uint8_t is_claim_complete = 0;
     uint32_t irq_reg = 0;
     uint32_t irq_bit = 0;
-    uint8_t *u8_ptr = get_u8_reg_ptr(plic, address, &is_claim_complete);
+    uint8_t *u8_ptr = get_u8_reg_ptr(plic, address, &context, &is_claim_complete);
     uint32_t tmp_val = 0;
 
     if(u8_ptr)
@@ -169,9 +249,21 @@ rv_ret plic_bus_access(void *priv, privilege_level priv_level, bus_access_type a
             }
             /* be sure that all updated values are sane */
             plic_check_sanity(plic);
+
+            if(address < PLIC_PRIORITY_SIZE_BYTES)
+                plic_update_prio_bits(plic);
+
+            plic->dirty = 1;
         }
         else 
         {
+            /* another context might have claimed the interrupt since the last update */
+            if(is_claim_complete)
+            {
+                plic_arbitrate(plic);
+                context->claim_complete = context->irq_to_trigger;
+            }
+
             memcpy(value, u8_ptr, len);
             tmp_val = *(uint32_t*)u8_ptr;
             /* check if it is the claim complete reg */
@@ -181,7 +273,10 @@ rv_ret plic_bus_access(void *priv, privilege_level priv_level, bus_access_type a
                 irq_reg = tmp_val/32;
                 irq_bit = tmp_val%32;
                 if(CHECK_BIT(plic->pending_bits[irq_reg], irq_bit))
+                {
                     assign_u32_bit(&plic->claimed_bits[irq_reg], irq_bit, 1);
+                    plic->dirty = 1;
+                }
             }
         }
     }
@@ -5,9 +5,35 @@
 #define NR_PENDING_REGS 8
 #define NR_ENABLE_REGS 8
 #define NR_CLAIMED_BITS_REGS 8
+#define NR_PRIO_LEVELS 8
 
 #include <stdint.h>
 #include <riscv_types.h>
+#include <snapshot.h>
+
+/* Target of the interrupts, e.g. the machine or supervisor mode of one hart */
+typedef struct plic_context_struct
+{
+    /* 0x0C00 2000 + 0x80*context
+     * bits correspronding to the interrupt ids
+     */
+    uint32_t enable_bits[NR_ENABLE_REGS];
+
+    /* 0x0C20 0000 + 0x1000*context
+     * Interrupts with a lower prio setting than threshold will be masked out
+     * Bits Field Name Description
+     * [2:0] Threshold Sets the priority threshold for the E31 Coreplex.
+     * [31:3] Reserved WIRI
+    */
+    uint32_t priority_threshold;
+
+    /* 0x0C20 0004 + 0x1000*context */
+    uint32_t claim_complete;
+
+    /* result of the last arbitration */
+    uint32_t irq_to_trigger;
+
+} plic_context_td;
 
 typedef struct plic_struct
 {
@@ -29,27 +55,25 @@ typedef struct plic_struct
     /* bits correspronding to the interrupt ids */
     uint32_t pending_bits[NR_PENDING_REGS];
 
-    /* bits correspronding to the interrupt ids */
-    uint32_t enable_bits[NR_ENABLE_REGS];
-
-    /*
-     * Interrupts with a lower prio setting than threshold will be masked out
-     * Bits Field Name Description
-     * [2:0] Threshold Sets the priority threshold for the E31 Coreplex.
-     * [31:3] Reserved WIRI
-    */
-    uint32_t priority_threshold;
-
-    uint32_t claim_complete;
+    plic_context_td contexts[PLIC_NR_CONTEXTS];
+    unsigned int nr_contexts;
 
 
     /* internal */
     uint32_t claimed_bits[NR_CLAIMED_BITS_REGS];
 
+    /* one bitmap per priority level, holding the ids which have this priority */
+    uint32_t prio_bits[NR_PRIO_LEVELS][NR_ENABLE_REGS];
+
+    /* the arbitration is only redone if something changed */
+    uint8_t dirty;
+
 } plic_td;
 
+void plic_init(plic_td *plic, unsigned int nr_contexts);
+void plic_snapshot(plic_td *plic, snapshot_td *snapshot);
 void plic_update_pending(plic_td *plic, uint32_t interrupt_id, uint8_t pending);
-uint8_t plic_update(plic_td *plic);
+uint8_t plic_update(plic_td *plic, unsigned int context);
 rv_ret plic_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len);
 
 #endif /* RISCV_PLIC_H */
@@ -8,9 +8,23 @@
 
 plic_td plic = {0};
 
+static void plic_write(rv_uint_xlen address, uint32_t val)
+{
+    plic_bus_access(&plic, machine_mode, bus_write_access, address, &val, sizeof(val));
+}
+
+static uint32_t plic_read(rv_uint_xlen address)
+{
+    uint32_t val = 0;
+
+    plic_bus_access(&plic, machine_mode, bus_read_access, address, &val, sizeof(val));
+
+    return val;
+}
+
 void setUp(void)
 {
-    memset(&plic, 0, sizeof(plic_td));
+    plic_init(&plic, 2);
 }
 
 void tearDown(void)
@@ -19,108 +33,195 @@ void tearDown(void)
 
 void test_PLIC_read_write_reg(void)
 {
-    rv_uint_xlen tmp_val = 0;
-    rv_uint_xlen tmp_read_val = 0;
-    int err = 0;
-
-    // printf("%p %p\n", get_u8_reg_ptr(&plic, 0x1004), (void *)&plic.pending_bits[1]);
-
     /* There are only 7 prio levels, so ensure that when writing 0x42 there should be only 0x2 set */
-    tmp_val = 42;
-    plic_write_reg(&plic, 0x8, tmp_val, sizeof(uint32_t));
-    tmp_read_val = plic_read_reg(&plic, 0x8, sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL_HEX(0x2, tmp_read_val);
-    // printf("RESULT %x "PRINTF_FMT"\n", plic.priority[2], tmp_read_val);
+    plic_write(0x8, 42);
+    TEST_ASSERT_EQUAL_HEX(0x2, plic_read(0x8));
 
     /* Pending bit registers start at 0x1000 */
-    tmp_val = 43;
-    plic_write_reg(&plic, 0x1004, tmp_val, sizeof(uint32_t));
-    tmp_read_val = plic_read_reg(&plic, 0x1004, sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL(43, tmp_read_val);
-    // printf("RESULT %x "PRINTF_FMT"\n", plic.pending_bits[1], tmp_read_val);
+    plic_write(0x1004, 43);
+    TEST_ASSERT_EQUAL(43, plic_read(0x1004));
 
     /* Enable bits start at 0x2000 */
-    tmp_val = 44;
-    plic_write_reg(&plic, 0x2004, tmp_val, sizeof(uint32_t));
-    tmp_read_val = plic_read_reg(&plic, 0x2004, sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL(44, tmp_read_val);
-    // printf("RESULT %x "PRINTF_FMT"\n", plic.enable_bits[1], tmp_read_val);
+    plic_write(0x2004, 44);
+    TEST_ASSERT_EQUAL(44, plic_read(0x2004));
 
     /* Threshold register - max level 7 */
-    tmp_val = 45;
-    plic_write_reg(&plic, 0x200000, tmp_val, sizeof(uint32_t));
-    tmp_read_val = plic_read_reg(&plic, 0x200000, sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL(5, tmp_read_val);
-    // printf("RESULT %x "PRINTF_FMT"\n", plic.priority_threshold, tmp_read_val);
-
-    /* Claim registers */
-    tmp_val = 46;
-    plic_write_reg(&plic, 0x200004, tmp_val, sizeof(uint32_t));
-    tmp_read_val = plic_read_reg(&plic, 0x200004,  sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL(46, tmp_read_val);
-    // printf("RESULT %x "PRINTF_FMT"\n", plic.claim_complete, tmp_read_val);
+    plic_write(0x200000, 45);
+    TEST_ASSERT_EQUAL(5, plic_read(0x200000));
+
+    /* Claim register, nothing is above the threshold */
+    plic_write(0x200004, 46);
+    TEST_ASSERT_EQUAL(0, plic_read(0x200004));
 }
 
 void test_PLIC_test_interrupts(void)
 {
-    rv_uint_xlen tmp_val = 0;
-    rv_uint_xlen tmp_read_val = 0;
-    int err = 0;
-
-    plic.priority[10] = 7;
-    plic.enable_bits[0] = (1<<10);
-    plic.priority_threshold = 0;
-    TEST_ASSERT_EQUAL(0, plic_update(&plic));
-    // plic_update(&plic) ? printf("Interrupt!\n") : printf("No Interrupt.\n");
+    plic_write(4*10, 7);
+    plic_write(0x2000, (1<<10));
+    plic_write(0x200000, 0);
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
 
     /* now set pending */
-    plic.pending_bits[0] |= (1<<10);
-    TEST_ASSERT_EQUAL(1, plic_update(&plic));
-    // plic_update(&plic) ? printf("Interrupt!\n") : printf("No Interrupt.\n");
+    plic_update_pending(&plic, 10, 1);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
 
     /* test priorities */
-    plic.priority[12] = 5;
-    plic.enable_bits[0] |= (1<<12);
-    plic.pending_bits[0] |= (1<<12);
-    TEST_ASSERT_EQUAL_HEX(0x1400, plic.pending_bits[0]);
-    TEST_ASSERT_EQUAL_HEX(0x1400, plic.enable_bits[0]);
-    // printf("pending %x\n", plic.enable_bits[0]);
-
-    plic.priority[37] = 6;
-    plic.enable_bits[1] |= (1<<5);
-    plic.pending_bits[1] |= (1<<5);
-    TEST_ASSERT_EQUAL_HEX(0x20, plic.enable_bits[1]);
-    TEST_ASSERT_EQUAL(1, plic_update(&plic));
-    // printf("pending %x\n", plic.enable_bits[1]);
-    // plic_update(&plic) ? printf("Interrupt!\n") : printf("No Interrupt.\n");
+    plic_write(4*12, 5);
+    plic_write(0x2000, (1<<10) | (1<<12));
+    plic_update_pending(&plic, 12, 1);
+    TEST_ASSERT_EQUAL_HEX(0x1400, plic_read(0x1000));
+    TEST_ASSERT_EQUAL_HEX(0x1400, plic_read(0x2000));
+
+    plic_write(4*37, 6);
+    plic_write(0x2004, (1<<5));
+    plic_update_pending(&plic, 37, 1);
+    TEST_ASSERT_EQUAL_HEX(0x20, plic_read(0x2004));
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
 
     /* now claim the interrupt and check if gets triggered again */
-    TEST_ASSERT_EQUAL(1, plic_update(&plic));
-    tmp_read_val = plic_read_reg(&plic, 0x200004, sizeof(tmp_read_val), &err);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
     /* Highest prio should be claimed first */
-    TEST_ASSERT_EQUAL(10, tmp_read_val);
-    // plic_update(&plic) ? printf("Interrupt!\n") : printf("No Interrupt.\n");
+    TEST_ASSERT_EQUAL(10, plic_read(0x200004));
 
     /* Next should be 37 */
-    TEST_ASSERT_EQUAL(1, plic_update(&plic));
-    tmp_read_val = plic_read_reg(&plic, 0x200004,  sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL(37, tmp_read_val);
-    // plic_update(&plic) ? printf("Interrupt!\n") : printf("No Interrupt.\n");
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(37, plic_read(0x200004));
 
     /* Last should be 12 */
-    TEST_ASSERT_EQUAL(1, plic_update(&plic));
-    tmp_read_val = plic_read_reg(&plic, 0x200004,  sizeof(tmp_read_val), &err);
-    TEST_ASSERT_EQUAL(12, tmp_read_val);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(12, plic_read(0x200004));
 
     /* Now all interrupts should be claimed so no one pending anymore */
-    TEST_ASSERT_EQUAL(0, plic_update(&plic));
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(0, plic_read(0x200004));
 }
 
-int main() 
+void test_PLIC_arbitration(void)
+{
+    plic_write(4*40, 3);
+    plic_write(4*70, 3);
+    plic_write(4*100, 3);
+    plic_write(0x2004, (1<<8));
+    plic_write(0x2008, (1<<6));
+    plic_write(0x200c, (1<<4));
+    plic_update_pending(&plic, 40, 1);
+    plic_update_pending(&plic, 70, 1);
+    plic_update_pending(&plic, 100, 1);
+
+    /* within one level the lowest id wins */
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(40, plic.contexts[0].claim_complete);
+
+    /* changing the priority redoes the arbitration */
+    plic_write(4*100, 4);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(100, plic.contexts[0].claim_complete);
+
+    /* so does the threshold, only lower prios are masked out */
+    plic_write(0x200000, 5);
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+    plic_write(0x200000, 4);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(100, plic.contexts[0].claim_complete);
+
+    /* and a pending edge */
+    plic_update_pending(&plic, 100, 0);
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+    plic_write(0x200000, 0);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(40, plic.contexts[0].claim_complete);
+}
+
+/* A source with a prio equal to the threshold is delivered, claimed and hidden while it is claimed */
+void test_PLIC_threshold_equal(void)
+{
+    plic_write(4*10, 4);
+    plic_write(0x2000, (1<<10));
+    plic_write(0x200000, 4);
+    plic_update_pending(&plic, 10, 1);
+
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(10, plic_read(0x200004));
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(0, plic_read(0x1000));
+
+    plic_write(0x200004, 10);
+    plic_update_pending(&plic, 10, 1);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+
+    plic_write(0x200000, 5);
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+}
+
+/* After completion the source can trigger again */
+void test_PLIC_complete(void)
+{
+    plic_write(4*10, 1);
+    plic_write(0x2000, (1<<10));
+    plic_update_pending(&plic, 10, 1);
+
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(10, plic_read(0x200004));
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+
+    plic_write(0x200004, 10);
+    plic_update_pending(&plic, 10, 1);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(10, plic_read(0x200004));
+}
+
+/* Every context has its own enable bits, threshold and claim register */
+void test_PLIC_contexts(void)
+{
+    plic_write(4*10, 2);
+    plic_write(4*20, 3);
+    plic_write(0x2000, (1<<10));
+    plic_write(0x2080, (1<<10) | (1<<20));
+    plic_update_pending(&plic, 20, 1);
+
+    /* 20 is only enabled for context 1 */
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 1));
+    TEST_ASSERT_EQUAL_HEX(0x100400, plic_read(0x2080));
+    TEST_ASSERT_EQUAL_HEX(0x400, plic_read(0x2000));
+
+    plic_write(0x201000, 3);
+    plic_update_pending(&plic, 10, 1);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 1));
+    TEST_ASSERT_EQUAL(3, plic_read(0x201000));
+    TEST_ASSERT_EQUAL(0, plic_read(0x200000));
+
+    /* a claim by one context hides the interrupt from the other one */
+    TEST_ASSERT_EQUAL(10, plic_read(0x200004));
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 0));
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 1));
+    TEST_ASSERT_EQUAL(20, plic_read(0x201004));
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 1));
+
+    /* 10 is below the threshold of context 1 */
+    plic_update_pending(&plic, 20, 0);
+    plic_write(0x200004, 10);
+    plic_write(0x201004, 20);
+    plic_update_pending(&plic, 10, 1);
+    TEST_ASSERT_EQUAL(0, plic_update(&plic, 1));
+    plic_write(0x201000, 0);
+    TEST_ASSERT_EQUAL(1, plic_update(&plic, 1));
+
+    /* the claim register is read without an update in between */
+    TEST_ASSERT_EQUAL(10, plic_read(0x201004));
+    TEST_ASSERT_EQUAL(0, plic_read(0x200004));
+}
+
+int main()
 {
     UnityBegin("plic/unit_tests.c");
     RUN_TEST(test_PLIC_read_write_reg, __LINE__);
     RUN_TEST(test_PLIC_test_interrupts, __LINE__);
+    RUN_TEST(test_PLIC_arbitration, __LINE__);
+    RUN_TEST(test_PLIC_threshold_equal, __LINE__);
+    RUN_TEST(test_PLIC_complete, __LINE__);
+    RUN_TEST(test_PLIC_contexts, __LINE__);
 
     return (UnityEnd());
-}
\ No newline at end of file
+}
@@ -14,19 +14,50 @@
 #define SIMPLE_UART_TXEMPTY_BIT 2
 #define SIMPLE_UART_TXIEN_BIT 3
 
-void simple_uart_init(simple_uart_td *uart)
+void simple_uart_init(simple_uart_td *uart, console_td *console)
 {
     memset(uart, 0, sizeof(simple_uart_td));
 
-    if (pthread_mutex_init(&uart->lock, NULL) != 0)
-    {
-        die_msg("uart mutex init failed\n");
-    }
+    uart->console = console;
 
+    /* rx_fifo is only written by the RX thread and only read by the cpu thread, no locking needed */
     fifo_init(&uart->rx_fifo, uart->rx_fifo_data, SIMPLE_UART_FIFO_SIZE);
     fifo_init(&uart->tx_fifo, uart->tx_fifo_data, SIMPLE_UART_FIFO_SIZE);
 }
 
+/* Everything but the console, characters still in the fifos are kept */
+void simple_uart_snapshot(simple_uart_td *uart, snapshot_td *snapshot)
+{
+    SNAPSHOT_FIELD(snapshot, uart->rx_triggered);
+    SNAPSHOT_FIELD(snapshot, uart->rx_fifo.in);
+    SNAPSHOT_FIELD(snapshot, uart->rx_fifo.out);
+    SNAPSHOT_FIELD(snapshot, uart->rx_fifo_data);
+    SNAPSHOT_FIELD(snapshot, uart->rx_irq_enabled);
+
+    SNAPSHOT_FIELD(snapshot, uart->tx_triggered);
+    SNAPSHOT_FIELD(snapshot, uart->tx_fifo.in);
+    SNAPSHOT_FIELD(snapshot, uart->tx_fifo.out);
+    SNAPSHOT_FIELD(snapshot, uart->tx_fifo_data);
+    SNAPSHOT_FIELD(snapshot, uart->tx_irq_enabled);
+    SNAPSHOT_FIELD(snapshot, uart->tx_needs_flush);
+}
+
+static void simple_uart_flush_tx(simple_uart_td *uart)
+{
+    uint8_t tmp_fifo_len = 0;
+    uint8_t tmp_char = 0;
+    int i = 0;
+
+    tmp_fifo_len = fifo_len(&uart->tx_fifo);
+    for(i=0;i<tmp_fifo_len;i++)
+    {
+        fifo_out(&uart->tx_fifo, &tmp_char, 1);
+        console_putc(uart->console, tmp_char);
+    }
+    console_poll(uart->console);
+    uart->tx_needs_flush = 0;
+}
+
 rv_ret simple_uart_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len)
 {
     (void) priv_level;
@@ -36,8 +67,6 @@ rv_ret simple_uart_bus_access(void *priv, privilege_level priv_level, bus_access
     if(len != 1)
         die_msg("UART WRITE: Only single byte access allowed!\n");
 
-    pthread_mutex_lock(&uart->lock);
-
     if(access_type == bus_write_access)
     {
         val_u8 = *(uint8_t*)value;
@@ -45,6 +74,9 @@ rv_ret simple_uart_bus_access(void *priv, privilege_level priv_level, bus_access
         {
             case SIMPLE_UART_TX_RX_REG:
                 fifo_in(&uart->tx_fifo, &val_u8, 1);
+                /* The core may run many instructions between two updates, don't drop anything */
+                if(fifo_is_full(&uart->tx_fifo))
+                    simple_uart_flush_tx(uart);
                 if(val_u8 == '\n')
                     uart->tx_needs_flush = 1;
                 // putchar(val_u8);
@@ -80,8 +112,6 @@ rv_ret simple_uart_bus_access(void *priv, privilege_level priv_level, bus_access
         }
     }
 
-    pthread_mutex_unlock(&uart->lock);
-
     return rv_ok;
 }
 
@@ -90,24 +120,10 @@ uint8_t simple_uart_update(void *priv)
 {
     simple_uart_td *uart = priv;
     uint8_t irq_trigger = 0;
-    uint8_t tmp_fifo_len = 0;
-    uint8_t tmp_char = 0;
-    int i = 0;
     static int count = 0;
 
-    pthread_mutex_lock(&uart->lock);
-
     if(fifo_is_full(&uart->tx_fifo) || uart->tx_needs_flush)
-    {
-        tmp_fifo_len = fifo_len(&uart->tx_fifo);
-        for(i=0;i<tmp_fifo_len;i++)
-        {
-            fifo_out(&uart->tx_fifo, &tmp_char, 1);
-            putchar(tmp_char);
-        }
-        fflush( stdout );
-        uart->tx_needs_flush = 0;
-    }
+        simple_uart_flush_tx(uart);
 
     if( uart->rx_irq_enabled && (fifo_is_full(&uart->rx_fifo)) ) //&& !uart->rx_triggered )
     {
@@ -124,19 +140,14 @@ uint8_t simple_uart_update(void *priv)
         count++;   
     }
 
-    pthread_mutex_unlock(&uart->lock);
-
     return irq_trigger;
 }
 
-void simple_uart_add_rx_char(simple_uart_td *uart, uint8_t x)
+/* Called from the RX thread, returns how many characters fit into the fifo */
+unsigned int simple_uart_add_rx_chars(simple_uart_td *uart, const uint8_t *buf, unsigned int len)
 {
-    pthread_mutex_lock(&uart->lock);
-
-    fifo_in(&uart->rx_fifo, &x, 1);
-
     // uart->rx_triggered = 0;
     // printf("rx irq_enabled %x tx irq_enabled %x triggered %x\n", uart->rx_irq_enabled, uart->tx_irq_enabled, uart->tx_triggered);
 
-    pthread_mutex_unlock(&uart->lock);
+    return fifo_in(&uart->rx_fifo, buf, len);
 }
@@ -2,9 +2,10 @@
 #define SIMPLE_UART_H
 
 #include <stdint.h>
-#include <pthread.h>
 
 #include <fifo.h>
+#include <console.h>
+#include <snapshot.h>
 
 #include <riscv_types.h>
 
@@ -23,13 +24,14 @@ typedef struct simple_uart_struct
     uint8_t tx_irq_enabled;
     uint8_t tx_needs_flush;
 
-    pthread_mutex_t lock;
+    console_td *console;
 
 } simple_uart_td;
 
-void simple_uart_init(simple_uart_td *uart);
+void simple_uart_init(simple_uart_td *uart, console_td *console);
+void simple_uart_snapshot(simple_uart_td *uart, snapshot_td *snapshot);
 rv_ret simple_uart_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len);
 uint8_t simple_uart_update(void *priv);
-void simple_uart_add_rx_char(simple_uart_td *uart, uint8_t x);
+unsigned int simple_uart_add_rx_chars(simple_uart_td *uart, const uint8_t *buf, unsigned int len);
 
 #endif /* UART_NS8250_H */
@@ -1,8 +1,6 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <pthread.h>
-
 #include <riscv_helper.h>
 #include <uart_8250.h>
 
@@ -35,15 +33,15 @@
 #define UART_FIFO_FAIL     0
 #define UART_FIFO_SUCCESS  1
 
-void uart_init(uart_ns8250_td *uart)
+void uart_init(uart_ns8250_td *uart, console_td *console)
 {
     memset(uart, 0, sizeof(uart_ns8250_td));
 
-    if (pthread_mutex_init(&uart->lock, NULL) != 0)
-    {
-        die_msg("uart mutex init failed\n");
-    }
+    uart->console = console;
 
+    /* The RX thread is the only writer of rx_fifo and the cpu thread the only reader,
+     * everything else is only touched by the cpu thread, so no locking is needed.
+     */
     fifo_init(&uart->tx_fifo, uart->tx_fifo_data, UART_NS8250_FIFO_SIZE);
     fifo_init(&uart->rx_fifo, uart->rx_fifo_data, UART_NS8250_FIFO_SIZE);
 
@@ -53,6 +51,40 @@ void uart_init(uart_ns8250_td *uart)
     uart->curr_iir_id = 1;
 }
 
+/* Everything but the console, characters still in the fifos are kept */
+void uart_snapshot(uart_ns8250_td *uart, snapshot_td *snapshot)
+{
+    SNAPSHOT_FIELD(snapshot, uart->dlab);
+
+    SNAPSHOT_FIELD(snapshot, uart->irq_enabled_rx_data_available);
+    SNAPSHOT_FIELD(snapshot, uart->irq_enabled_tx_holding_reg_empty);
+    SNAPSHOT_FIELD(snapshot, uart->irq_enabled_rlsr_change);
+    SNAPSHOT_FIELD(snapshot, uart->irq_enabled_msr_change);
+    SNAPSHOT_FIELD(snapshot, uart->irq_enabled_sleep);
+    SNAPSHOT_FIELD(snapshot, uart->irq_enabled_low_power);
+
+    SNAPSHOT_FIELD(snapshot, uart->tx_holding_reg_empty);
+    SNAPSHOT_FIELD(snapshot, uart->tx_holding_irq_cleared);
+
+    SNAPSHOT_FIELD(snapshot, uart->fifo_enabled);
+
+    SNAPSHOT_FIELD(snapshot, uart->tx_fifo.in);
+    SNAPSHOT_FIELD(snapshot, uart->tx_fifo.out);
+    SNAPSHOT_FIELD(snapshot, uart->tx_fifo_data);
+    SNAPSHOT_FIELD(snapshot, uart->tx_needs_flush);
+    SNAPSHOT_FIELD(snapshot, uart->tx_stop_triggering);
+
+    SNAPSHOT_FIELD(snapshot, uart->rx_fifo.in);
+    SNAPSHOT_FIELD(snapshot, uart->rx_fifo.out);
+    SNAPSHOT_FIELD(snapshot, uart->rx_fifo_data);
+    SNAPSHOT_FIELD(snapshot, uart->rx_irq_fifo_level);
+    SNAPSHOT_FIELD(snapshot, uart->lsr_change);
+
+    SNAPSHOT_FIELD(snapshot, uart->curr_iir_id);
+
+    SNAPSHOT_FIELD(snapshot, uart->regs);
+}
+
 rv_ret uart_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len)
 {
     (void) priv_level;
@@ -65,8 +97,6 @@ rv_ret uart_bus_access(void *priv, privilege_level priv_level, bus_access_type a
     if(len != 1)
         die_msg("UART WRITE: Only single byte access allowed!\n");
 
-    pthread_mutex_lock(&uart->lock);
-
     if(access_type == bus_write_access)
     {
         val_u8 = *(uint8_t*)value;
@@ -236,8 +266,8 @@ rv_ret uart_bus_access(void *priv, privilege_level priv_level, bus_access_type a
 
                     // printf("LSR! %x\n", tmp_out_val);
 
-                    if(uart->lsr_change)
-                        uart->lsr_change = 0;
+                    if(__atomic_load_n(&uart->lsr_change, __ATOMIC_RELAXED))
+                        __atomic_store_n(&uart->lsr_change, 0, __ATOMIC_RELAXED);
                 }
             break;
             case REG_LCR:
@@ -256,8 +286,6 @@ rv_ret uart_bus_access(void *priv, privilege_level priv_level, bus_access_type a
         }
     }
 
-    pthread_mutex_unlock(&uart->lock);
-
     return rv_ok;
 }
 
@@ -269,20 +297,18 @@ uint8_t uart_update(void *priv)
     uint8_t tmp_fifo_len = 0;
     uint8_t irq_trigger = 0;
 
-    pthread_mutex_lock(&uart->lock);
-
     if(fifo_is_full(&uart->tx_fifo) || uart->tx_needs_flush)
     {
         tmp_fifo_len = fifo_len(&uart->tx_fifo);
         for(i=0;i<tmp_fifo_len;i++)
         {
             fifo_out(&uart->tx_fifo, &tmp_char, 1);
-            putchar(tmp_char);
+            console_putc(uart->console, tmp_char);
         }
-        fflush( stdout );
+        console_poll(uart->console);
     }
 
-    if( (uart->irq_enabled_rlsr_change || uart->irq_enabled_rx_data_available ) && uart->lsr_change )
+    if( (uart->irq_enabled_rlsr_change || uart->irq_enabled_rx_data_available ) && __atomic_load_n(&uart->lsr_change, __ATOMIC_RELAXED) )
     {
         // printf("RX\n");
         irq_trigger = 1;
@@ -305,22 +331,19 @@ uint8_t uart_update(void *priv)
 
     uart->regs[REG_IIR] = uart->curr_iir_id;
 
-    pthread_mutex_unlock(&uart->lock);
-
     return irq_trigger;
 }
 
-void uart_add_rx_char(uart_ns8250_td *uart, uint8_t x)
+/* Called from the RX thread, returns how many characters fit into the fifo */
+unsigned int uart_add_rx_chars(uart_ns8250_td *uart, const uint8_t *buf, unsigned int len)
 {
-    pthread_mutex_lock(&uart->lock);
+    unsigned int added = fifo_in(&uart->rx_fifo, buf, len);
 
-    // uint8_t tmp = 13;
-    fifo_in(&uart->rx_fifo, &x, 1);
-    // fifo_in(&uart->rx_fifo, &tmp, 1);
-    uart->lsr_change = 1;
+    if(added)
+        __atomic_store_n(&uart->lsr_change, 1, __ATOMIC_RELEASE);
 
     // printf("RX %x\n", x);
     // assign_u8_bit(&uart->regs[REG_LSR], 0, 1);
 
-    pthread_mutex_unlock(&uart->lock);
+    return added;
 }
@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 #include <fifo.h>
+#include <console.h>
+#include <snapshot.h>
 
 #define UART_NS8250_NR_REGS 12
 #define UART_NS8250_FIFO_SIZE 16
@@ -36,19 +38,21 @@ typedef struct uart_ns8250_struct
     fifo_t rx_fifo;
     uint8_t rx_fifo_data[UART_NS8250_FIFO_SIZE];
     uint8_t rx_irq_fifo_level;
+    /* set by the RX thread, cleared by the cpu on LSR reads */
     uint8_t lsr_change;
 
     uint8_t curr_iir_id;
 
     uint8_t regs[UART_NS8250_NR_REGS];
 
-    pthread_mutex_t lock;
+    console_td *console;
 
 } uart_ns8250_td;
 
-void uart_init(uart_ns8250_td *uart);
+void uart_init(uart_ns8250_td *uart, console_td *console);
+void uart_snapshot(uart_ns8250_td *uart, snapshot_td *snapshot);
 rv_ret uart_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len);
 uint8_t uart_update(void *priv);
-void uart_add_rx_char(uart_ns8250_td *uart, uint8_t x);
+unsigned int uart_add_rx_chars(uart_ns8250_td *uart, const uint8_t *buf, unsigned int len);
 
 #endif /* UART_NS8250_H */
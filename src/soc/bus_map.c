@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bus_map.h>
+
+void bus_map_init(bus_map_td *bus_map)
+{
+    memset(bus_map, 0, sizeof(bus_map_td));
+}
+
+static void bus_map_add_region(bus_map_td *bus_map, bus_map_region_td *new_region)
+{
+    bus_map_region_td **regions = NULL;
+    bus_map_region_td *region = NULL;
+    uint64_t region_end = (uint64_t)new_region->addr_start + new_region->mem_size;
+    uint64_t page = 0;
+    uint64_t page_end = 0;
+    unsigned int i = 0;
+
+    if(new_region->mem_size == 0)
+        die_msg("Bus region at "PRINTF_FMT" has no size!\n", new_region->addr_start);
+
+    for(i=0;i<bus_map->nr_regions;i++)
+    {
+        region = bus_map->regions[i];
+        if( (new_region->addr_start < ((uint64_t)region->addr_start + region->mem_size)) &&
+            (region->addr_start < region_end) )
+            die_msg("Bus region at "PRINTF_FMT" overlaps with the one at "PRINTF_FMT"!\n", new_region->addr_start, region->addr_start);
+    }
+
+    region = malloc(sizeof(bus_map_region_td));
+    regions = realloc(bus_map->regions, (bus_map->nr_regions + 1) * sizeof(bus_map_region_td *));
+    if( (region == NULL) || (regions == NULL) )
+        die_msg("Could not allocate bus region!\n");
+
+    *region = *new_region;
+    bus_map->regions = regions;
+    bus_map->regions[bus_map->nr_regions++] = region;
+
+    /* Pages beyond the table are only found by the slow lookup */
+    page = new_region->addr_start >> BUS_MAP_PAGE_SHIFT;
+    page_end = ASSIGN_MIN(((region_end - 1) >> BUS_MAP_PAGE_SHIFT) + 1, BUS_MAP_NR_PAGES);
+
+    for(;page<page_end;page++)
+    {
+        bus_map_region_td ***table = &bus_map->pages[page >> BUS_MAP_LEVEL_BITS];
+
+        if(*table == NULL)
+        {
+            *table = calloc(BUS_MAP_LEVEL_SIZE, sizeof(bus_map_region_td *));
+            if(*table == NULL)
+                die_msg("Could not allocate bus map!\n");
+        }
+
+        /* a page shared with another region keeps its first one, the lookup falls back to a scan for the others */
+        if((*table)[page & (BUS_MAP_LEVEL_SIZE-1)] == NULL)
+            (*table)[page & (BUS_MAP_LEVEL_SIZE-1)] = region;
+    }
+}
+
+void bus_map_add_device(bus_map_td *bus_map, bus_access_func bus_access, void *priv, rv_uint_xlen addr_start, rv_uint_xlen mem_size)
+{
+    bus_map_region_td region = { bus_access, priv, NULL, addr_start, mem_size };
+    bus_map_add_region(bus_map, &region);
+}
+
+void bus_map_add_memory(bus_map_td *bus_map, uint8_t *host_mem, rv_uint_xlen addr_start, rv_uint_xlen mem_size)
+{
+    bus_map_region_td region = { NULL, NULL, host_mem, addr_start, mem_size };
+    bus_map_add_region(bus_map, &region);
+}
+
+bus_map_region_td *bus_map_lookup_slow(bus_map_td *bus_map, rv_uint_xlen addr, rv_uint_xlen len)
+{
+    unsigned int i = 0;
+
+    for(i=0;i<bus_map->nr_regions;i++)
+    {
+        if(ADDR_WITHIN_LEN(addr, len, bus_map->regions[i]->addr_start, bus_map->regions[i]->mem_size))
+            return bus_map->regions[i];
+    }
+
+    return NULL;
+}
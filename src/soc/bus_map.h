@@ -0,0 +1,64 @@
+#ifndef RISCV_BUS_MAP_H
+#define RISCV_BUS_MAP_H
+
+#include <stdint.h>
+#include <riscv_types.h>
+#include <riscv_helper.h>
+
+#define BUS_MAP_PAGE_SHIFT 12
+/* Two levels of 1024 entries each cover the lower 4GB of the physical address space */
+#define BUS_MAP_LEVEL_BITS 10
+#define BUS_MAP_LEVEL_SIZE (1UL << BUS_MAP_LEVEL_BITS)
+#define BUS_MAP_NR_PAGES (BUS_MAP_LEVEL_SIZE * BUS_MAP_LEVEL_SIZE)
+
+typedef struct bus_map_region_struct
+{
+    bus_access_func bus_access;
+    void *priv;
+
+    /* set for plain memory, which is accessed directly instead of calling bus_access */
+    uint8_t *host_mem;
+
+    rv_uint_xlen addr_start;
+    rv_uint_xlen mem_size;
+
+} bus_map_region_td;
+
+typedef struct bus_map_struct
+{
+    /* Page granular radix table, every page points to one of the regions touching it.
+     * Regions are allocated separately, so they keep their address when more get added.
+     */
+    bus_map_region_td **pages[BUS_MAP_LEVEL_SIZE];
+
+    bus_map_region_td **regions;
+    unsigned int nr_regions;
+
+} bus_map_td;
+
+void bus_map_init(bus_map_td *bus_map);
+void bus_map_add_device(bus_map_td *bus_map, bus_access_func bus_access, void *priv, rv_uint_xlen addr_start, rv_uint_xlen mem_size);
+void bus_map_add_memory(bus_map_td *bus_map, uint8_t *host_mem, rv_uint_xlen addr_start, rv_uint_xlen mem_size);
+bus_map_region_td *bus_map_lookup_slow(bus_map_td *bus_map, rv_uint_xlen addr, rv_uint_xlen len);
+
+static inline bus_map_region_td *bus_map_lookup(bus_map_td *bus_map, rv_uint_xlen addr, rv_uint_xlen len)
+{
+    uint64_t page = (uint64_t)addr >> BUS_MAP_PAGE_SHIFT;
+    bus_map_region_td **table = NULL;
+    bus_map_region_td *region = NULL;
+
+    if(page < BUS_MAP_NR_PAGES)
+    {
+        table = bus_map->pages[page >> BUS_MAP_LEVEL_BITS];
+        if(table != NULL)
+            region = table[page & (BUS_MAP_LEVEL_SIZE-1)];
+
+        if( (region != NULL) && ADDR_WITHIN_LEN(addr, len, region->addr_start, region->mem_size) )
+            return region;
+    }
+
+    /* pages shared by small regions, accesses beyond the table or to nowhere */
+    return bus_map_lookup_slow(bus_map, addr, len);
+}
+
+#endif /* RISCV_BUS_MAP_H */
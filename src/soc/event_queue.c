@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <riscv_helper.h>
+#include <event_queue.h>
+
+static void event_queue_set(event_queue_td *event_queue, unsigned int index, event_td *event)
+{
+    event_queue->heap[index] = event;
+    event->heap_index = index;
+}
+
+static void event_queue_sift_up(event_queue_td *event_queue, unsigned int index)
+{
+    event_td *event = event_queue->heap[index];
+    unsigned int parent = 0;
+
+    while(index > 0)
+    {
+        parent = (index - 1) / 2;
+        if(event_queue->heap[parent]->when <= event->when)
+            break;
+
+        event_queue_set(event_queue, index, event_queue->heap[parent]);
+        index = parent;
+    }
+
+    event_queue_set(event_queue, index, event);
+}
+
+static void event_queue_sift_down(event_queue_td *event_queue, unsigned int index)
+{
+    event_td *event = event_queue->heap[index];
+    unsigned int child = 0;
+
+    while((child = (2 * index) + 1) < event_queue->nr_events)
+    {
+        if( ((child + 1) < event_queue->nr_events) && (event_queue->heap[child + 1]->when < event_queue->heap[child]->when) )
+            child++;
+
+        if(event->when <= event_queue->heap[child]->when)
+            break;
+
+        event_queue_set(event_queue, index, event_queue->heap[child]);
+        index = child;
+    }
+
+    event_queue_set(event_queue, index, event);
+}
+
+void event_queue_init(event_queue_td *event_queue)
+{
+    memset(event_queue, 0, sizeof(event_queue_td));
+}
+
+void event_init(event_td *event, event_cb cb, void *priv)
+{
+    event->when = 0;
+    event->cb = cb;
+    event->priv = priv;
+    event->heap_index = -1;
+}
+
+void event_schedule(event_queue_td *event_queue, event_td *event, uint64_t when)
+{
+    if(event->heap_index < 0)
+    {
+        if(event_queue->nr_events >= EVENT_QUEUE_SIZE)
+            die_msg("Event queue full!\n");
+
+        event->when = when;
+        event_queue_set(event_queue, event_queue->nr_events++, event);
+        event_queue_sift_up(event_queue, event->heap_index);
+        return;
+    }
+
+    /* already queued, just move it to its new place */
+    event->when = when;
+    event_queue_sift_up(event_queue, event->heap_index);
+    event_queue_sift_down(event_queue, event->heap_index);
+}
+
+void event_cancel(event_queue_td *event_queue, event_td *event)
+{
+    unsigned int index = event->heap_index;
+    event_td *last = NULL;
+
+    if(event->heap_index < 0)
+        return;
+
+    event->heap_index = -1;
+    last = event_queue->heap[--event_queue->nr_events];
+
+    if(index == event_queue->nr_events)
+        return;
+
+    /* fill the gap with the last event */
+    event_queue_set(event_queue, index, last);
+    event_queue_sift_up(event_queue, index);
+    event_queue_sift_down(event_queue, last->heap_index);
+}
+
+/* Runs all events which are due, callbacks may schedule their event again */
+void event_queue_run(event_queue_td *event_queue, uint64_t now)
+{
+    event_td *event = NULL;
+
+    while(event_queue_next(event_queue) <= now)
+    {
+        event = event_queue->heap[0];
+        event_cancel(event_queue, event);
+        event->cb(event->priv);
+    }
+}
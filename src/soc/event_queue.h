@@ -0,0 +1,64 @@
+#ifndef RISCV_EVENT_QUEUE_H
+#define RISCV_EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <riscv_types.h>
+
+typedef void (*event_cb)(void *priv);
+
+/* Something a device wants to happen at a given cycle, the event stays
+ * owned by the device and can be rescheduled or cancelled at any time.
+ */
+typedef struct event_struct
+{
+    uint64_t when;
+    event_cb cb;
+    void *priv;
+
+    /* position in the heap, -1 if not scheduled */
+    int heap_index;
+
+} event_td;
+
+/* min-heap ordered by the cycle the events are due */
+typedef struct event_queue_struct
+{
+    event_td *heap[EVENT_QUEUE_SIZE];
+    unsigned int nr_events;
+
+    /* Raised by asynchronous sources such as the uart RX thread or by device accesses,
+     * it tells the run loop to poll the devices as soon as possible.
+     */
+    uint8_t check;
+
+} event_queue_td;
+
+void event_queue_init(event_queue_td *event_queue);
+void event_init(event_td *event, event_cb cb, void *priv);
+void event_schedule(event_queue_td *event_queue, event_td *event, uint64_t when);
+void event_cancel(event_queue_td *event_queue, event_td *event);
+void event_queue_run(event_queue_td *event_queue, uint64_t now);
+
+/* cycle of the next event, UINT64_MAX if there is none */
+static inline uint64_t event_queue_next(event_queue_td *event_queue)
+{
+    return event_queue->nr_events ? event_queue->heap[0]->when : UINT64_MAX;
+}
+
+static inline void event_queue_raise(event_queue_td *event_queue)
+{
+    __atomic_store_n(&event_queue->check, 1, __ATOMIC_RELEASE);
+}
+
+static inline int event_queue_raised(event_queue_td *event_queue)
+{
+    return __atomic_load_n(&event_queue->check, __ATOMIC_RELAXED);
+}
+
+/* Returns the flag and clears it, anything raised afterwards is seen by the next check */
+static inline int event_queue_take(event_queue_td *event_queue)
+{
+    return __atomic_exchange_n(&event_queue->check, 0, __ATOMIC_ACQUIRE);
+}
+
+#endif /* RISCV_EVENT_QUEUE_H */
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <riscv_helper.h>
+#include <input_log.h>
+
+void input_log_init(input_log_td *input_log)
+{
+    memset(input_log, 0, sizeof(input_log_td));
+
+    if(pthread_mutex_init(&input_log->lock, NULL) != 0)
+        die_msg("Could not init input log lock!\n");
+
+    input_log->next_cycle = UINT64_MAX;
+}
+
+static void input_log_read_next(input_log_td *input_log)
+{
+    char line[(2 * INPUT_LOG_BUF_SIZE) + 32];
+    char *hex = NULL;
+    unsigned int byte = 0;
+
+    input_log->next_cycle = UINT64_MAX;
+    input_log->nr_next = 0;
+
+    if(fgets(line, sizeof(line), input_log->file) == NULL)
+        return;
+
+    input_log->next_cycle = strtoull(line, &hex, 10);
+
+    while(*hex == ' ')
+        hex++;
+
+    while((input_log->nr_next < INPUT_LOG_BUF_SIZE) && (sscanf(hex, "%2x", &byte) == 1))
+    {
+        input_log->next[input_log->nr_next++] = byte;
+        hex += 2;
+    }
+
+    if(input_log->nr_next == 0)
+        die_msg("Malformed input log entry: %s\n", line);
+}
+
+void input_log_record(input_log_td *input_log, char *file_name)
+{
+    input_log->file = fopen(file_name, "w");
+    if(input_log->file == NULL)
+        die_msg("Could not open input log %s!\n", file_name);
+
+    input_log->mode = input_log_recording;
+}
+
+void input_log_replay(input_log_td *input_log, char *file_name)
+{
+    input_log->file = fopen(file_name, "r");
+    if(input_log->file == NULL)
+        die_msg("Could not open input log %s!\n", file_name);
+
+    input_log->mode = input_log_replaying;
+    input_log_read_next(input_log);
+}
+
+/* Drops the chunks of the log which are due up to the given cycle */
+void input_log_skip(input_log_td *input_log, uint64_t cycle)
+{
+    while((input_log->mode == input_log_replaying) && (input_log->next_cycle <= cycle))
+        input_log_read_next(input_log);
+}
+
+/* Called by the input thread while recording, returns how much of buf was taken */
+unsigned int input_log_queue(input_log_td *input_log, const uint8_t *buf, unsigned int len)
+{
+    pthread_mutex_lock(&input_log->lock);
+
+    len = ASSIGN_MIN(len, INPUT_LOG_BUF_SIZE - input_log->nr_pending);
+    memcpy(&input_log->pending[input_log->nr_pending], buf, len);
+    input_log->nr_pending += len;
+
+    pthread_mutex_unlock(&input_log->lock);
+
+    return len;
+}
+
+/* Copies the input which should be passed on at the given cycle to buf and returns its length */
+unsigned int input_log_due(input_log_td *input_log, uint64_t cycle, uint8_t *buf)
+{
+    unsigned int len = 0;
+
+    if(input_log->mode == input_log_recording)
+    {
+        pthread_mutex_lock(&input_log->lock);
+        len = input_log->nr_pending;
+        memcpy(buf, input_log->pending, len);
+        pthread_mutex_unlock(&input_log->lock);
+    }
+    else if((input_log->mode == input_log_replaying) && (input_log->next_cycle <= cycle))
+    {
+        len = input_log->nr_next;
+        memcpy(buf, input_log->next, len);
+    }
+
+    return len;
+}
+
+/* The first len bytes of what input_log_due() returned were passed on at the given cycle */
+void input_log_consumed(input_log_td *input_log, uint64_t cycle, unsigned int len)
+{
+    unsigned int i = 0;
+
+    if(len == 0)
+        return;
+
+    if(input_log->mode == input_log_recording)
+    {
+        fprintf(input_log->file, "%" PRIu64 " ", cycle);
+        for(i=0;i<len;i++)
+            fprintf(input_log->file, "%02x", input_log->pending[i]);
+        fprintf(input_log->file, "\n");
+
+        /* the log should survive the emulator getting killed */
+        fflush(input_log->file);
+
+        pthread_mutex_lock(&input_log->lock);
+        input_log->nr_pending -= len;
+        memmove(input_log->pending, &input_log->pending[len], input_log->nr_pending);
+        pthread_mutex_unlock(&input_log->lock);
+    }
+    else if(input_log->mode == input_log_replaying)
+    {
+        /* the uart had room for all of it while recording */
+        if(len != input_log->nr_next)
+            die_msg("Replay diverged at cycle %" PRIu64 "!\n", cycle);
+
+        input_log_read_next(input_log);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef RISCV_INPUT_LOG_H
+#define RISCV_INPUT_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <riscv_types.h>
+
+typedef enum
+{
+    input_log_off = 0,
+    input_log_recording,
+    input_log_replaying
+
+} input_log_mode;
+
+/* Makes external input reproducible. Instead of reaching the uart at whatever point the host
+ * thread happens to deliver it, input is only passed on between two quanta of the hart and every
+ * chunk is logged together with the cycle it was passed on at. A replay passes on the same chunks
+ * at the same cycles again, one line of the log file per chunk: "<cycle> <hex bytes>".
+ */
+typedef struct input_log_struct
+{
+    input_log_mode mode;
+    FILE *file;
+
+    /* host input which was not passed on yet, filled by the input thread while recording */
+    pthread_mutex_t lock;
+    uint8_t pending[INPUT_LOG_BUF_SIZE];
+    unsigned int nr_pending;
+
+    /* next chunk of the log while replaying, next_cycle is UINT64_MAX once it is exhausted */
+    uint64_t next_cycle;
+    uint8_t next[INPUT_LOG_BUF_SIZE];
+    unsigned int nr_next;
+
+} input_log_td;
+
+void input_log_init(input_log_td *input_log);
+void input_log_record(input_log_td *input_log, char *file_name);
+void input_log_replay(input_log_td *input_log, char *file_name);
+void input_log_skip(input_log_td *input_log, uint64_t cycle);
+unsigned int input_log_queue(input_log_td *input_log, const uint8_t *buf, unsigned int len);
+unsigned int input_log_due(input_log_td *input_log, uint64_t cycle, uint8_t *buf);
+void input_log_consumed(input_log_td *input_log, uint64_t cycle, unsigned int len);
+
+/* cycle at which the next chunk of the log has to be passed on, UINT64_MAX if there is none */
+static inline uint64_t input_log_next_cycle(input_log_td *input_log)
+{
+    return (input_log->mode == input_log_replaying) ? input_log->next_cycle : UINT64_MAX;
+}
+
+#endif /* RISCV_INPUT_LOG_H */
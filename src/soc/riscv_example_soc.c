@@ -2,67 +2,80 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <riscv_helper.h>
 #include <riscv_example_soc.h>
 
 #include <file_helper.h>
+#include <host_clock.h>
 
-#define INIT_MEM_ACCESS_STRUCT(_ref_rv_soc, _entry, _bus_access_func, _priv, _addr_start, _mem_size) \
-{ \
-    size_t _tmp_count = _entry; \
-    if(_tmp_count >= (sizeof(_ref_rv_soc->mem_access_cbs)/sizeof(_ref_rv_soc->mem_access_cbs[0]))) \
-        die_msg("No mem access pointer available for entry nr %d, please increase mem_access_cbs!\n", _entry); \
-    _ref_rv_soc->mem_access_cbs[_tmp_count].bus_access = _bus_access_func; \
-    _ref_rv_soc->mem_access_cbs[_tmp_count].priv = _priv; \
-    _ref_rv_soc->mem_access_cbs[_tmp_count].addr_start = _addr_start; \
-    _ref_rv_soc->mem_access_cbs[_tmp_count].mem_size = _mem_size; \
-}
-
-static rv_ret memory_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len)
+static void rv_soc_init_bus_map(rv_soc_td *rv_soc)
 {
-    (void) priv_level;
-    uint8_t *mem_ptr = priv;
+    bus_map_init(&rv_soc->bus_map);
 
-    if(access_type == bus_write_access)
-        memcpy(&mem_ptr[address], value, len);
-    else 
-        memcpy(value, &mem_ptr[address], len);
-
-    return rv_ok;
-}
-
-static void rv_soc_init_mem_access_cbs(rv_soc_td *rv_soc)
-{
-    int count = 0;
-    INIT_MEM_ACCESS_STRUCT(rv_soc, count++, memory_bus_access, rv_soc->ram, RAM_BASE_ADDR, RAM_SIZE_BYTES);
-    INIT_MEM_ACCESS_STRUCT(rv_soc, count++, clint_bus_access, &rv_soc->clint, CLINT_BASE_ADDR, CLINT_SIZE_BYTES);
-    INIT_MEM_ACCESS_STRUCT(rv_soc, count++, plic_bus_access, &rv_soc->plic, PLIC_BASE_ADDR, PLIC_SIZE_BYTES);
+    bus_map_add_memory(&rv_soc->bus_map, rv_soc->ram, RAM_BASE_ADDR, RAM_SIZE_BYTES);
+    bus_map_add_device(&rv_soc->bus_map, clint_bus_access, &rv_soc->clint, CLINT_BASE_ADDR, CLINT_SIZE_BYTES);
+    bus_map_add_device(&rv_soc->bus_map, plic_bus_access, &rv_soc->plic, PLIC_BASE_ADDR, PLIC_SIZE_BYTES);
     #ifdef USE_SIMPLE_UART
-        INIT_MEM_ACCESS_STRUCT(rv_soc, count++, simple_uart_bus_access, &rv_soc->uart, SIMPLE_UART_TX_REG_ADDR, SIMPLE_UART_SIZE_BYTES);
+        bus_map_add_device(&rv_soc->bus_map, simple_uart_bus_access, &rv_soc->uart, SIMPLE_UART_TX_REG_ADDR, SIMPLE_UART_SIZE_BYTES);
     #else
-        INIT_MEM_ACCESS_STRUCT(rv_soc, count++, uart_bus_access, &rv_soc->uart8250, UART8250_TX_REG_ADDR, UART_NS8250_NR_REGS);
+        bus_map_add_device(&rv_soc->bus_map, uart_bus_access, &rv_soc->uart8250, UART8250_TX_REG_ADDR, UART_NS8250_NR_REGS);
     #endif
-    INIT_MEM_ACCESS_STRUCT(rv_soc, count++, memory_bus_access, rv_soc->mrom, MROM_BASE_ADDR, MROM_SIZE_BYTES);
-    INIT_MEM_ACCESS_STRUCT(rv_soc, count++, memory_bus_access, rv_soc->from, FROM_BASE_ADDR, FROM_SIZE_BYTES);
+    bus_map_add_memory(&rv_soc->bus_map, rv_soc->mrom, MROM_BASE_ADDR, MROM_SIZE_BYTES);
+    bus_map_add_memory(&rv_soc->bus_map, rv_soc->from, FROM_BASE_ADDR, FROM_SIZE_BYTES);
 }
 
+static void rv_soc_update_timer(rv_soc_td *rv_soc);
+
 static rv_ret rv_soc_bus_access(void *priv, privilege_level priv_level, bus_access_type access_type, rv_uint_xlen address, void *value, uint8_t len)
 {
-    rv_soc_td *rv_soc = priv;
+    rv_soc_hart_td *hart = priv;
+    rv_soc_td *rv_soc = hart->rv_soc;
+    bus_map_region_td *region = bus_map_lookup(&rv_soc->bus_map, address, len);
     rv_uint_xlen tmp_addr = 0;
-    size_t i = 0;
+    rv_ret ret = rv_ok;
+
+    if(region == NULL)
+        die_msg("Invalid Address, or no valid write pointer found, write not executed!: Addr: 0x"PRINTF_FMT" Len: %d Cycle: %ld  PC: 0x"PRINTF_FMT"\n", address, len, hart->rv_core.curr_cycle, hart->rv_core.pc);
+
+    tmp_addr = address - region->addr_start;
 
-    for(i=0;i<(sizeof(rv_soc->mem_access_cbs)/sizeof(rv_soc->mem_access_cbs[0]));i++)
+    if(region->host_mem != NULL)
     {
-        if(ADDR_WITHIN_LEN(address, len, rv_soc->mem_access_cbs[i].addr_start, rv_soc->mem_access_cbs[i].mem_size))
-        {
-            tmp_addr = address - rv_soc->mem_access_cbs[i].addr_start;
-            return rv_soc->mem_access_cbs[i].bus_access(rv_soc->mem_access_cbs[i].priv, priv_level, access_type, tmp_addr, value, len);
-        }
+        if(access_type == bus_write_access)
+            memcpy(&region->host_mem[tmp_addr], value, len);
+        else
+            memcpy(value, &region->host_mem[tmp_addr], len);
+
+        return rv_ok;
     }
 
-    die_msg("Invalid Address, or no valid write pointer found, write not executed!: Addr: 0x"PRINTF_FMT" Len: %d Cycle: %ld  PC: 0x"PRINTF_FMT"\n", address, len, rv_soc->rv_core0.curr_cycle, rv_soc->rv_core0.pc);
+    /* devices see the current time and get polled right after the access */
+    pthread_mutex_lock(&rv_soc->device_lock);
+    rv_soc_update_timer(rv_soc);
+    ret = region->bus_access(region->priv, priv_level, access_type, tmp_addr, value, len);
+    pthread_mutex_unlock(&rv_soc->device_lock);
+
+    event_queue_raise(&rv_soc->events);
+    hart->rv_core.exit_request = 1;
+
+    return ret;
+}
+
+static uint8_t *rv_soc_bus_host_ptr(void *priv, rv_uint_xlen address, rv_uint_xlen len)
+{
+    rv_soc_hart_td *hart = priv;
+    rv_soc_td *rv_soc = hart->rv_soc;
+    bus_map_region_td *region = bus_map_lookup(&rv_soc->bus_map, address, len);
+
+    /* only plain memory can be accessed directly, peripherals need their callbacks */
+    if( (region == NULL) || (region->host_mem == NULL) )
+        return NULL;
+
+    return &region->host_mem[address - region->addr_start];
 }
 
 void rv_soc_dump_mem(rv_soc_td *rv_soc)
@@ -75,7 +88,33 @@ void rv_soc_dump_mem(rv_soc_td *rv_soc)
     }
 }
 
-void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, char *initrd_file_name)
+static void rv_soc_timer_event(void *priv);
+static void rv_soc_input_event(void *priv);
+
+static void rv_soc_init_locks(rv_soc_td *rv_soc)
+{
+    pthread_condattr_t cond_attr;
+    unsigned int i = 0;
+
+    /* timeouts are taken from the monotonic clock */
+    if( (pthread_mutex_init(&rv_soc->device_lock, NULL) != 0) ||
+        (pthread_mutex_init(&rv_soc->idle_lock, NULL) != 0) ||
+        (pthread_condattr_init(&cond_attr) != 0) ||
+        (pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) != 0) )
+        die_msg("Could not init idle lock!\n");
+
+    for(i=0;i<rv_soc->nr_harts;i++)
+    {
+        if(pthread_cond_init(&rv_soc->harts[i].idle_cond, &cond_attr) != 0)
+            die_msg("Could not init idle lock!\n");
+
+        rv_soc->harts[i].halt_poll_ns = ASSIGN_MIN(HALT_POLL_NS_START, HALT_POLL_NS_MAX);
+    }
+
+    pthread_condattr_destroy(&cond_attr);
+}
+
+void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, char *initrd_file_name, unsigned int nr_harts)
 {
     #define RESET_VEC_SIZE 10
     #define MiB 0x100000
@@ -87,12 +126,19 @@ void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, cha
     uint64_t fdt_size = 0;
     uint64_t tmp = 0;
 
-    static uint8_t __attribute__((aligned (4))) soc_from[FROM_SIZE_BYTES] = { 0 };
-    static uint8_t __attribute__((aligned (4))) soc_mrom[MROM_SIZE_BYTES] = { 0 };
-    static uint8_t __attribute__((aligned (4))) soc_ram[RAM_SIZE_BYTES] = { 0 };
+    /* 8 byte AMOs are done with host atomics, see rv_core_amo(), and a snapshot
+     * can only be mapped over the memories if they start on a host page
+     */
+    static uint8_t __attribute__((aligned (SNAPSHOT_MEM_ALIGN))) soc_from[FROM_SIZE_BYTES] = { 0 };
+    static uint8_t __attribute__((aligned (SNAPSHOT_MEM_ALIGN))) soc_mrom[MROM_SIZE_BYTES] = { 0 };
+    static uint8_t __attribute__((aligned (SNAPSHOT_MEM_ALIGN))) soc_ram[RAM_SIZE_BYTES] = { 0 };
+
+    if( (nr_harts == 0) || (nr_harts > RV_MAX_HARTS) )
+        die_msg("Number of harts has to be between 1 and %d!\n", RV_MAX_HARTS);
 
     /* Init everything to zero */
     memset(rv_soc, 0, sizeof(rv_soc_td));
+    rv_soc->nr_harts = nr_harts;
     rv_soc->from = soc_from;
     rv_soc->mrom = soc_mrom;
     rv_soc->ram = soc_ram;
@@ -114,7 +160,9 @@ void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, cha
         write_mem_from_file(dtb_file_name, &soc_ram[tmp], RAM_SIZE_BYTES-tmp);
     }
 
-    write_mem_from_file(fw_file_name, soc_ram, sizeof(soc_ram));
+    /* there is none if the memory comes from a snapshot */
+    if(fw_file_name != NULL)
+        write_mem_from_file(fw_file_name, soc_ram, sizeof(soc_ram));
 
     if (initrd_file_name != NULL) {
         write_mem_from_file(initrd_file_name, soc_from, FROM_SIZE_BYTES);
@@ -146,55 +194,973 @@ void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, cha
         tmp_ptr[i] = reset_vec[i];
     }
 
-    /* initialize one core with a csr table */
-    rv_core_init(&rv_soc->rv_core0, rv_soc, rv_soc_bus_access);
+    /* initialize the cores with a csr table each, they all start at the reset vector */
+    for(i=0;i<nr_harts;i++)
+    {
+        rv_soc->harts[i].rv_soc = rv_soc;
+        rv_soc->harts[i].id = i;
+        rv_core_init(&rv_soc->harts[i].rv_core, i, &rv_soc->harts[i], rv_soc_bus_access, rv_soc_bus_host_ptr);
+        rv_soc->harts[i].rv_core.smp = (nr_harts > 1);
+    }
+
+    console_init(&rv_soc->console, STDOUT_FILENO, CONSOLE_FLUSH_LATENCY_NS);
 
     #ifdef USE_SIMPLE_UART
-        simple_uart_init(&rv_soc->uart);
+        simple_uart_init(&rv_soc->uart, &rv_soc->console);
     #else
-        uart_init(&rv_soc->uart8250);
+        uart_init(&rv_soc->uart8250, &rv_soc->console);
     #endif
 
+    clint_init(&rv_soc->clint, nr_harts);
+    plic_init(&rv_soc->plic, 2 * nr_harts);
+
     /* initialize ram and peripheral read write access pointers */
-    rv_soc_init_mem_access_cbs(rv_soc);
+    rv_soc_init_bus_map(rv_soc);
+
+    rv_soc_init_locks(rv_soc);
+
+    event_queue_init(&rv_soc->events);
+    event_init(&rv_soc->timer_event, rv_soc_timer_event, rv_soc);
+    event_init(&rv_soc->input_event, rv_soc_input_event, rv_soc);
+    input_log_init(&rv_soc->input_log);
+    /* initial poll of all devices */
+    event_queue_raise(&rv_soc->events);
+
+    /* there is no common cycle count the timer could follow */
+    if(nr_harts > 1)
+        rv_soc_enable_host_clock(rv_soc);
 
     DEBUG_PRINT("rv SOC initialized!\n");
 }
 
-void rv_soc_run(rv_soc_td *rv_soc, rv_uint_xlen success_pc, uint64_t num_cycles)
+#ifdef BLOCK_CACHE_SUPPORT
+    void rv_soc_enable_block_engine(rv_soc_td *rv_soc)
+    {
+        unsigned int i = 0;
+
+        for(i=0;i<rv_soc->nr_harts;i++)
+            rv_core_enable_block_engine(&rv_soc->harts[i].rv_core);
+
+        rv_soc->use_block_engine = 1;
+    }
+#endif
+
+#ifdef JIT_SUPPORT
+    void rv_soc_enable_jit(rv_soc_td *rv_soc)
+    {
+        unsigned int i = 0;
+
+        rv_soc_enable_block_engine(rv_soc);
+
+        for(i=0;i<rv_soc->nr_harts;i++)
+            rv_core_enable_jit(&rv_soc->harts[i].rv_core);
+    }
+#endif
+
+/* mtime and the time CSRs follow the host clock instead of the number of executed instructions */
+void rv_soc_enable_host_clock(rv_soc_td *rv_soc)
 {
-    uint8_t mei = 0, msi = 0, mti = 0;
+    unsigned int i = 0;
+
+    if(rv_soc->clint.host_clock)
+        return;
+
+    clint_enable_host_clock(&rv_soc->clint);
+
+    for(i=0;i<rv_soc->nr_harts;i++)
+        rv_core_set_time_source(&rv_soc->harts[i].rv_core, &rv_soc->clint, clint_read_time);
+}
+
+/* Must be called before the input thread starts, from then on input can end a WFI */
+void rv_soc_enable_host_input(rv_soc_td *rv_soc)
+{
+    rv_soc->host_input = 1;
+}
+
+/* Max. time the uart output may be held back, 0 writes it out at every device update */
+void rv_soc_set_console_latency(rv_soc_td *rv_soc, uint64_t latency_ns)
+{
+    console_flush(&rv_soc->console);
+    rv_soc->console.flush_latency_ns = latency_ns;
+}
+
+static void rv_soc_resume_hart(rv_soc_hart_td *hart, uint64_t parked_ns);
+static void rv_soc_pool_kick(rv_soc_td *rv_soc);
+
+static void rv_soc_wake_hart(rv_soc_hart_td *hart)
+{
+    rv_soc_td *rv_soc = hart->rv_soc;
+    uint64_t parked_ns = 0;
+    uint8_t parked = 0;
+
+    pthread_mutex_lock(&rv_soc->idle_lock);
+
+    parked = hart->parked;
+    if(parked)
+    {
+        __atomic_store_n(&hart->parked, 0, __ATOMIC_RELEASE);
+        parked_ns = hart->parked_ns;
+    }
+    else
+    {
+        __atomic_store_n(&hart->wakeup, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&hart->idle_cond);
+    }
+
+    pthread_mutex_unlock(&rv_soc->idle_lock);
+
+    if(parked)
+        rv_soc_resume_hart(hart, parked_ns);
+}
+
+static unsigned int rv_soc_uart_add_rx_chars(rv_soc_td *rv_soc, const uint8_t *buf, unsigned int len)
+{
+    #ifdef USE_SIMPLE_UART
+        return simple_uart_add_rx_chars(&rv_soc->uart, buf, len);
+    #else
+        return uart_add_rx_chars(&rv_soc->uart8250, buf, len);
+    #endif
+}
+
+/* Called by the input thread, returns how much of buf was taken. While recording the
+ * input only reaches the uart between two quanta, see rv_soc_pass_on_input().
+ */
+unsigned int rv_soc_add_input(rv_soc_td *rv_soc, const uint8_t *buf, unsigned int len)
+{
+    if(rv_soc->input_log.mode == input_log_recording)
+        return input_log_queue(&rv_soc->input_log, buf, len);
+
+    return rv_soc_uart_add_rx_chars(rv_soc, buf, len);
+}
+
+/* Passes on recorded or replayed input. This always happens at the same point between two quanta,
+ * so a replay sees the input at exactly the same instruction as the recorded run.
+ */
+static void rv_soc_pass_on_input(rv_soc_td *rv_soc)
+{
+    input_log_td *input_log = &rv_soc->input_log;
+    uint64_t now = rv_soc->harts[0].rv_core.curr_cycle;
+    uint8_t buf[INPUT_LOG_BUF_SIZE];
+    unsigned int len = 0;
+    unsigned int added = 0;
+
+    if(input_log->mode == input_log_off)
+        return;
+
+    while((len = input_log_due(input_log, now, buf)) != 0)
+    {
+        added = rv_soc_uart_add_rx_chars(rv_soc, buf, len);
+        input_log_consumed(input_log, now, added);
+
+        if(added)
+            event_queue_raise(&rv_soc->events);
+
+        /* the fifo is full, the rest has to wait */
+        if(added < len)
+            break;
+    }
+
+    if(input_log_next_cycle(input_log) == UINT64_MAX)
+        event_cancel(&rv_soc->events, &rv_soc->input_event);
+    else
+        event_schedule(&rv_soc->events, &rv_soc->input_event, input_log_next_cycle(input_log));
+}
+
+/* Only stops the hart at the cycle of the next replayed chunk, which is passed on right before the events run */
+static void rv_soc_input_event(void *priv)
+{
+    (void) priv;
+}
+
+/* The run only is reproducible if nothing else depends on the host's timing */
+static void rv_soc_check_input_log(rv_soc_td *rv_soc)
+{
+    if((rv_soc->nr_harts > 1) || rv_soc->clint.host_clock)
+        die_msg("Input can only be recorded or replayed with a single hart and the cycle based timer!\n");
+}
+
+void rv_soc_record_input(rv_soc_td *rv_soc, char *file_name)
+{
+    rv_soc_check_input_log(rv_soc);
+    input_log_record(&rv_soc->input_log, file_name);
+}
+
+void rv_soc_replay_input(rv_soc_td *rv_soc, char *file_name)
+{
+    uint64_t now = rv_soc->harts[0].rv_core.curr_cycle;
+
+    rv_soc_check_input_log(rv_soc);
+    input_log_replay(&rv_soc->input_log, file_name);
+
+    /* the run continues from a snapshot, the input up to now was passed on before it got taken */
+    if(now != 0)
+        input_log_skip(&rv_soc->input_log, now);
+
+    rv_soc_pass_on_input(rv_soc);
+}
+
+/* Called by the input thread after it passed new input to a peripheral */
+void rv_soc_notify_input(rv_soc_td *rv_soc)
+{
+    unsigned int i = 0;
+
+    event_queue_raise(&rv_soc->events);
+
+    /* an idle worker updates the devices, which wakes the hart the interrupt is routed to */
+    if(rv_soc->nr_workers)
+    {
+        rv_soc_pool_kick(rv_soc);
+        return;
+    }
+
+    /* whichever hart runs first passes the interrupt on to the one it is routed to */
+    for(i=0;i<rv_soc->nr_harts;i++)
+        rv_soc_wake_hart(&rv_soc->harts[i]);
+}
+
+/* Same as KVM's halt polling: the poll window grows as long as a wakeup comes
+ * shortly after the hart went idle and shrinks again if the hart slept for long.
+ */
+static void rv_soc_halt_poll_adjust(rv_soc_hart_td *hart, uint64_t block_ns, uint8_t event)
+{
+    if(block_ns <= hart->halt_poll_ns)
+        return;
+
+    if(block_ns > HALT_POLL_NS_MAX)
+    {
+        hart->halt_poll_ns /= 2;
+        if(hart->halt_poll_ns < HALT_POLL_NS_START)
+            hart->halt_poll_ns = 0;
+    }
+    else if(event)
+    {
+        hart->halt_poll_ns = hart->halt_poll_ns ? (hart->halt_poll_ns * 2) : HALT_POLL_NS_START;
+        hart->halt_poll_ns = ASSIGN_MIN(hart->halt_poll_ns, HALT_POLL_NS_MAX);
+    }
+}
+
+/* Waits until the hart gets woken up or the timeout (UINT64_MAX means none) expired, returns the time it took */
+static uint64_t rv_soc_wait_for_wakeup(rv_soc_hart_td *hart, uint64_t timeout_ns)
+{
+    rv_soc_td *rv_soc = hart->rv_soc;
+    uint64_t start = host_clock_ns();
+    uint64_t now = start;
+    uint64_t poll_ns = ASSIGN_MIN(hart->halt_poll_ns, timeout_ns);
+    uint64_t deadline = 0;
+    struct timespec abstime;
+    uint8_t event = 0;
+
+    /* a wakeup within the poll window is picked up without going to sleep */
+    while( ((now - start) < poll_ns) && !__atomic_load_n(&hart->wakeup, __ATOMIC_ACQUIRE) )
+        now = host_clock_ns();
+
+    deadline = (timeout_ns > (UINT64_MAX - start)) ? UINT64_MAX : (start + timeout_ns);
+    abstime.tv_sec = deadline / HOST_CLOCK_NS_PER_SEC;
+    abstime.tv_nsec = deadline % HOST_CLOCK_NS_PER_SEC;
+
+    pthread_mutex_lock(&rv_soc->idle_lock);
+
+    while(!hart->wakeup)
+    {
+        if(deadline == UINT64_MAX)
+            pthread_cond_wait(&hart->idle_cond, &rv_soc->idle_lock);
+        else if(pthread_cond_timedwait(&hart->idle_cond, &rv_soc->idle_lock, &abstime) == ETIMEDOUT)
+            break;
+    }
+
+    event = hart->wakeup;
+    hart->wakeup = 0;
+
+    pthread_mutex_unlock(&rv_soc->idle_lock);
+
+    now = host_clock_ns();
+    rv_soc_halt_poll_adjust(hart, now - start, event);
+
+    return now - start;
+}
+
+/* Lets the time pass while the hart waits in WFI and returns the number of ticks which went by.
+ * If nothing but device events can end the wait the time just jumps to the next one, unless mtime
+ * follows the host clock. Otherwise the emulator sleeps until either the hart gets woken up, e.g. by
+ * input or another hart, or the timer expires.
+ */
+static uint64_t rv_soc_wait_for_interrupt(rv_soc_hart_td *hart, uint64_t max_cycles)
+{
+    rv_soc_td *rv_soc = hart->rv_soc;
+    rv_core_td *rv_core = &hart->rv_core;
+    clint_td *clint = &rv_soc->clint;
+    rv_uint_xlen ie = *rv_core->trap.m.regs[trap_reg_ie];
+    uint8_t input_wakeup = rv_soc->host_input && (CHECK_BIT(ie, trap_cause_machine_exti) || CHECK_BIT(ie, trap_cause_super_exti));
+    uint64_t next_event = event_queue_next(&rv_soc->events);
+    uint64_t ticks = UINT64_MAX;
+    uint64_t timeout_ns = UINT64_MAX;
+    uint64_t elapsed_ns = 0;
+
+    /* other harts can send IPIs or take over the devices at any time */
+    if(rv_soc->nr_harts > 1)
+        input_wakeup = 1;
+
+    if(clint->host_clock)
+    {
+        if(CHECK_BIT(ie, trap_cause_machine_ti))
+            timeout_ns = clint_ns_until_deadline(clint, hart->id);
+    }
+    else
+    {
+        if(next_event != UINT64_MAX)
+            ticks = (next_event > rv_core->curr_cycle) ? (next_event - rv_core->curr_cycle) : 0;
+
+        ticks = ASSIGN_MIN(ticks, max_cycles);
+
+        /* the timer keeps running in host time while waiting for input */
+        if(input_wakeup)
+            timeout_ns = host_clock_ticks_to_ns(ticks, CLINT_TIMEBASE_FREQ);
+    }
+
+    if( input_wakeup || (clint->host_clock && (timeout_ns != UINT64_MAX)) )
+    {
+        /* whatever was printed before going to sleep should show up now */
+        pthread_mutex_lock(&rv_soc->device_lock);
+        console_flush(&rv_soc->console);
+        pthread_mutex_unlock(&rv_soc->device_lock);
+
+        elapsed_ns = rv_soc_wait_for_wakeup(hart, timeout_ns);
+        ticks = ASSIGN_MIN(ticks, host_clock_ns_to_ticks(elapsed_ns, CLINT_TIMEBASE_FREQ));
+
+        if(clint->host_clock)
+        {
+            pthread_mutex_lock(&rv_soc->device_lock);
+            clint_check_deadline(clint);
+            pthread_mutex_unlock(&rv_soc->device_lock);
+        }
+
+        event_queue_raise(&rv_soc->events);
+    }
+    else if(ticks == UINT64_MAX)
+    {
+        /* Nothing will ever end the wait, let the time pass tick by tick as before */
+        ticks = 1;
+    }
+
+    rv_core_idle(rv_core, ticks);
+
+    return ticks;
+}
+
+/* Brings mtime up to the current cycle and plans the next timer event. With several harts there is
+ * no common cycle count, mtime follows the host clock and every hart polls its own timer instead.
+ */
+static void rv_soc_update_timer(rv_soc_td *rv_soc)
+{
+    uint64_t now = rv_soc->harts[0].rv_core.curr_cycle;
+    uint64_t ticks = 0;
+
+    if(rv_soc->nr_harts > 1)
+        return;
+
+    clint_update(&rv_soc->clint, now - rv_soc->devices_cycle);
+    clint_get_irqs(&rv_soc->clint, 0, &rv_soc->harts[0].msi, &rv_soc->harts[0].mti);
+    rv_soc->devices_cycle = now;
+
+    ticks = clint_ticks_until_update(&rv_soc->clint);
+    if(ticks == UINT64_MAX)
+        event_cancel(&rv_soc->events, &rv_soc->timer_event);
+    else
+        event_schedule(&rv_soc->events, &rv_soc->timer_event, now + ticks);
+}
+
+static void rv_soc_timer_event(void *priv)
+{
+    rv_soc_td *rv_soc = priv;
+
+    pthread_mutex_lock(&rv_soc->device_lock);
+    rv_soc_update_timer(rv_soc);
+    pthread_mutex_unlock(&rv_soc->device_lock);
+}
+
+/* Has to be called with the device lock held. Harts whose interrupt lines changed, or whose
+ * timer or software interrupt got written, are woken up if they wait in WFI. curr_hart is NULL
+ * if an idle worker of the pool does the update.
+ */
+static void rv_soc_update_devices(rv_soc_td *rv_soc, rv_soc_hart_td *curr_hart)
+{
+    rv_soc_hart_td *hart = NULL;
     uint8_t uart_irq_pending = 0;
+    uint8_t mei = 0;
+    uint8_t changed = 0;
+    unsigned int i = 0;
 
-    rv_core_reg_dump(&rv_soc->rv_core0);
+    #ifdef USE_SIMPLE_UART
+        uart_irq_pending = simple_uart_update(&rv_soc->uart);
+    #else
+        uart_irq_pending = uart_update(&rv_soc->uart8250);
+    #endif
 
-    while(1)
+    /* update interrupt controllers, both contexts of a hart raise its external interrupt */
+    plic_update_pending(&rv_soc->plic, 10, uart_irq_pending);
+
+    for(i=0;i<rv_soc->nr_harts;i++)
+    {
+        hart = &rv_soc->harts[i];
+        mei = plic_update(&rv_soc->plic, 2*i) | plic_update(&rv_soc->plic, 2*i + 1);
+        changed = (mei != hart->mei) | clint_take_changed(&rv_soc->clint, i);
+
+        __atomic_store_n(&hart->mei, mei, __ATOMIC_RELAXED);
+
+        if(changed && (hart != curr_hart))
+            rv_soc_wake_hart(hart);
+    }
+
+    rv_soc_update_timer(rv_soc);
+}
+
+/* Runs the hart for up to max_cycles cycles, or less if a device event becomes due, the hart traps,
+ * reaches stop_pc, or does something which might need the attention of the devices or interrupt handling.
+ * Afterwards the devices and interrupts are brought up to date.
+ *
+ * Devices are not polled after every instruction. They are only looked at when one of their events is due,
+ * or if something raised the check flag: accesses to a device, or input coming from the host.
+ * With several harts this runs on the thread of each hart, whichever sees the check flag first updates the devices.
+ */
+static void rv_soc_run_quantum(rv_soc_hart_td *hart, uint64_t max_cycles, rv_uint_xlen stop_pc)
+{
+    rv_soc_td *rv_soc = hart->rv_soc;
+    rv_core_td *rv_core = &hart->rv_core;
+    uint64_t next_event = event_queue_next(&rv_soc->events);
+    uint64_t max_instr = ASSIGN_MIN(max_cycles, RUN_QUANTUM);
+
+    if(rv_core->wfi)
+    {
+        /* on a worker pool the hart gets parked instead, see rv_soc_run_slice() */
+        if(rv_soc->nr_workers == 0)
+            rv_soc_wait_for_interrupt(hart, max_cycles);
+    }
+    else
     {
-        rv_core_run(&rv_soc->rv_core0);
+        /* run until the next event is due */
+        if(next_event > rv_core->curr_cycle)
+            max_instr = ASSIGN_MIN(max_instr, next_event - rv_core->curr_cycle);
 
-        /* update peripherals */
-        #ifdef USE_SIMPLE_UART
-            uart_irq_pending = simple_uart_update(&rv_soc->uart);
+        #ifdef RISCV_EM_DEBUG
+            /* keep the register dump after every single instruction */
+            max_instr = 1;
+        #endif
+
+        #ifdef BLOCK_CACHE_SUPPORT
+            if(rv_soc->use_block_engine)
+                rv_core_run_blocks(rv_core, max_instr, stop_pc);
+            else
+                rv_core_run_n(rv_core, max_instr, stop_pc);
         #else
-            uart_irq_pending = uart_update(&rv_soc->uart8250);
+            rv_core_run_n(rv_core, max_instr, stop_pc);
         #endif
+    }
+
+    rv_soc_pass_on_input(rv_soc);
+
+    if(event_queue_raised(&rv_soc->events) && event_queue_take(&rv_soc->events))
+    {
+        pthread_mutex_lock(&rv_soc->device_lock);
+        rv_soc_update_devices(rv_soc, hart);
+        pthread_mutex_unlock(&rv_soc->device_lock);
+    }
+
+    if(rv_soc->nr_harts > 1)
+        clint_poll_irqs(&rv_soc->clint, hart->id, &hart->msi, &hart->mti);
+    else
+        event_queue_run(&rv_soc->events, rv_core->curr_cycle);
+
+    /* a single hart is the only one touching the console, otherwise only take the lock if there is output */
+    if(console_pending(&rv_soc->console))
+    {
+        if(rv_soc->nr_harts > 1)
+        {
+            pthread_mutex_lock(&rv_soc->device_lock);
+            console_poll(&rv_soc->console);
+            pthread_mutex_unlock(&rv_soc->device_lock);
+        }
+        else
+        {
+            console_poll(&rv_soc->console);
+        }
+    }
+
+    /* update CSRs for actual interrupt processing */
+    rv_core_process_interrupts(rv_core, __atomic_load_n(&hart->mei, __ATOMIC_RELAXED), hart->mti, hart->msi);
+
+    rv_core_reg_dump(rv_core);
+}
+
+static void *rv_soc_hart_thread(void *p)
+{
+    rv_soc_hart_td *hart = p;
+
+    rv_core_reg_dump(&hart->rv_core);
+
+    /* pcs are always aligned, so this never stops early */
+    while(!__atomic_load_n(&hart->rv_soc->stop, __ATOMIC_ACQUIRE))
+        rv_soc_run_quantum(hart, UINT64_MAX, 1);
+
+    return NULL;
+}
+
+/* Returns the hart at the front of the worker's queue, NULL if it is empty */
+static rv_soc_hart_td *rv_soc_worker_pop(rv_soc_worker_td *worker)
+{
+    rv_soc_hart_td *hart = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    if(worker->count)
+    {
+        hart = &worker->rv_soc->harts[worker->queue[worker->head]];
+        worker->head = (worker->head + 1) % RV_MAX_HARTS;
+        worker->count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return hart;
+}
+
+/* Takes the hart at the back of another worker's queue, the one which would run last there */
+static rv_soc_hart_td *rv_soc_worker_steal(rv_soc_worker_td *worker)
+{
+    rv_soc_hart_td *hart = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    if(worker->count)
+    {
+        worker->count--;
+        hart = &worker->rv_soc->harts[worker->queue[(worker->head + worker->count) % RV_MAX_HARTS]];
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return hart;
+}
+
+/* Returns the number of harts queued on the worker now, a hart is never in more than one queue */
+static unsigned int rv_soc_worker_push(rv_soc_worker_td *worker, rv_soc_hart_td *hart)
+{
+    unsigned int count = 0;
+
+    pthread_mutex_lock(&worker->lock);
+    worker->queue[(worker->head + worker->count) % RV_MAX_HARTS] = hart->id;
+    count = ++worker->count;
+    pthread_mutex_unlock(&worker->lock);
+
+    return count;
+}
+
+static rv_soc_hart_td *rv_soc_worker_find_hart(rv_soc_worker_td *worker)
+{
+    rv_soc_td *rv_soc = worker->rv_soc;
+    rv_soc_hart_td *hart = rv_soc_worker_pop(worker);
+    unsigned int i = 0;
+
+    for(i=1;(hart == NULL) && (i<rv_soc->nr_workers);i++)
+        hart = rv_soc_worker_steal(&rv_soc->workers[(worker->id + i) % rv_soc->nr_workers]);
+
+    return hart;
+}
+
+static uint8_t rv_soc_pool_has_work(rv_soc_td *rv_soc)
+{
+    unsigned int i = 0;
+
+    if(__atomic_load_n(&rv_soc->stop, __ATOMIC_ACQUIRE) || event_queue_raised(&rv_soc->events))
+        return 1;
+
+    for(i=0;i<rv_soc->nr_workers;i++)
+    {
+        if(__atomic_load_n(&rv_soc->workers[i].count, __ATOMIC_SEQ_CST))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Wakes up an idle worker, if there is one. Idle workers announce themselves before they
+ * look for work a last time, so either they see the new work or they get signalled.
+ */
+static void rv_soc_pool_kick(rv_soc_td *rv_soc)
+{
+    if(__atomic_load_n(&rv_soc->idle_workers, __ATOMIC_SEQ_CST) == 0)
+        return;
 
-        /* update interrupt controllers */
-        plic_update_pending(&rv_soc->plic, 10, uart_irq_pending);
-        mei = plic_update(&rv_soc->plic);
+    pthread_mutex_lock(&rv_soc->idle_lock);
+    pthread_cond_signal(&rv_soc->pool_cond);
+    pthread_mutex_unlock(&rv_soc->idle_lock);
+}
 
-        /* Feed clint and update internall states */    
-        clint_update(&rv_soc->clint, &msi, &mti);
+/* Puts a parked hart back on the queue of the worker it ran on the last time */
+static void rv_soc_resume_hart(rv_soc_hart_td *hart, uint64_t parked_ns)
+{
+    rv_soc_td *rv_soc = hart->rv_soc;
+
+    /* the hart is not on any queue, nobody else touches it now */
+    rv_core_idle(&hart->rv_core, host_clock_ns_to_ticks(host_clock_ns() - parked_ns, CLINT_TIMEBASE_FREQ));
+    rv_soc_worker_push(&rv_soc->workers[hart->worker], hart);
+    rv_soc_pool_kick(rv_soc);
+}
+
+/* Takes a hart in WFI off the run queues, returns 0 if it got woken up in the meantime */
+static uint8_t rv_soc_park_hart(rv_soc_hart_td *hart)
+{
+    rv_soc_td *rv_soc = hart->rv_soc;
+    uint8_t parked = 0;
+
+    pthread_mutex_lock(&rv_soc->idle_lock);
+
+    if(!hart->wakeup)
+    {
+        hart->parked_ns = host_clock_ns();
+        __atomic_store_n(&hart->parked, 1, __ATOMIC_RELEASE);
+        parked = 1;
+    }
 
-        /* update CSRs for actual interrupt processing */
-        rv_core_process_interrupts(&rv_soc->rv_core0, mei, mti, msi);
+    hart->wakeup = 0;
+
+    pthread_mutex_unlock(&rv_soc->idle_lock);
+
+    return parked;
+}
+
+static uint8_t rv_soc_hart_timer_enabled(rv_soc_hart_td *hart)
+{
+    return CHECK_BIT(*hart->rv_core.trap.m.regs[trap_reg_ie], trap_cause_machine_ti) ? 1 : 0;
+}
+
+/* Wakes up parked harts whose timer expired, returns the time until the next one expires */
+static uint64_t rv_soc_pool_check_timers(rv_soc_td *rv_soc)
+{
+    rv_soc_hart_td *hart = NULL;
+    uint64_t next_ns = UINT64_MAX;
+    uint64_t ns = 0;
+    unsigned int i = 0;
+
+    for(i=0;i<rv_soc->nr_harts;i++)
+    {
+        hart = &rv_soc->harts[i];
+        if(!__atomic_load_n(&hart->parked, __ATOMIC_ACQUIRE) || !rv_soc_hart_timer_enabled(hart))
+            continue;
+
+        ns = clint_ns_until_deadline(&rv_soc->clint, i);
+        if(ns == 0)
+            rv_soc_wake_hart(hart);
+        else
+            next_ns = ASSIGN_MIN(next_ns, ns);
+    }
+
+    return next_ns;
+}
+
+static void rv_soc_pool_stop(rv_soc_td *rv_soc)
+{
+    pthread_mutex_lock(&rv_soc->idle_lock);
+    __atomic_store_n(&rv_soc->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&rv_soc->pool_cond);
+    pthread_mutex_unlock(&rv_soc->idle_lock);
+}
+
+/* Runs the hart for one time slice, afterwards it is either queued again or parked if it waits in WFI */
+static void rv_soc_run_slice(rv_soc_worker_td *worker, rv_soc_hart_td *hart)
+{
+    rv_soc_td *rv_soc = worker->rv_soc;
+    rv_core_td *rv_core = &hart->rv_core;
+    rv_uint_xlen stop_pc = (hart->id == 0) ? rv_soc->success_pc : 1;
+    uint64_t slice_end = rv_core->curr_cycle + HART_TIME_SLICE;
+    uint64_t max_cycles = UINT64_MAX;
+
+    hart->worker = worker->id;
+
+    while(rv_core->curr_cycle < slice_end)
+    {
+        if((hart->id == 0) && (rv_soc->num_cycles != 0))
+            max_cycles = rv_soc->num_cycles - rv_core->curr_cycle;
+
+        rv_soc_run_quantum(hart, max_cycles, stop_pc);
+
+        /* hart 0 decides when the run ends, the same way as without the pool */
+        if( (hart->id == 0) &&
+            ((rv_core->pc == rv_soc->success_pc) || ((rv_soc->num_cycles != 0) && (rv_core->curr_cycle >= rv_soc->num_cycles))) )
+        {
+            rv_soc_pool_stop(rv_soc);
+            return;
+        }
+
+        if(rv_core->wfi)
+        {
+            pthread_mutex_lock(&rv_soc->device_lock);
+            console_flush(&rv_soc->console);
+            pthread_mutex_unlock(&rv_soc->device_lock);
+
+            if(rv_soc_park_hart(hart))
+                return;
+        }
+
+        if(__atomic_load_n(&rv_soc->stop, __ATOMIC_ACQUIRE))
+            return;
+    }
+
+    /* there is more to do than this worker can run, let the idle ones steal */
+    if(rv_soc_worker_push(worker, hart) > 1)
+        rv_soc_pool_kick(rv_soc);
+}
+
+static void rv_soc_worker_idle(rv_soc_worker_td *worker)
+{
+    rv_soc_td *rv_soc = worker->rv_soc;
+    uint64_t timeout_ns = rv_soc_pool_check_timers(rv_soc);
+    uint64_t deadline = 0;
+    struct timespec abstime;
 
-        rv_core_reg_dump(&rv_soc->rv_core0);
+    pthread_mutex_lock(&rv_soc->device_lock);
+    console_flush(&rv_soc->console);
+    pthread_mutex_unlock(&rv_soc->device_lock);
 
-        if(rv_soc->rv_core0.pc == success_pc)
+    pthread_mutex_lock(&rv_soc->idle_lock);
+    __atomic_add_fetch(&rv_soc->idle_workers, 1, __ATOMIC_SEQ_CST);
+
+    if(!rv_soc_pool_has_work(rv_soc))
+    {
+        if(timeout_ns == UINT64_MAX)
+        {
+            pthread_cond_wait(&rv_soc->pool_cond, &rv_soc->idle_lock);
+        }
+        else
+        {
+            deadline = host_clock_ns() + timeout_ns;
+            abstime.tv_sec = deadline / HOST_CLOCK_NS_PER_SEC;
+            abstime.tv_nsec = deadline % HOST_CLOCK_NS_PER_SEC;
+            pthread_cond_timedwait(&rv_soc->pool_cond, &rv_soc->idle_lock, &abstime);
+        }
+    }
+
+    __atomic_sub_fetch(&rv_soc->idle_workers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&rv_soc->idle_lock);
+}
+
+static void rv_soc_worker_loop(rv_soc_worker_td *worker)
+{
+    rv_soc_td *rv_soc = worker->rv_soc;
+    rv_soc_hart_td *hart = NULL;
+
+    while(!__atomic_load_n(&rv_soc->stop, __ATOMIC_ACQUIRE))
+    {
+        hart = rv_soc_worker_find_hart(worker);
+        if(hart != NULL)
+        {
+            rv_soc_run_slice(worker, hart);
+            rv_soc_pool_check_timers(rv_soc);
+        }
+        else if(event_queue_raised(&rv_soc->events) && event_queue_take(&rv_soc->events))
+        {
+            /* e.g. input came in while all harts are parked */
+            pthread_mutex_lock(&rv_soc->device_lock);
+            rv_soc_update_devices(rv_soc, NULL);
+            pthread_mutex_unlock(&rv_soc->device_lock);
+        }
+        else
+        {
+            rv_soc_worker_idle(worker);
+        }
+    }
+}
+
+static void *rv_soc_worker_thread(void *p)
+{
+    rv_soc_worker_loop(p);
+
+    return NULL;
+}
+
+/* Lets the harts share nr_workers host threads instead of having one each, 0 goes back to the latter */
+void rv_soc_set_workers(rv_soc_td *rv_soc, unsigned int nr_workers)
+{
+    pthread_condattr_t cond_attr;
+    rv_soc_worker_td *worker = NULL;
+    unsigned int i = 0;
+
+    if(nr_workers > RV_MAX_HARTS)
+        die_msg("Number of workers has to be between 0 and %d!\n", RV_MAX_HARTS);
+
+    /* a single hart always runs on the calling thread */
+    if(rv_soc->nr_harts == 1)
+        nr_workers = 0;
+
+    rv_soc->nr_workers = nr_workers;
+    if(nr_workers == 0)
+        return;
+
+    if( (pthread_condattr_init(&cond_attr) != 0) ||
+        (pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) != 0) ||
+        (pthread_cond_init(&rv_soc->pool_cond, &cond_attr) != 0) )
+        die_msg("Could not init worker pool!\n");
+
+    pthread_condattr_destroy(&cond_attr);
+
+    for(i=0;i<nr_workers;i++)
+    {
+        worker = &rv_soc->workers[i];
+        worker->rv_soc = rv_soc;
+        worker->id = i;
+        if(pthread_mutex_init(&worker->lock, NULL) != 0)
+            die_msg("Could not init worker pool!\n");
+    }
+
+    /* spread the harts over the workers, they get rebalanced by stealing anyway */
+    for(i=0;i<rv_soc->nr_harts;i++)
+    {
+        rv_soc->harts[i].worker = i % nr_workers;
+        rv_soc_worker_push(&rv_soc->workers[i % nr_workers], &rv_soc->harts[i]);
+    }
+}
+
+/* The calling thread is worker 0, the run ends once hart 0 reaches success_pc or num_cycles */
+static void rv_soc_run_pool(rv_soc_td *rv_soc, rv_uint_xlen success_pc, uint64_t num_cycles)
+{
+    unsigned int i = 0;
+
+    rv_soc->success_pc = success_pc;
+    rv_soc->num_cycles = num_cycles;
+
+    for(i=1;i<rv_soc->nr_workers;i++)
+    {
+        if(pthread_create(&rv_soc->workers[i].thread, NULL, rv_soc_worker_thread, &rv_soc->workers[i]) != 0)
+            die_msg("Could not start worker thread %d!\n", i);
+    }
+
+    rv_soc_worker_loop(&rv_soc->workers[0]);
+
+    /* the run might also have been ended by rv_soc_request_stop() */
+    rv_soc_pool_stop(rv_soc);
+    for(i=1;i<rv_soc->nr_workers;i++)
+        pthread_join(rv_soc->workers[i].thread, NULL);
+
+    pthread_mutex_lock(&rv_soc->device_lock);
+    console_flush(&rv_soc->console);
+    pthread_mutex_unlock(&rv_soc->device_lock);
+}
+
+/* Makes the run end after the current quantum of hart 0, this may be called from a signal handler */
+void rv_soc_request_stop(rv_soc_td *rv_soc)
+{
+    __atomic_store_n(&rv_soc->stop, 1, __ATOMIC_RELEASE);
+}
+
+/* Hart 0 runs on the calling thread and decides when the run ends, all others get their own thread.
+ * They have all stopped once this returns.
+ */
+void rv_soc_run(rv_soc_td *rv_soc, rv_uint_xlen success_pc, uint64_t num_cycles)
+{
+    rv_soc_hart_td *hart = &rv_soc->harts[0];
+    rv_core_td *rv_core = &hart->rv_core;
+    uint64_t max_cycles = UINT64_MAX;
+    unsigned int i = 0;
+
+    rv_core_reg_dump(rv_core);
+
+    if(rv_soc->nr_workers)
+    {
+        rv_soc_run_pool(rv_soc, success_pc, num_cycles);
+        return;
+    }
+
+    for(i=1;i<rv_soc->nr_harts;i++)
+    {
+        if(pthread_create(&rv_soc->harts[i].thread, NULL, rv_soc_hart_thread, &rv_soc->harts[i]) != 0)
+            die_msg("Could not start thread of hart %d!\n", i);
+    }
+
+    while(1)
+    {
+        if(num_cycles != 0)
+            max_cycles = num_cycles - rv_core->curr_cycle;
+
+        rv_soc_run_quantum(hart, max_cycles, success_pc);
+
+        if(rv_core->pc == success_pc)
             break;
 
-        if((num_cycles != 0) && (rv_soc->rv_core0.curr_cycle >= num_cycles))
+        if((num_cycles != 0) && (rv_core->curr_cycle >= num_cycles))
             break;
+
+        if(__atomic_load_n(&rv_soc->stop, __ATOMIC_ACQUIRE))
+            break;
+    }
+
+    /* harts waiting in WFI see the stop flag once they got woken up */
+    __atomic_store_n(&rv_soc->stop, 1, __ATOMIC_RELEASE);
+    for(i=1;i<rv_soc->nr_harts;i++)
+    {
+        rv_soc_wake_hart(&rv_soc->harts[i]);
+        pthread_join(rv_soc->harts[i].thread, NULL);
+    }
+
+    pthread_mutex_lock(&rv_soc->device_lock);
+    console_flush(&rv_soc->console);
+    pthread_mutex_unlock(&rv_soc->device_lock);
+}
+
+/* Walks through the state of the whole machine, the harts must not be running */
+static void rv_soc_snapshot(rv_soc_td *rv_soc, snapshot_td *snapshot)
+{
+    uint32_t xlen = XLEN;
+    unsigned int nr_harts = rv_soc->nr_harts;
+    unsigned int i = 0;
+
+    SNAPSHOT_FIELD(snapshot, xlen);
+    if(xlen != XLEN)
+        die_msg("Snapshot %s was taken on RV%u!\n", snapshot->file_name, xlen);
+
+    SNAPSHOT_FIELD(snapshot, nr_harts);
+    if(nr_harts != rv_soc->nr_harts)
+        die_msg("Snapshot %s was taken with %u harts!\n", snapshot->file_name, nr_harts);
+
+    for(i=0;i<nr_harts;i++)
+    {
+        rv_core_snapshot(&rv_soc->harts[i].rv_core, snapshot);
+        SNAPSHOT_FIELD(snapshot, rv_soc->harts[i].mei);
+        SNAPSHOT_FIELD(snapshot, rv_soc->harts[i].mti);
+        SNAPSHOT_FIELD(snapshot, rv_soc->harts[i].msi);
     }
+
+    SNAPSHOT_FIELD(snapshot, rv_soc->devices_cycle);
+    clint_snapshot(&rv_soc->clint, snapshot);
+    plic_snapshot(&rv_soc->plic, snapshot);
+
+    #ifdef USE_SIMPLE_UART
+        simple_uart_snapshot(&rv_soc->uart, snapshot);
+    #else
+        uart_snapshot(&rv_soc->uart8250, snapshot);
+    #endif
+
+    snapshot_memory(snapshot, rv_soc->mrom, MROM_SIZE_BYTES);
+    snapshot_memory(snapshot, rv_soc->ram, RAM_SIZE_BYTES);
+    snapshot_memory(snapshot, rv_soc->from, FROM_SIZE_BYTES);
+}
+
+/* Has to be called after rv_soc_run() returned */
+void rv_soc_save_snapshot(rv_soc_td *rv_soc, char *file_name)
+{
+    snapshot_td snapshot;
+
+    snapshot_open(&snapshot, file_name, 0);
+    rv_soc_snapshot(rv_soc, &snapshot);
+    snapshot_close(&snapshot);
+}
+
+/* Has to be called before rv_soc_run() and after the timer source got chosen, the memories are mapped from the file */
+void rv_soc_load_snapshot(rv_soc_td *rv_soc, char *file_name)
+{
+    snapshot_td snapshot;
+
+    snapshot_open(&snapshot, file_name, 1);
+    rv_soc_snapshot(rv_soc, &snapshot);
+    snapshot_close(&snapshot);
+
+    pthread_mutex_lock(&rv_soc->device_lock);
+    rv_soc_update_timer(rv_soc);
+    pthread_mutex_unlock(&rv_soc->device_lock);
+
+    event_queue_raise(&rv_soc->events);
 }
@@ -1,6 +1,8 @@
 #ifndef RISCV_EXAMPLE_SOC_H
 #define RISCV_EXAMPLE_SOC_H
 
+#include <pthread.h>
+
 #include <riscv_types.h>
 #include <core.h>
 
@@ -8,19 +10,65 @@
 #include <uart_8250.h>
 #include <simple_uart.h>
 
-typedef struct rv_soc_mem_access_cb_struct
+#include <bus_map.h>
+#include <event_queue.h>
+#include <input_log.h>
+#include <console.h>
+
+typedef struct rv_soc_struct rv_soc_td;
+
+/* One hart of the SoC, if there is more than one each of them runs on its own host thread
+ * unless they share a pool of workers.
+ */
+typedef struct rv_soc_hart_struct
+{
+    rv_core_td rv_core;
+    rv_soc_td *rv_soc;
+    unsigned int id;
+    pthread_t thread;
+
+    /* Interrupt lines as seen after the last device update. With several harts mei is set
+     * by whichever hart updated the devices, msi and mti are polled by the hart itself.
+     */
+    uint8_t mei;
+    uint8_t mti;
+    uint8_t msi;
+
+    /* A hart in WFI sleeps on the host until it gets woken up, see rv_soc_wait_for_interrupt() */
+    pthread_cond_t idle_cond;
+    uint8_t wakeup;
+    uint64_t halt_poll_ns;
+
+    /* On a worker pool a hart in WFI is taken off the run queues instead, see rv_soc_park_hart() */
+    uint8_t parked;
+    uint64_t parked_ns;
+    /* worker which ran the hart the last time, it gets queued there again when woken up */
+    unsigned int worker;
+
+} rv_soc_hart_td;
+
+/* A worker thread of the pool, it runs the harts of its queue in time slices of HART_TIME_SLICE
+ * instructions. Workers which run out of harts steal from the others.
+ */
+typedef struct rv_soc_worker_struct
 {
-    bus_access_func bus_access;
-    void *priv;
-    rv_uint_xlen addr_start;
-    rv_uint_xlen mem_size;
+    rv_soc_td *rv_soc;
+    unsigned int id;
+    pthread_t thread;
+
+    /* run queue of hart ids, the owner takes from the front and thieves from the back */
+    pthread_mutex_t lock;
+    unsigned int queue[RV_MAX_HARTS];
+    unsigned int head;
+    unsigned int count;
 
-} rv_soc_mem_access_cb_td;
+} rv_soc_worker_td;
 
 typedef struct rv_soc_struct
 {
-    /* For now we have 1 single core */
-    rv_core_td rv_core0;
+    rv_soc_hart_td harts[RV_MAX_HARTS];
+    unsigned int nr_harts;
+
     uint8_t *mrom; /* Contains reset vector and device-tree? */
     uint8_t *ram;
     uint8_t *from; /* Contains filesystem */
@@ -34,12 +82,66 @@ typedef struct rv_soc_struct
         uart_ns8250_td uart8250;
     #endif
 
-    rv_soc_mem_access_cb_td mem_access_cbs[6];
+    /* buffered host output of the uart */
+    console_td console;
+
+    /* physical address space, further devices can be added with bus_map_add_device() */
+    bus_map_td bus_map;
+
+    #ifdef BLOCK_CACHE_SUPPORT
+        uint8_t use_block_engine;
+    #endif
+
+    /* The devices, the console and the event queue are shared by all harts,
+     * they are only touched while holding the device lock.
+     */
+    pthread_mutex_t device_lock;
+
+    /* device events, ordered by cycle, only used with a single hart */
+    event_queue_td events;
+    event_td timer_event;
+    /* cycle at which the timer was brought up to date the last time */
+    uint64_t devices_cycle;
+
+    /* protects the wakeup and parked flags of the harts */
+    pthread_mutex_t idle_lock;
+    uint8_t host_input;
+
+    /* recorded or replayed input, the event makes the hart stop at the cycle of the next chunk */
+    input_log_td input_log;
+    event_td input_event;
+
+    /* worker pool, not used if nr_workers is 0 */
+    rv_soc_worker_td workers[RV_MAX_HARTS];
+    unsigned int nr_workers;
+    unsigned int idle_workers;
+    pthread_cond_t pool_cond;
+    /* set once the run ends, the other harts or workers then stop as well */
+    uint8_t stop;
+    rv_uint_xlen success_pc;
+    uint64_t num_cycles;
 
 } rv_soc_td;
 
 void rv_soc_dump_mem(rv_soc_td *rv_soc);
-void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, char *initrd_file_name);
+void rv_soc_init(rv_soc_td *rv_soc, char *fw_file_name, char *dtb_file_name, char *initrd_file_name, unsigned int nr_harts);
+#ifdef BLOCK_CACHE_SUPPORT
+    void rv_soc_enable_block_engine(rv_soc_td *rv_soc);
+#endif
+#ifdef JIT_SUPPORT
+    void rv_soc_enable_jit(rv_soc_td *rv_soc);
+#endif
+void rv_soc_enable_host_clock(rv_soc_td *rv_soc);
+void rv_soc_enable_host_input(rv_soc_td *rv_soc);
+void rv_soc_set_console_latency(rv_soc_td *rv_soc, uint64_t latency_ns);
+void rv_soc_notify_input(rv_soc_td *rv_soc);
+unsigned int rv_soc_add_input(rv_soc_td *rv_soc, const uint8_t *buf, unsigned int len);
+void rv_soc_record_input(rv_soc_td *rv_soc, char *file_name);
+void rv_soc_replay_input(rv_soc_td *rv_soc, char *file_name);
+void rv_soc_set_workers(rv_soc_td *rv_soc, unsigned int nr_workers);
 void rv_soc_run(rv_soc_td *rv_soc, rv_uint_xlen success_pc, uint64_t num_cycles);
+void rv_soc_request_stop(rv_soc_td *rv_soc);
+void rv_soc_save_snapshot(rv_soc_td *rv_soc, char *file_name);
+void rv_soc_load_snapshot(rv_soc_td *rv_soc, char *file_name);
 
 #endif /* RISCV_EXAMPLE_SOC_H */
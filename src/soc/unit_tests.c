@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <event_queue.h>
+#include <bus_map.h>
+#include <input_log.h>
+#include <riscv_helper.h>
+
+#include <unity.h>
+
+#define TEST_NR_EVENTS 8
+
+static event_queue_td event_queue_test = {0};
+static bus_map_td bus_map_test = {0};
+static uint8_t test_mem[0x3000] = {0};
+static input_log_td input_log_test = {0};
+static char input_log_file[] = "/tmp/riscv_em_input_log_XXXXXX";
+static int input_log_file_created = 0;
+static event_td events_test[TEST_NR_EVENTS];
+
+/* ids of the events in the order their callbacks ran */
+static unsigned int events_run[4 * TEST_NR_EVENTS];
+static unsigned int nr_events_run = 0;
+
+static void event_test_cb(void *priv)
+{
+    event_td *event = priv;
+
+    events_run[nr_events_run++] = event - events_test;
+}
+
+/* Returns 1 if func makes the emulator give up */
+static int test_child_dies(void (*func)(void))
+{
+    int status = 0;
+    pid_t pid = 0;
+
+    /* the child must not write out what is still buffered */
+    fflush(stdout);
+    pid = fork();
+
+    if(pid == 0)
+    {
+        if(freopen("/dev/null", "w", stdout) == NULL)
+            _exit(0);
+
+        func();
+        _exit(0);
+    }
+
+    if( (pid < 0) || (waitpid(pid, &status, 0) != pid) )
+        return 0;
+
+    return WIFEXITED(status) && (WEXITSTATUS(status) != 0);
+}
+
+/* every parent is due before its children and every event knows where it is */
+static void event_queue_check_heap(event_queue_td *event_queue)
+{
+    unsigned int i = 0;
+
+    for(i=0;i<event_queue->nr_events;i++)
+    {
+        TEST_ASSERT_EQUAL(i, event_queue->heap[i]->heap_index);
+        if(i > 0)
+            TEST_ASSERT_TRUE(event_queue->heap[(i-1)/2]->when <= event_queue->heap[i]->when);
+    }
+}
+
+void setUp(void)
+{
+    unsigned int i = 0;
+
+    event_queue_init(&event_queue_test);
+    for(i=0;i<TEST_NR_EVENTS;i++)
+        event_init(&events_test[i], event_test_cb, &events_test[i]);
+
+    memset(events_run, 0, sizeof(events_run));
+    nr_events_run = 0;
+
+    bus_map_init(&bus_map_test);
+
+    input_log_init(&input_log_test);
+}
+
+void tearDown(void)
+{
+    if(input_log_test.file != NULL)
+        fclose(input_log_test.file);
+
+    if(input_log_file_created)
+        unlink(input_log_file);
+
+    input_log_file_created = 0;
+}
+
+void test_EVENT_QUEUE_order(void)
+{
+    const uint64_t when[TEST_NR_EVENTS] = { 50, 10, 80, 40, 70, 20, 60, 30 };
+    const unsigned int expected[TEST_NR_EVENTS] = { 1, 5, 7, 3, 0, 6, 4, 2 };
+    unsigned int i = 0;
+
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, event_queue_next(&event_queue_test));
+
+    for(i=0;i<TEST_NR_EVENTS;i++)
+    {
+        event_schedule(&event_queue_test, &events_test[i], when[i]);
+        event_queue_check_heap(&event_queue_test);
+    }
+    TEST_ASSERT_EQUAL_UINT64(10, event_queue_next(&event_queue_test));
+
+    /* only what is due runs */
+    event_queue_run(&event_queue_test, 35);
+    TEST_ASSERT_EQUAL(3, nr_events_run);
+    TEST_ASSERT_EQUAL_UINT64(40, event_queue_next(&event_queue_test));
+    event_queue_check_heap(&event_queue_test);
+
+    event_queue_run(&event_queue_test, 80);
+    TEST_ASSERT_EQUAL(TEST_NR_EVENTS, nr_events_run);
+    TEST_ASSERT_EQUAL(0, event_queue_test.nr_events);
+
+    for(i=0;i<TEST_NR_EVENTS;i++)
+    {
+        TEST_ASSERT_EQUAL(expected[i], events_run[i]);
+        TEST_ASSERT_EQUAL(-1, events_test[i].heap_index);
+    }
+}
+
+/* scheduling an event which is already queued moves it instead of adding it twice */
+void test_EVENT_QUEUE_reschedule(void)
+{
+    unsigned int i = 0;
+
+    for(i=0;i<TEST_NR_EVENTS;i++)
+        event_schedule(&event_queue_test, &events_test[i], (i + 1) * 10);
+
+    /* to the back, to the front and into the middle */
+    event_schedule(&event_queue_test, &events_test[0], 100);
+    event_queue_check_heap(&event_queue_test);
+    event_schedule(&event_queue_test, &events_test[7], 5);
+    event_queue_check_heap(&event_queue_test);
+    event_schedule(&event_queue_test, &events_test[1], 45);
+    event_queue_check_heap(&event_queue_test);
+
+    TEST_ASSERT_EQUAL(TEST_NR_EVENTS, event_queue_test.nr_events);
+    TEST_ASSERT_EQUAL_UINT64(5, event_queue_next(&event_queue_test));
+
+    event_queue_run(&event_queue_test, UINT64_MAX - 1);
+    TEST_ASSERT_EQUAL(TEST_NR_EVENTS, nr_events_run);
+    TEST_ASSERT_EQUAL(7, events_run[0]);
+    TEST_ASSERT_EQUAL(2, events_run[1]);
+    TEST_ASSERT_EQUAL(3, events_run[2]);
+    TEST_ASSERT_EQUAL(1, events_run[3]);
+    TEST_ASSERT_EQUAL(0, events_run[7]);
+}
+
+void test_EVENT_QUEUE_cancel(void)
+{
+    unsigned int i = 0;
+
+    for(i=0;i<TEST_NR_EVENTS;i++)
+        event_schedule(&event_queue_test, &events_test[i], (i + 1) * 10);
+
+    /* the first one, one in the middle and the last one in the heap */
+    event_cancel(&event_queue_test, &events_test[0]);
+    event_queue_check_heap(&event_queue_test);
+    event_cancel(&event_queue_test, &events_test[4]);
+    event_queue_check_heap(&event_queue_test);
+    event_cancel(&event_queue_test, event_queue_test.heap[event_queue_test.nr_events - 1]);
+    event_queue_check_heap(&event_queue_test);
+    TEST_ASSERT_EQUAL(TEST_NR_EVENTS - 3, event_queue_test.nr_events);
+    TEST_ASSERT_EQUAL(-1, events_test[0].heap_index);
+    TEST_ASSERT_EQUAL(-1, events_test[4].heap_index);
+
+    /* cancelling an event which is not queued does nothing */
+    event_cancel(&event_queue_test, &events_test[0]);
+    TEST_ASSERT_EQUAL(TEST_NR_EVENTS - 3, event_queue_test.nr_events);
+
+    TEST_ASSERT_EQUAL_UINT64(20, event_queue_next(&event_queue_test));
+    event_queue_run(&event_queue_test, UINT64_MAX - 1);
+    TEST_ASSERT_EQUAL(TEST_NR_EVENTS - 3, nr_events_run);
+    for(i=0;i<nr_events_run;i++)
+    {
+        TEST_ASSERT_TRUE(events_run[i] != 0);
+        TEST_ASSERT_TRUE(events_run[i] != 4);
+        if(i > 0)
+            TEST_ASSERT_TRUE(events_run[i-1] < events_run[i]);
+    }
+}
+
+/* The last event fills the gap, it may have to move up if the gap is in another branch of the heap */
+void test_EVENT_QUEUE_cancel_reorder(void)
+{
+    const uint64_t when[7] = { 10, 50, 20, 60, 70, 25, 30 };
+    unsigned int i = 0;
+
+    for(i=0;i<7;i++)
+        event_schedule(&event_queue_test, &events_test[i], when[i]);
+    TEST_ASSERT_EQUAL(3, events_test[3].heap_index);
+    TEST_ASSERT_EQUAL(6, events_test[6].heap_index);
+
+    event_cancel(&event_queue_test, &events_test[3]);
+    event_queue_check_heap(&event_queue_test);
+    TEST_ASSERT_EQUAL(1, events_test[6].heap_index);
+}
+
+static void event_test_periodic_cb(void *priv)
+{
+    event_td *event = priv;
+
+    event_test_cb(priv);
+    event_schedule(&event_queue_test, event, event->when + 10);
+}
+
+/* a callback may schedule its own event again, it only runs again once that is due */
+void test_EVENT_QUEUE_periodic(void)
+{
+    event_init(&events_test[0], event_test_periodic_cb, &events_test[0]);
+    event_schedule(&event_queue_test, &events_test[0], 10);
+    event_schedule(&event_queue_test, &events_test[1], 25);
+
+    event_queue_run(&event_queue_test, 35);
+    TEST_ASSERT_EQUAL(4, nr_events_run);
+    TEST_ASSERT_EQUAL(0, events_run[0]);
+    TEST_ASSERT_EQUAL(0, events_run[1]);
+    TEST_ASSERT_EQUAL(1, events_run[2]);
+    TEST_ASSERT_EQUAL(0, events_run[3]);
+    TEST_ASSERT_EQUAL_UINT64(40, event_queue_next(&event_queue_test));
+}
+
+void test_EVENT_QUEUE_raise(void)
+{
+    TEST_ASSERT_FALSE(event_queue_raised(&event_queue_test));
+
+    event_queue_raise(&event_queue_test);
+    TEST_ASSERT_TRUE(event_queue_raised(&event_queue_test));
+
+    TEST_ASSERT_TRUE(event_queue_take(&event_queue_test));
+    TEST_ASSERT_FALSE(event_queue_raised(&event_queue_test));
+    TEST_ASSERT_FALSE(event_queue_take(&event_queue_test));
+}
+
+void test_BUS_MAP_lookup(void)
+{
+    bus_map_region_td *mem_region = NULL;
+    bus_map_region_td *dev_region = NULL;
+
+    bus_map_add_memory(&bus_map_test, test_mem, 0x80000000, sizeof(test_mem));
+    bus_map_add_device(&bus_map_test, NULL, &bus_map_test, 0x10000000, 0x100);
+
+    mem_region = bus_map_lookup(&bus_map_test, 0x80001ffc, 4);
+    TEST_ASSERT_NOT_NULL(mem_region);
+    TEST_ASSERT_EQUAL_PTR(test_mem, mem_region->host_mem);
+    TEST_ASSERT_EQUAL_PTR(mem_region, bus_map_lookup(&bus_map_test, 0x80000000, 8));
+    TEST_ASSERT_EQUAL_PTR(mem_region, bus_map_lookup(&bus_map_test, 0x80002ff8, 8));
+
+    dev_region = bus_map_lookup(&bus_map_test, 0x10000004, 4);
+    TEST_ASSERT_NOT_NULL(dev_region);
+    TEST_ASSERT_NULL(dev_region->host_mem);
+    TEST_ASSERT_EQUAL_PTR(&bus_map_test, dev_region->priv);
+
+    /* the rest of the device page, accesses crossing the end and holes belong to nobody */
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x10000100, 4));
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x100000fe, 4));
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x80002ffc, 8));
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x80003000, 1));
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x0, 4));
+
+    /* regions keep their address when more are added */
+    bus_map_add_device(&bus_map_test, NULL, NULL, 0x20000000, 0x1000);
+    TEST_ASSERT_EQUAL_PTR(mem_region, bus_map_lookup(&bus_map_test, 0x80000000, 4));
+    TEST_ASSERT_EQUAL_PTR(dev_region, bus_map_lookup(&bus_map_test, 0x10000000, 4));
+}
+
+/* Small regions may share a page, only the first one is in the table and the others are found by the scan */
+void test_BUS_MAP_page_sharing(void)
+{
+    bus_map_region_td *first = NULL;
+    bus_map_region_td *second = NULL;
+
+    bus_map_add_device(&bus_map_test, NULL, NULL, 0x3000000, 0x2);
+    bus_map_add_device(&bus_map_test, NULL, NULL, 0x3000010, 0x10);
+    bus_map_add_memory(&bus_map_test, test_mem, 0x3000800, 0x800);
+
+    first = bus_map_lookup(&bus_map_test, 0x3000000, 1);
+    second = bus_map_lookup(&bus_map_test, 0x3000018, 4);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_TRUE(first != second);
+    TEST_ASSERT_EQUAL_UINT64(0x3000000, first->addr_start);
+    TEST_ASSERT_EQUAL_UINT64(0x3000010, second->addr_start);
+
+    TEST_ASSERT_EQUAL_PTR(test_mem, bus_map_lookup(&bus_map_test, 0x3000ffc, 4)->host_mem);
+
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x3000001, 2));
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x3000004, 4));
+    TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x3000020, 1));
+}
+
+#ifdef RV64
+    /* beyond the lower 4GB there is no table, the scan finds the regions */
+    void test_BUS_MAP_above_table(void)
+    {
+        bus_map_add_memory(&bus_map_test, test_mem, 0x100000000UL, sizeof(test_mem));
+
+        TEST_ASSERT_EQUAL_PTR(test_mem, bus_map_lookup(&bus_map_test, 0x100001000UL, 8)->host_mem);
+        TEST_ASSERT_NULL(bus_map_lookup(&bus_map_test, 0x100003000UL, 8));
+    }
+#endif
+
+static rv_uint_xlen bus_map_test_start = 0;
+static rv_uint_xlen bus_map_test_size = 0;
+
+static void bus_map_test_add(void)
+{
+    bus_map_add_device(&bus_map_test, NULL, NULL, bus_map_test_start, bus_map_test_size);
+}
+
+static int bus_map_test_add_dies(rv_uint_xlen addr_start, rv_uint_xlen mem_size)
+{
+    bus_map_test_start = addr_start;
+    bus_map_test_size = mem_size;
+
+    return test_child_dies(bus_map_test_add);
+}
+
+void test_BUS_MAP_overlap(void)
+{
+    bus_map_add_device(&bus_map_test, NULL, NULL, 0x3000010, 0x10);
+
+    TEST_ASSERT_TRUE(bus_map_test_add_dies(0x3000010, 0x10));
+    TEST_ASSERT_TRUE(bus_map_test_add_dies(0x3000000, 0x11));
+    TEST_ASSERT_TRUE(bus_map_test_add_dies(0x300001f, 0x1));
+    TEST_ASSERT_TRUE(bus_map_test_add_dies(0x3000000, 0x1000));
+    TEST_ASSERT_TRUE(bus_map_test_add_dies(0x3000100, 0));
+
+    /* right in front of and right behind it is fine */
+    TEST_ASSERT_FALSE(bus_map_test_add_dies(0x3000000, 0x10));
+    TEST_ASSERT_FALSE(bus_map_test_add_dies(0x3000020, 0x10));
+}
+
+/* Writes the log file with the given content, it is removed again in tearDown() */
+static char *input_log_test_file(const char *content)
+{
+    FILE *file = NULL;
+    int fd = -1;
+
+    if(!input_log_file_created)
+    {
+        strcpy(input_log_file, "/tmp/riscv_em_input_log_XXXXXX");
+        fd = mkstemp(input_log_file);
+        TEST_ASSERT_TRUE(fd >= 0);
+        close(fd);
+        input_log_file_created = 1;
+    }
+
+    file = fopen(input_log_file, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(content, file);
+    fclose(file);
+
+    return input_log_file;
+}
+
+static char *input_log_test_read(char *buf, int len)
+{
+    FILE *file = fopen(input_log_file, "r");
+    size_t nr_read = 0;
+
+    TEST_ASSERT_NOT_NULL(file);
+    nr_read = fread(buf, 1, len - 1, file);
+    buf[nr_read] = 0;
+    fclose(file);
+
+    return buf;
+}
+
+void test_INPUT_LOG_parse(void)
+{
+    uint8_t buf[INPUT_LOG_BUF_SIZE] = {0};
+
+    input_log_replay(&input_log_test, input_log_test_file("5 0aff\n7  41\n12 6c730d\n"));
+
+    TEST_ASSERT_EQUAL_UINT64(5, input_log_next_cycle(&input_log_test));
+    TEST_ASSERT_EQUAL(0, input_log_due(&input_log_test, 4, buf));
+    TEST_ASSERT_EQUAL(2, input_log_due(&input_log_test, 5, buf));
+    TEST_ASSERT_EQUAL_HEX8(0x0a, buf[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xff, buf[1]);
+
+    /* a late quantum still gets it, the log continues with the next chunk */
+    TEST_ASSERT_EQUAL(2, input_log_due(&input_log_test, 6, buf));
+    input_log_consumed(&input_log_test, 6, 2);
+    TEST_ASSERT_EQUAL_UINT64(7, input_log_next_cycle(&input_log_test));
+    TEST_ASSERT_EQUAL(1, input_log_due(&input_log_test, 7, buf));
+    TEST_ASSERT_EQUAL_HEX8(0x41, buf[0]);
+    input_log_consumed(&input_log_test, 7, 1);
+
+    TEST_ASSERT_EQUAL(3, input_log_due(&input_log_test, 12, buf));
+    TEST_ASSERT_EQUAL_HEX8(0x6c, buf[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x73, buf[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x0d, buf[2]);
+    input_log_consumed(&input_log_test, 12, 3);
+
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, input_log_next_cycle(&input_log_test));
+    TEST_ASSERT_EQUAL(0, input_log_due(&input_log_test, UINT64_MAX, buf));
+}
+
+/* A restored snapshot continues the log after the chunks which were already passed on */
+void test_INPUT_LOG_skip(void)
+{
+    input_log_replay(&input_log_test, input_log_test_file("5 0a\n7 0b\n12 0c\n"));
+
+    input_log_skip(&input_log_test, 4);
+    TEST_ASSERT_EQUAL_UINT64(5, input_log_next_cycle(&input_log_test));
+    input_log_skip(&input_log_test, 7);
+    TEST_ASSERT_EQUAL_UINT64(12, input_log_next_cycle(&input_log_test));
+    input_log_skip(&input_log_test, 100);
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, input_log_next_cycle(&input_log_test));
+}
+
+/* The uart only took part of the input, the rest is logged at a later cycle */
+void test_INPUT_LOG_record(void)
+{
+    uint8_t buf[INPUT_LOG_BUF_SIZE] = {0};
+    char log[64] = {0};
+
+    input_log_record(&input_log_test, input_log_test_file(""));
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, input_log_next_cycle(&input_log_test));
+
+    TEST_ASSERT_EQUAL(0, input_log_due(&input_log_test, 10, buf));
+    TEST_ASSERT_EQUAL(3, input_log_queue(&input_log_test, (const uint8_t *)"abc", 3));
+
+    TEST_ASSERT_EQUAL(3, input_log_due(&input_log_test, 20, buf));
+    input_log_consumed(&input_log_test, 20, 2);
+    TEST_ASSERT_EQUAL(1, input_log_due(&input_log_test, 30, buf));
+    TEST_ASSERT_EQUAL_HEX8('c', buf[0]);
+
+    TEST_ASSERT_EQUAL(1, input_log_queue(&input_log_test, (const uint8_t *)"d", 1));
+    TEST_ASSERT_EQUAL(2, input_log_due(&input_log_test, 40, buf));
+    input_log_consumed(&input_log_test, 40, 2);
+    TEST_ASSERT_EQUAL(0, input_log_due(&input_log_test, 50, buf));
+
+    TEST_ASSERT_EQUAL_STRING("20 6162\n40 6364\n", input_log_test_read(log, sizeof(log)));
+}
+
+void test_INPUT_LOG_queue_full(void)
+{
+    uint8_t input[INPUT_LOG_BUF_SIZE + 16] = {0};
+
+    input_log_record(&input_log_test, input_log_test_file(""));
+
+    TEST_ASSERT_EQUAL(INPUT_LOG_BUF_SIZE - 16, input_log_queue(&input_log_test, input, INPUT_LOG_BUF_SIZE - 16));
+    TEST_ASSERT_EQUAL(16, input_log_queue(&input_log_test, input, sizeof(input)));
+    TEST_ASSERT_EQUAL(0, input_log_queue(&input_log_test, input, 1));
+}
+
+static void input_log_test_consume_one(void)
+{
+    input_log_consumed(&input_log_test, 5, 1);
+}
+
+static void input_log_test_skip(void)
+{
+    input_log_skip(&input_log_test, 5);
+}
+
+static void input_log_test_replay(void)
+{
+    input_log_replay(&input_log_test, input_log_file);
+}
+
+void test_INPUT_LOG_diverged(void)
+{
+    uint8_t buf[INPUT_LOG_BUF_SIZE] = {0};
+
+    input_log_replay(&input_log_test, input_log_test_file("5 0a0b\n"));
+    TEST_ASSERT_EQUAL(2, input_log_due(&input_log_test, 5, buf));
+
+    /* the uart had room for all of it while recording */
+    TEST_ASSERT_TRUE(test_child_dies(input_log_test_consume_one));
+
+    input_log_consumed(&input_log_test, 5, 2);
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, input_log_next_cycle(&input_log_test));
+}
+
+void test_INPUT_LOG_malformed(void)
+{
+    /* an entry is only read once the one before it was passed on */
+    input_log_replay(&input_log_test, input_log_test_file("5 0a\n7\n"));
+    TEST_ASSERT_EQUAL_UINT64(5, input_log_next_cycle(&input_log_test));
+    TEST_ASSERT_TRUE(test_child_dies(input_log_test_consume_one));
+    TEST_ASSERT_TRUE(test_child_dies(input_log_test_skip));
+
+    input_log_test_file("x 0a\n");
+    TEST_ASSERT_TRUE(test_child_dies(input_log_test_replay));
+    input_log_test_file("5 0a\n");
+    TEST_ASSERT_FALSE(test_child_dies(input_log_test_replay));
+}
+
+int main() 
+{
+    UnityBegin("soc/unit_tests.c");
+    RUN_TEST(test_EVENT_QUEUE_order, __LINE__);
+    RUN_TEST(test_EVENT_QUEUE_reschedule, __LINE__);
+    RUN_TEST(test_EVENT_QUEUE_cancel, __LINE__);
+    RUN_TEST(test_EVENT_QUEUE_cancel_reorder, __LINE__);
+    RUN_TEST(test_EVENT_QUEUE_periodic, __LINE__);
+    RUN_TEST(test_EVENT_QUEUE_raise, __LINE__);
+
+    RUN_TEST(test_BUS_MAP_lookup, __LINE__);
+    RUN_TEST(test_BUS_MAP_page_sharing, __LINE__);
+    #ifdef RV64
+        RUN_TEST(test_BUS_MAP_above_table, __LINE__);
+    #endif
+    RUN_TEST(test_BUS_MAP_overlap, __LINE__);
+
+    RUN_TEST(test_INPUT_LOG_parse, __LINE__);
+    RUN_TEST(test_INPUT_LOG_skip, __LINE__);
+    RUN_TEST(test_INPUT_LOG_record, __LINE__);
+    RUN_TEST(test_INPUT_LOG_queue_full, __LINE__);
+    RUN_TEST(test_INPUT_LOG_diverged, __LINE__);
+    RUN_TEST(test_INPUT_LOG_malformed, __LINE__);
+
+    return (UnityEnd());
+}